@@ -6,6 +6,9 @@
 #include "utils.hpp"
 #include "node.hpp"
 #include "astar_ddd/astar_ddd_open_list.hpp"
+#include "utils/options.hpp"
+#include "utils/checkpoint.hpp"
+#include "hash_functions/tabulation_hash.hpp"
 
 #include <cmath>
 #include <tuple>
@@ -15,48 +18,113 @@ using namespace std;
 
 namespace astar_ddd {
 
-template<class D> class AstarDDD : public SearchAlg<D> {
+template<class D, class Layout = FullLayout>
+class AstarDDD : public SearchAlg<D> {
 
-    AstarDDDOpenList<Node<D> > open;
+    utils::Checkpointer checkpointer;
+    AstarDDDOpenList<Node<D, Layout> > open;
     
     std::vector<typename D::State> path;
 
+    // nodes popped at once, a read buffer of them
+    const size_t batch_size =
+        BUFFER_BYTES / Node<D, Layout>::get_size_in_bytes();
+    std::vector<Node<D, Layout> > batch;
+
+    // Expands n, or reconstructs the path if n is a goal. Returns true if
+    // the goal was reached.
+    bool expand(Node<D, Layout> n) {
+        typename D::State state;
+        this->dom.unpack(state, n.packed);
+
+        if (this->dom.isgoal(state)) {
+            // trace path here
+            path.push_back(state);
+            while(n.packed != n.parent_packed) {
+                Node<D, Layout> parent = open.trace_parent(n);
+                typename D::State parent_state;
+                this->dom.unpack(parent_state, parent.packed);
+                path.push_back(parent_state);
+                n = parent;
+            }
+            open.print_statistics();
+            checkpointer.print_statistics();
+            checkpointer.clear();
+            open.clear();
+            return true;
+        }
+
+        this->expd++;
+        for (int i = 0; i < this->dom.nops(state); i++) {
+            int op = this->dom.nthop(state, i);
+            if (op == n.pop)
+                continue;
+            this->gend++;
+            Edge<D> e = this->dom.apply(state, op);
+            open.push(wrap(state, &n, e.cost, e.pop));
+            this->dom.undo(state, e);
+        }
+        return false;
+    }
+
+    void save(utils::Manifest& manifest, typename D::State &init) {
+        manifest.set_string("algorithm", "astar_ddd");
+        manifest.set_int("initial state", wrap(init, nullptr, 0, -1)
+                         .packed.hash());
+        manifest.set_int("expanded", this->expd);
+        manifest.set_int("generated", this->gend);
+        manifest.set_string("node layout", Layout::get_name());
+        manifest.set_string("hash generator",
+                            TabulationHash<Node<D, Layout> >::get_generator_state());
+        open.checkpoint(manifest);
+    }
+
+    void restore(typename D::State &init) {
+        auto manifest = checkpointer.load();
+        if (manifest.get_string("algorithm") != "astar_ddd" ||
+            static_cast<unsigned long>(manifest.get_int("initial state")) !=
+            wrap(init, nullptr, 0, -1).packed.hash())
+            throw Fatal("Checkpoint is of another search");
+        if (manifest.get_string("node layout") != Layout::get_name())
+            throw Fatal("Checkpoint was written with another node layout");
+        this->expd = manifest.get_int("expanded");
+        this->gend = manifest.get_int("generated");
+        TabulationHash<Node<D, Layout> >::set_generator_state
+            (manifest.get_string("hash generator"));
+        open.restore(manifest);
+    }
+
 public:
-    AstarDDD<D>(D &d) : SearchAlg<D>(d),
-        open(true) { }
+    static void add_option_names(std::set<std::string>& names) {
+        utils::Checkpointer::add_option_names(names);
+        RecordFileOptions::add_option_names(names);
+    }
+
+    AstarDDD(D &d, const utils::Options& options = utils::Options()) :
+        SearchAlg<D>(d),
+        checkpointer(options),
+        open(true, checkpointer, RecordFileOptions::from(options)) { }
 
     std::vector<typename D::State> search(typename D::State &init) {
-        open.push(wrap(init, nullptr, 0, -1));
+        if (checkpointer.is_resuming()) {
+            restore(init);
+        } else {
+            open.push(wrap(init, nullptr, 0, -1));
+        }
 
         while (path.size() == 0) {
             try {
-                Node<D> n = open.pop();
-
-                typename D::State state;
-                this->dom.unpack(state, n.packed);
-
-                if (this->dom.isgoal(state)) {
-                    // trace path here
-                    path.push_back(state);
-                    while(n.packed != n.parent_packed) {
-                        Node<D> parent = open.trace_parent(n);
-                        typename D::State parent_state;
-                        this->dom.unpack(parent_state, parent.packed);
-                        path.push_back(parent_state);
-                        n = parent;
-                    }
-                    open.clear();
-                    break;
+                if (checkpointer.is_due() && open.can_checkpoint()) {
+                    checkpointer.write([this, &init](utils::Manifest& manifest) {
+                            save(manifest, init);
+                        });
                 }
-                this->expd++;
-                for (int i = 0; i < this->dom.nops(state); i++) {
-                    int op = this->dom.nthop(state, i);
-                    if (op == n.pop)
-                        continue;
-                    this->gend++;
-                    Edge<D> e = this->dom.apply(state, op);
-                    open.push(wrap(state, &n, e.cost, e.pop));
-                    this->dom.undo(state, e);
+
+                // a run of the next bucket, read at once
+                batch.clear();
+                open.pop_batch(batch_size, batch);
+                for (auto& n : batch) {
+                    if (expand(n)) break;
                 }
             } catch (OpenListEmpty& e) {
                 break;
@@ -67,8 +135,8 @@ public:
         return path;
     }
 
-    Node<D> wrap(typename D::State &s, Node<D>* p, int c, int pop) {
-        Node<D> n;
+    Node<D, Layout> wrap(typename D::State &s, Node<D, Layout>* p, int c, int pop) {
+        Node<D, Layout> n;
         n.g = c;
         if (p)
             n.g += p->g;
@@ -4,13 +4,18 @@
 #ifndef ASTAR_DDD_OPEN_LIST_HPP
 #define ASTAR_DDD_OPEN_LIST_HPP
 
+#include "../node.hpp"
 #include "../utils/memory.hpp"
-#include "../utils/named_fstream.hpp"
+#include "../utils/record_file.hpp"
 #include "../utils/errors.hpp"
+#include "../utils/checkpoint.hpp"
+#include "../fatal.hpp"
 #include "../hash_functions/tabulation_hash.hpp"
+#include "../compress/push_buffer.hpp"
 
 #include <utility>
 #include <vector>
+#include <algorithm>
 #include <string>
 #include <memory>
 #include <limits>
@@ -42,11 +47,22 @@ namespace astar_ddd {
         bool first_insert = true; // to initialize min_f
         int current_bucket = 0; // current bucket being expanded
         
-        vector<unique_ptr<named_fstream> > open_buckets;
-        vector<unique_ptr<named_fstream> > next_buckets;
-        vector<unique_ptr<named_fstream> > closed_buckets;
+        // before the buckets, which wait for their reads and writes when
+        // destroyed
+        unique_ptr<utils::CompressionStats> compression;
+        unique_ptr<utils::WriteBehind> writer;
+        unique_ptr<utils::ReadAhead> reader;
+        vector<unique_ptr<RecordFile> > open_buckets;
+        vector<unique_ptr<RecordFile> > next_buckets;
+        vector<unique_ptr<RecordFile> > closed_buckets;
 
-        unique_ptr<named_fstream> recursive_bucket; // for recursive expansion
+        unique_ptr<RecordFile> recursive_bucket; // for recursive expansion
+
+        // Open and next buckets are rewritten by remove_duplicates into files
+        // of the next generation, the previous ones being retired.
+        utils::Checkpointer& checkpointer;
+        RecordFileOptions bucket_options;
+        int generation = 0;
 
         void create_bucket(int bucket_index, BucketType bucket_type);
         string get_bucket_string(int bucket_index, BucketType bucket_type) const;
@@ -54,57 +70,144 @@ namespace astar_ddd {
         TabulationHash<Entry> bucket_hasher;
         TabulationHash<Entry> dd_hasher; // duplicate detection
 
+        // Entries for next buckets are staged in a push buffer of each until
+        // it is full, or the next buckets are read, so that duplicates among
+        // them are combined before they are written.
+        using Staging = compress::PushBuffer<Entry, TabulationHash<Entry> >;
+        vector<unique_ptr<Staging> > next_staged;
+        size_t n_combined = 0;
+
+        void push_next(int bucket_index, const Entry& entry);
+        void flush_next(int bucket_index);
+
         // for temp logging
         size_t max_bucket_size_in_bytes = 0;
         
     public:
-        AstarDDDOpenList(bool reopen_closed);
+        AstarDDDOpenList(bool reopen_closed, utils::Checkpointer& checkpointer,
+                         const RecordFileOptions& bucket_options =
+                         RecordFileOptions());
         ~AstarDDDOpenList() = default;
 
         void push(const Entry& entry);
         Entry pop();
+        // Appends to entries up to max entries to expand, all of the
+        // recursive bucket or all of the current bucket and read at once, and
+        // returns their number. Throws OpenListEmpty if there are none.
+        size_t pop_batch(size_t max, vector<Entry>& entries);
         void clear();
+
+        // Only possible while the recursive bucket is empty, as it is a stack
+        // that is popped from and appended to again.
+        bool can_checkpoint();
+        // Records buckets and offsets in the manifest, with their files synced
+        void checkpoint(utils::Manifest& manifest);
+        void restore(const utils::Manifest& manifest);
         
         Entry trace_parent(const Entry &entry);
+
+        void print_statistics() {
+            if (writer) writer->print_statistics();
+            if (reader) reader->print_statistics();
+            if (compression) compression->print_statistics();
+            dfpair(stdout, "open list combined duplicates", "%lu", n_combined);
+            dfpair(stdout, "open list peak disk (bytes)", "%ld",
+                   RecordFile::get_peak_disk_bytes());
+        }
     };
     
     template<class Entry>
-    AstarDDDOpenList<Entry>::AstarDDDOpenList(bool reopen_closed) :
+    AstarDDDOpenList<Entry>::AstarDDDOpenList(bool reopen_closed,
+                                              utils::Checkpointer& checkpointer,
+                                              const RecordFileOptions& bucket_options) :
         reopen_closed(reopen_closed),
         open_buckets(n_buckets),
         next_buckets(n_buckets),
-        closed_buckets(n_buckets)
+        closed_buckets(n_buckets),
+        checkpointer(checkpointer),
+        bucket_options(bucket_options),
+        next_staged(n_buckets)
     {
         // create directory for open list files if not exist
         mkdir("open_list_buckets", 0744);
+        if (bucket_options.compress) {
+            compression = memory::make_unique<utils::CompressionStats>();
+            this->bucket_options.compression = compression.get();
+        }
+        if (bucket_options.write_behind > 0) {
+            writer = memory::make_unique<utils::WriteBehind>
+                (bucket_options.write_behind);
+            this->bucket_options.writer = writer.get();
+        }
+        if (bucket_options.read_ahead) {
+            reader = memory::make_unique<utils::ReadAhead>();
+            this->bucket_options.reader = reader.get();
+        }
         
-        recursive_bucket = memory::make_unique<named_fstream>
-            ("open_list_buckets/recursive.bucket");
+        if (bucket_options.push_buffer > 0) {
+            for (auto& buffer : next_staged)
+                buffer = memory::make_unique<Staging>
+                    (bucket_options.push_buffer, dd_hasher);
+        }
 
-        // create buckets
-        for (int i = 0; i < n_buckets; ++i) {
+        recursive_bucket = memory::make_unique<RecordFile>
+            ("open_list_buckets/recursive.bucket", Entry::get_size_in_bytes(),
+             this->bucket_options);
+
+        // create buckets, unless they are restored from a checkpoint
+        for (int i = 0; i < n_buckets && !checkpointer.is_resuming(); ++i) {
             create_bucket(i, BucketType::open);
             create_bucket(i, BucketType::next);
             create_bucket(i, BucketType::closed);
         }
         dfpair(stdout, "number of hash buckets", "%d", n_buckets);
+        dfpair(stdout, "open list storage", "%s",
+               utils::get_storage_backend_name(bucket_options.backend));
+        dfpair(stdout, "open list push buffer (nodes)", "%lu",
+               bucket_options.push_buffer);
+    }
+
+    template<class Entry>
+    void AstarDDDOpenList<Entry>::push_next(int bucket_index,
+                                            const Entry& entry) {
+        auto& buffer = next_staged[bucket_index];
+        if (!buffer) {
+            entry.write(*next_buckets[bucket_index]);
+            return;
+        }
+        if (!buffer->push(entry)) {
+            ++n_combined;
+            return;
+        }
+        if (buffer->is_full()) flush_next(bucket_index);
+    }
+
+    template<class Entry>
+    void AstarDDDOpenList<Entry>::flush_next(int bucket_index) {
+        auto& buffer = next_staged[bucket_index];
+        if (!buffer || buffer->is_empty()) return;
+        auto& entries = buffer->get_entries();
+        Entry::write_many(*next_buckets[bucket_index], entries.data(),
+                          entries.size());
+        buffer->clear();
     }
 
     template<class Entry>
     void AstarDDDOpenList<Entry>::
     remove_duplicates() {
         min_f = numeric_limits<int>::max();
+        ++generation;
         
         for (int i = 0; i < n_buckets; ++i) { // for each bucket
 
             unordered_set<Entry, decltype(dd_hasher) > hash_table;
 
             // hash next list entries
-            next_buckets[i]->clear();
-            next_buckets[i]->seekg(0, ios::beg);
+            flush_next(i);
+            next_buckets[i]->set_read_offset(0);
+            NodeReader<Entry> next_reader(*next_buckets[i]);
             Entry next_entry;
-            next_entry.read(*next_buckets[i]);
-            while (!next_buckets[i]->eof()) {
+            while (next_reader.read(next_entry)) {
                 auto it = hash_table.find(next_entry);
                 if (it != hash_table.end()) {
                     if (it->g > next_entry.g) {
@@ -114,45 +217,53 @@ namespace astar_ddd {
                 } else {
                     hash_table.insert(next_entry);
                 }
-                next_entry.read(*next_buckets[i]);
             }
             
             size_t bucket_size_in_bytes = hash_table.size() * sizeof(Entry);
             if (bucket_size_in_bytes > max_bucket_size_in_bytes)
                 max_bucket_size_in_bytes = bucket_size_in_bytes; 
+            checkpointer.retire(*next_buckets[i]);
             next_buckets[i].reset(nullptr);
             create_bucket(i, BucketType::next);
-            next_buckets[i]->clear();
-            next_buckets[i]->seekg(0, ios::beg);
 
             // hash closed list entries against next list entries, deleting
             // duplicates
-            closed_buckets[i]->clear();
-            closed_buckets[i]->seekg(0, ios::beg);
-            Entry closed_entry;
-            closed_entry.read(*closed_buckets[i]);
-            while (!closed_buckets[i]->eof()) {
+            closed_buckets[i]->set_read_offset(0);
+            NodeReader<Entry> closed_reader(*closed_buckets[i]);
+            Entry closed_entry{};
+            while (closed_reader.read(closed_entry)) {
                 auto it = hash_table.find(closed_entry);
                 if (it != hash_table.end()) {
                     hash_table.erase(it);
                 }
-                closed_entry.read(*closed_buckets[i]);
             }
-            closed_buckets[i]->clear();
-            closed_buckets[i]->seekg(0, ios::end);
 
+            checkpointer.retire(*open_buckets[i]);
             open_buckets[i].reset(nullptr); // erase old open bucket
             create_bucket(i, BucketType::open);
-            open_buckets[i]->clear();
-            open_buckets[i]->seekg(0, ios::beg);
             
+            vector<Entry> run;
+            if (compression) {
+                // in the order of states, so that each differs little from
+                // the one before, for the codec
+                run.assign(hash_table.begin(), hash_table.end());
+                hash_table.clear();
+                sort(run.begin(), run.end());
+                for (auto& entry : run)
+                    if (entry.f < min_f) min_f = entry.f;
+                Entry::write_many(*open_buckets[i], run.data(), run.size());
+                continue;
+            }
+            run.reserve(BUFFER_BYTES / Entry::get_size_in_bytes());
             for (auto& entry : hash_table) {
                 if (entry.f < min_f) min_f = entry.f;
-                entry.write(*open_buckets[i]);
+                run.push_back(entry);
+                if (run.size() == run.capacity()) {
+                    Entry::write_many(*open_buckets[i], run.data(), run.size());
+                    run.clear();
+                }
             }
-            // reset open
-            open_buckets[i]->clear();
-            open_buckets[i]->seekg(0, ios::beg);
+            Entry::write_many(*open_buckets[i], run.data(), run.size());
         }
         if (min_f ==  numeric_limits<int>::max()) {
             throw OpenListEmpty();
@@ -173,59 +284,102 @@ namespace astar_ddd {
         if (first_insert) {
             min_f = entry.f;
             entry.write(*open_buckets[bucket_index]);
-            open_buckets[bucket_index]->clear();
-            open_buckets[bucket_index]->seekg(0, ios::beg);
             first_insert = false;
             return;
         }
         
         
-        if (!entry.write(*next_buckets[bucket_index]))
-            throw IOException("Fail to write state to fstream.");
-
+        push_next(bucket_index, entry);
     }
 
     template<class Entry>
     Entry AstarDDDOpenList<Entry>::pop() {
         //cout << "removing min" << endl;
         Entry min_entry;
-        if (recursive_bucket->tellg() != 0) {
-            recursive_bucket->seekg(-Entry::get_size_in_bytes(), ios::cur);
-            min_entry.read(*recursive_bucket);
-            recursive_bucket->seekg(-Entry::get_size_in_bytes(), ios::cur);
+        if (min_entry.pop_back(*recursive_bucket)) {
             min_entry.write(*closed_buckets[bucket_hasher(min_entry) % n_buckets]);
             return min_entry;
         }
     
         while (current_bucket != n_buckets) {
             // attempt read from current bucket
-            min_entry.read(*open_buckets[current_bucket]);
-            //cout << " reading entry " << endl;
-            if (open_buckets[current_bucket]->eof()) { // exhausted current bucket
+            if (!min_entry.read(*open_buckets[current_bucket])) {
+                // exhausted current bucket
                 ++current_bucket;
                 continue;
             }
             
+            // the next bucket is read ahead while this one is expanded, and
+            // the space of what was read of this one given back
+            if (reader && current_bucket + 1 != n_buckets)
+                open_buckets[current_bucket + 1]->prefetch();
+            open_buckets[current_bucket]->reclaim();
+
             if (min_entry.f == min_f) {
                 min_entry.write(*closed_buckets[current_bucket]);
                 return min_entry;
             } else {
                 // transfer unexpanded to next bucket
-                min_entry.write(*next_buckets[current_bucket]);
+                push_next(current_bucket, min_entry);
             }
         }
 
         // exhausted all buckets
         remove_duplicates();
         current_bucket = 0;
-        recursive_bucket.reset(nullptr);
-        recursive_bucket =
-            memory::make_unique<named_fstream>
-            (string("open_list_buckets/recursive.bucket"));
-         
         return pop();
     }
 
+    template<class Entry>
+    size_t AstarDDDOpenList<Entry>::pop_batch(size_t max,
+                                              vector<Entry>& entries) {
+        auto first = entries.size();
+        Entry entry;
+        while (entries.size() - first < max &&
+               entry.pop_back(*recursive_bucket)) {
+            entry.write(*closed_buckets[bucket_hasher(entry) % n_buckets]);
+            entries.push_back(entry);
+        }
+        if (entries.size() > first || max == 0) return entries.size() - first;
+
+        while (current_bucket != n_buckets) {
+            entries.resize(first + max);
+            auto n_read = Entry::read_many(*open_buckets[current_bucket],
+                                           &entries[first], max);
+            if (n_read == 0) {
+                // exhausted current bucket
+                entries.resize(first);
+                ++current_bucket;
+                continue;
+            }
+
+            // the next bucket is read ahead while this one is expanded, and
+            // the space of what was read of this one given back
+            if (reader && current_bucket + 1 != n_buckets)
+                open_buckets[current_bucket + 1]->prefetch();
+            open_buckets[current_bucket]->reclaim();
+
+            // keep those to expand, transfer unexpanded to next bucket
+            auto last = first;
+            for (auto i = first; i < first + n_read; ++i) {
+                if (entries[i].f == min_f) {
+                    entries[last++] = entries[i];
+                } else {
+                    push_next(current_bucket, entries[i]);
+                }
+            }
+            entries.resize(last);
+            Entry::write_many(*closed_buckets[current_bucket],
+                              entries.data() + first, last - first);
+            if (last > first) return last - first;
+        }
+
+        // exhausted all buckets
+        remove_duplicates();
+        current_bucket = 0;
+        return pop_batch(max, entries);
+    }
+
 
     template<class Entry>
     void AstarDDDOpenList<Entry>::clear() {
@@ -238,6 +392,67 @@ namespace astar_ddd {
         dfpair(stdout, "max bucket size (bytes)", "%lu", max_bucket_size_in_bytes);
     }
 
+    template<class Entry>
+    bool AstarDDDOpenList<Entry>::can_checkpoint() {
+        return recursive_bucket->is_empty();
+    }
+
+    template<class Entry>
+    void AstarDDDOpenList<Entry>::checkpoint(utils::Manifest& manifest) {
+        for (int i = 0; i < n_buckets; ++i) {
+            flush_next(i);
+            std::ostringstream oss;
+            for (auto bucket : { open_buckets[i].get(), next_buckets[i].get(),
+                        closed_buckets[i].get() }) {
+                // only open buckets are read from
+                off_t offset = 0;
+                if (bucket == open_buckets[i].get()) {
+                    offset = bucket->get_read_offset();
+                    bucket->keep_from(offset);
+                }
+                bucket->sync();
+                oss << bucket->get_file_name() << " " << offset << " "
+                    << bucket->get_size() << " ";
+            }
+            manifest.set_string("ddd bucket " + to_string(i), oss.str());
+        }
+        manifest.set_int("ddd buckets", n_buckets);
+        manifest.set_int("ddd min f", min_f);
+        manifest.set_int("ddd first insert", first_insert);
+        manifest.set_int("ddd current bucket", current_bucket);
+        manifest.set_int("ddd generation", generation);
+        manifest.set_int("ddd max bucket size", max_bucket_size_in_bytes);
+    }
+
+    template<class Entry>
+    void AstarDDDOpenList<Entry>::restore(const utils::Manifest& manifest) {
+        if (manifest.get_int("ddd buckets") != n_buckets)
+            throw Fatal("Checkpoint has another number of buckets");
+        for (int i = 0; i < n_buckets; ++i) {
+            std::istringstream iss(manifest.get_string("ddd bucket " +
+                                                       to_string(i)));
+            for (auto bucket : { &open_buckets[i], &next_buckets[i],
+                        &closed_buckets[i] }) {
+                string file_name;
+                off_t offset;
+                size_t size;
+                iss >> file_name >> offset >> size;
+                // drop what was appended after the checkpoint
+                utils::truncate_file(file_name, size);
+                *bucket = memory::make_unique<RecordFile>
+                    (file_name, Entry::get_size_in_bytes(), bucket_options,
+                     false);
+                (*bucket)->set_read_offset(offset);
+                (*bucket)->keep_from(offset);
+            }
+        }
+        min_f = manifest.get_int("ddd min f");
+        first_insert = manifest.get_int("ddd first insert");
+        current_bucket = manifest.get_int("ddd current bucket");
+        generation = manifest.get_int("ddd generation");
+        max_bucket_size_in_bytes = manifest.get_int("ddd max bucket size");
+    }
+
     template<class Entry>
     string AstarDDDOpenList<Entry>::
     get_bucket_string(int bucket_index, BucketType bucket_type) const {
@@ -246,34 +461,25 @@ namespace astar_ddd {
         if (bucket_type == BucketType::next) bucket_type_str = "next";
         if (bucket_type == BucketType::closed) bucket_type_str = "closed";
         std::ostringstream oss;
-        oss << "open_list_buckets/" <<  bucket_index << "_" << bucket_type_str << ".bucket";
+        oss << "open_list_buckets/" <<  bucket_index << "_" << bucket_type_str;
+        // closed buckets are only appended to, and never rewritten
+        if (bucket_type != BucketType::closed) oss << "_" << generation;
+        oss << ".bucket";
         return oss.str();
     }
 
     template<class Entry>
     void AstarDDDOpenList<Entry>::
     create_bucket(int bucket_index, BucketType bucket_type) {
-        if (bucket_type == BucketType::open) {
-            open_buckets[bucket_index] =
-                memory::make_unique<named_fstream>
-                (get_bucket_string(bucket_index, bucket_type));
-            if (!open_buckets[bucket_index]->is_open())
-                throw IOException("Fail to open open list fstream.");
-        }
-        if (bucket_type == BucketType::next) {
-            next_buckets[bucket_index] =
-                memory::make_unique<named_fstream>
-                (get_bucket_string(bucket_index,bucket_type));
-            if (!next_buckets[bucket_index]->is_open())
-                throw IOException("Fail to open open list fstream.");
-        }
-        if (bucket_type == BucketType::closed) {
-            closed_buckets[bucket_index] =
-                memory::make_unique<named_fstream>
-                (get_bucket_string(bucket_index, bucket_type));
-            if (!closed_buckets[bucket_index]->is_open())
-                throw IOException("Fail to open open list fstream.");
-        }
+        auto bucket = memory::make_unique<RecordFile>
+            (get_bucket_string(bucket_index, bucket_type),
+             Entry::get_size_in_bytes(), bucket_options);
+        if (bucket_type == BucketType::open)
+            open_buckets[bucket_index] = move(bucket);
+        if (bucket_type == BucketType::next)
+            next_buckets[bucket_index] = move(bucket);
+        if (bucket_type == BucketType::closed)
+            closed_buckets[bucket_index] = move(bucket);
     }
 
     template<class Entry>
@@ -284,17 +490,14 @@ namespace astar_ddd {
         
         // check parent hash bucket only
         int bucket_index = bucket_hasher(entry.parent_packed) % n_buckets;
-        closed_buckets[bucket_index]->clear();
-        closed_buckets[bucket_index]->seekg(0, ios::beg);
-
-        Entry closed_entry;
-        closed_entry.read(*closed_buckets[bucket_index]);
-        while (!closed_buckets[bucket_index]->eof()) {
+        closed_buckets[bucket_index]->set_read_offset(0);
+        NodeReader<Entry> closed_reader(*closed_buckets[bucket_index]);
+        Entry closed_entry{};
+        while (closed_reader.read(closed_entry)) {
             if (closed_entry.packed ==
                 entry.parent_packed) {
                 return closed_entry;
             }
-            closed_entry.read(*closed_buckets[bucket_index]);
         }
         return Entry();
     }
@@ -2,136 +2,273 @@
 // Modified, Copyright 2017 Shunji Lin. All rights reserved.
 // Use of this source code is governed by an MIT-style
 // license that can be found in the LICENSE file.
-
-/*******************//**
- * WORK IN PROGRESS
- ***********************/
-
 #include "search.hpp"
 #include "utils.hpp"
 #include "node.hpp"
 
 #include "compress/compress_open_list.hpp"
 #include "compress/compress_closed_list_async.hpp"
+#include "compress/push_buffer.hpp"
 #include "utils/compunits.hpp"
-//#include "utils/scoped_thread.hpp"
+#include "utils/options.hpp"
+#include "utils/checkpoint.hpp"
+#include "utils/worker_pool.hpp"
+#include "utils/wall_timer.hpp"
+#include "hash_functions/tabulation_hash.hpp"
 
-#include <set>
-#include <future>
 #include <algorithm>
+#include <iostream>
+#include <limits>
 #include <thread>
 
 using namespace compunits;
 using namespace compress;
 
-const std::size_t N_THREADS = 32;//std::thread::hardware_concurrency() - 1;
-using FoundReopened = std::pair<bool, bool>;
+/*                                                                          \
+| A*-PIDD, A*-IDD that expands the nodes of the open list in rounds on a    |
+| pool of threads.                                                          |
+|                                                                           |
+| A round pops a batch of up to --batch nodes of the lowest f, combining    |
+| those of the same state, looks them up in the closed list at once, the    |
+| probes of each thread being read as one batch of its own, and expands     |
+| the new ones, each thread generating the children of its share. The       |
+| children are pushed to the open list in the order of the threads. Nodes   |
+| of a batch are of the same f, so that a goal is only found among nodes    |
+| of the lowest f.                                                          |
+\==========================================================================*/
 
 namespace astar_pidd {
 
-    template<class Domain>
-    struct NodeStats {
-        Node<Domain> node;
-        bool lookup;
-        bool found;
-        bool reopen;
-        bool first_probe;
-        size_t pointer;
-        NodeStats() : lookup(true), found(false), reopen(false),
-                      first_probe(true), pointer(0) {}
-        bool operator==(const NodeStats<Domain>& other) const {
-            return node == other.node;
-        }
-    };
+    template<class Domain, class Layout = FullLayout>
+    class AStarPIDD : public SearchAlg<Domain> {
 
-    template<class Domain> class AStarPIDD : public SearchAlg<Domain> {
+        // parsed before the closed list creates its files, so that an
+        // invalid option leaves none behind
+        RecordFileOptions bucket_options;
+        CompressClosedListAsync<Node<Domain, Layout> > closed;
+        // checkpoints are not supported, the open list never keeps files
+        utils::Checkpointer checkpointer{utils::Options()};
+        CompressOpenList<Node<Domain, Layout> > open;
 
-        CompressClosedListAsync<Node<Domain> > closed;
-        CompressOpenList<Node<Domain> > open;
-    
         std::vector<typename Domain::State> path;
 
+        utils::WorkerPool pool;
+
+        // nodes of a round, combined by state as they are popped
+        std::size_t batch_size;
+        TabulationHash<Node<Domain, Layout> > hasher;
+        PushBuffer<Node<Domain, Layout>,
+                   TabulationHash<Node<Domain, Layout> > > batch;
+        std::vector<Node<Domain, Layout> > run, nodes;
         std::size_t duplicates = 0;
 
-        std::vector<Node<Domain> > collect_unique_nodes(std::size_t n_nodes) {
-            // inefficient, could use a set here
-
-            //TODO: NEED TO ASSERT THAT LOWER G IS SELECTED
-            std::vector<Node<Domain> > nodes;
-            while (!open.isempty() &&
-                   nodes.size() < n_nodes) {
-                Node<Domain> node = open.pop();
-                auto it = std::find(nodes.begin(), nodes.end(), node);
-                if (it != nodes.end()) {
-                    if (it->g > node.g) it->g = node.g;
-                    ++duplicates;
-                } else {
-                    nodes.push_back(node);
-                }   
+        // of each thread in a round
+        std::vector<std::vector<Node<Domain, Layout> > > children;
+        std::vector<std::size_t> expanded;
+        std::vector<std::size_t> goals; // index in nodes of the first
+
+        // wall time of the phases of rounds, in seconds
+        struct RoundTimes {
+            std::size_t n_rounds = 0;
+            std::size_t n_nodes = 0;
+            double pop = 0;
+            double probe = 0;
+            double expand = 0;
+            double push = 0;
+            double slowest = 0;
+
+            void add(const RoundTimes& other) {
+                n_rounds += other.n_rounds;
+                n_nodes += other.n_nodes;
+                pop += other.pop;
+                probe += other.probe;
+                expand += other.expand;
+                push += other.push;
+                slowest = std::max(slowest, other.slowest);
+            }
+        };
+        // of the f layer being expanded, printed as a row when it is done
+        RoundTimes layer, total;
+        int layer_f = -1;
+
+        void finish_layer() {
+            if (layer.n_rounds == 0) return;
+            dfrow(stdout, "f layer", "duuggggg", static_cast<long>(layer_f),
+                  layer.n_rounds, layer.n_nodes, layer.pop, layer.probe,
+                  layer.expand, layer.push, layer.slowest);
+            total.add(layer);
+            layer = RoundTimes();
+        }
+
+        // Pops the nodes of the next round, all of the lowest f. Returns
+        // false if the open list is empty.
+        bool collect_unique_nodes() {
+            int f, front_f;
+            if (!open.get_front_f(f)) return false;
+            batch.clear();
+            while (!batch.is_full() && open.get_front_f(front_f) &&
+                   front_f == f) {
+                run.clear();
+                open.pop_batch(batch_size - batch.get_entries().size(), run);
+                for (auto& node : run) {
+                    // the one of lower g is kept
+                    if (!batch.push(node)) ++duplicates;
+                }
+            }
+            nodes.assign(batch.get_entries().begin(),
+                         batch.get_entries().end());
+            return true;
+        }
+
+        // expands the share of thread of nodes into children[thread]
+        void expand(unsigned thread) {
+            auto& generated = children[thread];
+            generated.clear();
+            expanded[thread] = 0;
+            goals[thread] = std::numeric_limits<std::size_t>::max();
+            for (auto i = pool.get_first(nodes.size(), thread);
+                 i < pool.get_first(nodes.size(), thread + 1); ++i) {
+                auto& n = nodes[i];
+                typename Domain::State state;
+                this->dom.unpack(state, n.packed);
+
+                if (this->dom.isgoal(state)) {
+                    goals[thread] = std::min(goals[thread], i);
+                    continue;
+                }
+
+                ++expanded[thread];
+                for (int op_index = 0; op_index < this->dom.nops(state);
+                     op_index++) {
+                    int op = this->dom.nthop(state, op_index);
+                    if (op == n.pop)
+                        continue;
+                    Edge<Domain> e = this->dom.apply(state, op);
+                    generated.push_back(wrap(state, &n, e.cost, e.pop));
+                    this->dom.undo(state, e);
+                }
+            }
+        }
+
+        void trace_path(Node<Domain, Layout> n) {
+            typename Domain::State state;
+            this->dom.unpack(state, n.packed);
+            path.push_back(state);
+            while(n.packed != n.parent_packed) {
+                Node<Domain, Layout> parent = closed.trace_parent(n);
+                typename Domain::State parent_state;
+                this->dom.unpack(parent_state, parent.packed);
+                path.push_back(parent_state);
+                n = parent;
             }
-            return nodes;
+        }
+
+        void print_statistics() {
+            closed.print_statistics();
+            open.print_statistics();
+            pool.print_statistics();
+            dfpair(stdout, "pidd rounds", "%lu", total.n_rounds);
+            dfpair(stdout, "pidd batch duplicates", "%lu", duplicates);
+            std::cout << "#pair  \"pidd pop time (s)\"   "
+                 << "\"" << total.pop << "\"" << std::endl;
+            std::cout << "#pair  \"pidd probe time (s)\"   "
+                 << "\"" << total.probe << "\"" << std::endl;
+            std::cout << "#pair  \"pidd expand time (s)\"   "
+                 << "\"" << total.expand << "\"" << std::endl;
+            std::cout << "#pair  \"pidd push time (s)\"   "
+                 << "\"" << total.push << "\"" << std::endl;
+            std::cout << "#pair  \"pidd slowest round (s)\"   "
+                 << "\"" << total.slowest << "\"" << std::endl;
+        }
+
+        static unsigned get_n_threads(const utils::Options& options) {
+            long n_threads = options.get_int
+                ("threads", std::max(1u, std::thread::hardware_concurrency()));
+            if (n_threads < 1)
+                throw Fatal("--threads must be at least 1, not %ld",
+                            n_threads);
+            return n_threads;
         }
 
     public:
-        AStarPIDD(Domain &d) : SearchAlg<Domain>(d),
-            closed(true, true, true, 950_MiB), // TODO: move to user option
-            open() {
-            std::cout << N_THREADS << " concurrent threads are supported.\n";
+        // --threads and --batch, and those of its lists; checkpoints are not
+        // supported, and the closed list always flushes on the round's thread
+        static void add_option_names(std::set<std::string>& names) {
+            ClosedListOptions::add_option_names(names);
+            names.erase("closed-background-flush");
+            RecordFileOptions::add_option_names(names);
+            names.insert({ "threads", "batch" });
+        }
+
+        AStarPIDD(Domain &d,
+                  const utils::Options& options = utils::Options()) :
+            SearchAlg<Domain>(d),
+            bucket_options(RecordFileOptions::from(options)),
+            closed(true, true, true, ClosedListOptions::from(options)),
+            open(checkpointer, bucket_options),
+            pool(get_n_threads(options)),
+            batch_size(std::max(1l, options.get_int("batch", 1024))),
+            batch(batch_size, hasher),
+            children(pool.get_n_threads()),
+            expanded(pool.get_n_threads()),
+            goals(pool.get_n_threads()) {
+            dfpair(stdout, "pidd threads", "%u", pool.get_n_threads());
+            dfpair(stdout, "pidd batch (nodes)", "%lu", batch_size);
         }
 
         std::vector<typename Domain::State>
         search(typename Domain::State &init) {
+            dfrowhdr(stdout, "f layer", 8, "f", "rounds", "nodes",
+                     "pop time (s)", "probe time (s)", "expand time (s)",
+                     "push time (s)", "slowest round (s)");
+            this->reopd = 0;
             open.push(wrap(init, nullptr, 0, -1));
 
-            while (!open.isempty() && path.size() == 0) {
-                // temporary placeholder for intermediate reopenings
-                std::vector<Node<Domain> > reopened_nodes;
-
-                auto nodes = collect_unique_nodes(N_THREADS);
-                
-                closed.batch_duplicate_detection(nodes);
-                               
-                for (std::size_t i = 0; i < nodes.size(); ++i) {
-                    auto n = nodes[i];
-                    
-                    typename Domain::State state;
-                    this->dom.unpack(state, n.packed);
-
-                    if (this->dom.isgoal(state)) {
-                        // trace path here
-                        path.push_back(state);
-                        while(n.packed != n.parent_packed) {
-                            Node<Domain> parent = closed.trace_parent(n);
-                            typename Domain::State parent_state;
-                            this->dom.unpack(parent_state, parent.packed);
-                            path.push_back(parent_state);
-                            n = parent;
-                        }
-                        closed.print_statistics();
-                        open.clear();
-                        closed.clear();
-                        std::cout << "duplicates " << duplicates << std::endl;
-                        return path;
-                    }
-
-                    this->expd++;
-                    for (int i = 0; i < this->dom.nops(state); i++) {
-                        int op = this->dom.nthop(state, i);
-                        if (op == n.pop)
-                            continue;
-                        this->gend++;
-                        Edge<Domain> e = this->dom.apply(state, op);
-                        open.push(wrap(state, &n, e.cost, e.pop));
-                        this->dom.undo(state, e);
-                    }
+            utils::WallTimer round_timer, timer;
+            while (path.size() == 0) {
+                round_timer.reset();
+                timer.reset();
+                if (!collect_unique_nodes()) break;
+                if (nodes[0].f != layer_f) {
+                    finish_layer();
+                    layer_f = nodes[0].f;
+                }
+                ++layer.n_rounds;
+                layer.n_nodes += nodes.size();
+                layer.pop += timer.get_seconds();
+
+                timer.reset();
+                this->reopd += closed.batch_duplicate_detection(nodes, pool);
+                layer.probe += timer.get_seconds();
+
+                timer.reset();
+                pool.run([this](unsigned thread) { expand(thread); });
+                auto goal = *std::min_element(goals.begin(), goals.end());
+                if (goal < nodes.size()) trace_path(nodes[goal]);
+                for (auto n : expanded) this->expd += n;
+                layer.expand += timer.get_seconds();
+
+                timer.reset();
+                for (auto& generated : children) {
+                    this->gend += generated.size();
+                    if (goal < nodes.size()) continue;
+                    for (auto& node : generated)
+                        open.push(node);
                 }
+                layer.push += timer.get_seconds();
+                layer.slowest = std::max<double>(layer.slowest,
+                                                 round_timer.get_seconds());
             }
+            finish_layer();
+            print_statistics();
+            open.clear();
+            closed.clear();
             return path;
         }
 
-        Node<Domain> wrap(typename Domain::State &s,
-                          Node<Domain>* p, int c, int pop) {
-            Node<Domain> n;
+        Node<Domain, Layout> wrap(typename Domain::State &s,
+                          Node<Domain, Layout>* p, int c, int pop) const {
+            Node<Domain, Layout> n;
             n.g = c;
             if (p)
                 n.g += p->g;
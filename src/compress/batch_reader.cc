@@ -0,0 +1,393 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#include "batch_reader.hpp"
+#include "../utils/errors.hpp"
+#include "../utils/memory.hpp"
+#include "../utils/wall_timer.hpp"
+#include "../utils.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <linux/aio_abi.h>
+
+using namespace std;
+
+namespace compress {
+
+    namespace {
+
+        size_t align_down(size_t value, size_t alignment) {
+            return value / alignment * alignment;
+        }
+
+        size_t align_up(size_t value, size_t alignment) {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+
+        class PreadBatchReader : public BatchReader {
+            struct Queued {
+                unsigned slot;
+                int fd;
+                char *buffer;
+                size_t length;
+                uint64_t offset;
+            };
+            vector<Queued> queued;
+        protected:
+            void queue(unsigned slot, int fd, char *buffer, size_t length,
+                       uint64_t offset) {
+                queued.push_back(Queued{slot, fd, buffer, length, offset});
+            }
+
+            void submit_and_wait(vector<Completion>& completions) {
+                for (auto& read : queued) {
+                    long result = pread(read.fd, read.buffer, read.length,
+                                        read.offset);
+                    completions.push_back(Completion{read.slot,
+                                result < 0 ? -errno : result});
+                }
+                queued.clear();
+            }
+        public:
+            PreadBatchReader(unsigned queue_depth, size_t alignment) :
+                BatchReader(queue_depth, alignment) {}
+
+            const char *get_name() const { return "pread"; }
+        };
+
+        class AioBatchReader : public BatchReader {
+            aio_context_t context = 0;
+            vector<iocb> iocbs;
+            vector<iocb *> pending;
+            vector<io_event> events;
+        protected:
+            void queue(unsigned slot, int fd, char *buffer, size_t length,
+                       uint64_t offset) {
+                iocb& cb = iocbs[slot];
+                memset(&cb, 0, sizeof(cb));
+                cb.aio_data = slot;
+                cb.aio_lio_opcode = IOCB_CMD_PREAD;
+                cb.aio_fildes = fd;
+                cb.aio_buf = reinterpret_cast<uint64_t>(buffer);
+                cb.aio_nbytes = length;
+                cb.aio_offset = offset;
+                pending.push_back(&cb);
+            }
+
+            void submit_and_wait(vector<Completion>& completions) {
+                size_t submitted = 0;
+                while (submitted < pending.size()) {
+                    long n = syscall(__NR_io_submit, context,
+                                     pending.size() - submitted,
+                                     pending.data() + submitted);
+                    if (n < 0) {
+                        if (errno == EINTR || errno == EAGAIN) continue;
+                        throw IOException("Fail to submit aio reads");
+                    }
+                    submitted += n;
+                }
+                pending.clear();
+                long n;
+                do {
+                    n = syscall(__NR_io_getevents, context, 1, events.size(),
+                                events.data(), NULL);
+                } while (n < 0 && errno == EINTR);
+                if (n < 0) throw IOException("Fail to reap aio reads");
+                for (long i = 0; i < n; ++i) {
+                    completions.push_back(
+                        Completion{static_cast<unsigned>(events[i].data),
+                                static_cast<long>(events[i].res)});
+                }
+            }
+        public:
+            AioBatchReader(unsigned queue_depth, size_t alignment) :
+                BatchReader(queue_depth, alignment),
+                iocbs(queue_depth),
+                events(queue_depth) {
+                if (syscall(__NR_io_setup, queue_depth, &context) < 0)
+                    throw IOException("Fail to set up aio context");
+            }
+
+            ~AioBatchReader() {
+                syscall(__NR_io_destroy, context);
+            }
+
+            const char *get_name() const { return "aio"; }
+        };
+
+        class IoUringBatchReader : public BatchReader {
+            int ring_fd;
+            io_uring_params params;
+
+            void *sq_ring = MAP_FAILED;
+            void *cq_ring = MAP_FAILED;
+            size_t sq_ring_bytes;
+            size_t cq_ring_bytes;
+            io_uring_sqe *sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+            size_t sqes_bytes;
+
+            unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+            unsigned *cq_head, *cq_tail, *cq_mask;
+            io_uring_cqe *cqes;
+
+            unsigned to_submit = 0;
+
+            void unmap() {
+                if (sqes != MAP_FAILED) munmap(sqes, sqes_bytes);
+                if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+                    munmap(cq_ring, cq_ring_bytes);
+                if (sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_bytes);
+            }
+
+        protected:
+            void queue(unsigned slot, int fd, char *buffer, size_t length,
+                       uint64_t offset) {
+                unsigned tail = *sq_tail;
+                unsigned index = tail & *sq_mask;
+                io_uring_sqe& sqe = sqes[index];
+                memset(&sqe, 0, sizeof(sqe));
+                sqe.opcode = IORING_OP_READ;
+                sqe.fd = fd;
+                sqe.addr = reinterpret_cast<uint64_t>(buffer);
+                sqe.len = length;
+                sqe.off = offset;
+                sqe.user_data = slot;
+                sq_array[index] = index;
+                __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+                ++to_submit;
+            }
+
+            void submit_and_wait(vector<Completion>& completions) {
+                while (true) {
+                    // reap completions already in the ring
+                    unsigned head = *cq_head;
+                    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+                    for (; head != tail; ++head) {
+                        auto& cqe = cqes[head & *cq_mask];
+                        completions.push_back(
+                            Completion{static_cast<unsigned>(cqe.user_data),
+                                    static_cast<long>(cqe.res)});
+                    }
+                    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+                    if (!completions.empty() && to_submit == 0) return;
+
+                    int n = syscall(__NR_io_uring_enter, ring_fd, to_submit,
+                                    completions.empty() ? 1 : 0,
+                                    IORING_ENTER_GETEVENTS, NULL, 0);
+                    if (n < 0) {
+                        if (errno == EINTR || errno == EAGAIN ||
+                            errno == EBUSY) continue;
+                        throw IOException("Fail to enter io_uring");
+                    }
+                    to_submit -= n;
+                }
+            }
+
+        public:
+            IoUringBatchReader(unsigned queue_depth, size_t alignment) :
+                BatchReader(queue_depth, alignment) {
+                memset(&params, 0, sizeof(params));
+                ring_fd = syscall(__NR_io_uring_setup, queue_depth, &params);
+                if (ring_fd < 0)
+                    throw IOException("Fail to set up io_uring");
+
+                sq_ring_bytes = params.sq_off.array +
+                    params.sq_entries * sizeof(unsigned);
+                cq_ring_bytes = params.cq_off.cqes +
+                    params.cq_entries * sizeof(io_uring_cqe);
+                if (params.features & IORING_FEAT_SINGLE_MMAP) {
+                    if (cq_ring_bytes > sq_ring_bytes)
+                        sq_ring_bytes = cq_ring_bytes;
+                    cq_ring_bytes = sq_ring_bytes;
+                }
+                sq_ring = mmap(NULL, sq_ring_bytes, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, ring_fd,
+                               IORING_OFF_SQ_RING);
+                if (params.features & IORING_FEAT_SINGLE_MMAP) {
+                    cq_ring = sq_ring;
+                } else if (sq_ring != MAP_FAILED) {
+                    cq_ring = mmap(NULL, cq_ring_bytes, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, ring_fd,
+                                   IORING_OFF_CQ_RING);
+                }
+                sqes_bytes = params.sq_entries * sizeof(io_uring_sqe);
+                if (cq_ring != MAP_FAILED) {
+                    sqes = static_cast<io_uring_sqe *>(
+                        mmap(NULL, sqes_bytes, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring_fd,
+                             IORING_OFF_SQES));
+                }
+                if (sqes == MAP_FAILED) {
+                    unmap();
+                    close(ring_fd);
+                    throw IOException("Fail to mmap io_uring");
+                }
+
+                char *sq = static_cast<char *>(sq_ring);
+                sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+                sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+                sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+                sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+                char *cq = static_cast<char *>(cq_ring);
+                cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+                cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+                cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+                cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+            }
+
+            ~IoUringBatchReader() {
+                unmap();
+                close(ring_fd);
+            }
+
+            const char *get_name() const { return "io_uring"; }
+        };
+    }
+
+    BatchReader::BatchReader(unsigned queue_depth, size_t alignment) :
+        queue_depth(queue_depth), alignment(alignment) {
+        if (queue_depth == 0)
+            throw IOException("Queue depth of batch reader must be positive");
+    }
+
+    BatchReader::~BatchReader() {
+        free(bounce_buffers);
+    }
+
+    void BatchReader::read_batch(const vector<ReadRequest>& requests) {
+        if (requests.empty()) return;
+        utils::WallTimer timer;
+
+        // size bounce buffers for the widest aligned request
+        if (alignment != 0) {
+            size_t max_span = 0;
+            for (auto& request : requests) {
+                size_t begin = align_down(request.offset, alignment);
+                size_t end = align_up(request.offset + request.length, alignment);
+                if (end - begin > max_span) max_span = end - begin;
+            }
+            if (max_span > slot_bytes) {
+                free(bounce_buffers);
+                bounce_buffers = nullptr;
+                slot_bytes = max_span;
+                void *buffers;
+                if (posix_memalign(&buffers, alignment,
+                                   slot_bytes * queue_depth) != 0)
+                    throw IOException("Fail to allocate aligned read buffers");
+                bounce_buffers = static_cast<char *>(buffers);
+            }
+        }
+
+        vector<size_t> slot_request(queue_depth); // request index in slot
+        vector<unsigned> free_slots;
+        for (unsigned slot = queue_depth; slot > 0; --slot)
+            free_slots.push_back(slot - 1);
+        vector<Completion> completions;
+
+        size_t next_request = 0;
+        size_t n_completed = 0;
+        while (n_completed < requests.size()) {
+            while (next_request < requests.size() && !free_slots.empty()) {
+                unsigned slot = free_slots.back();
+                free_slots.pop_back();
+                slot_request[slot] = next_request;
+                auto& request = requests[next_request++];
+                if (alignment == 0) {
+                    queue(slot, request.fd, request.destination,
+                          request.length, request.offset);
+                } else {
+                    size_t begin = align_down(request.offset, alignment);
+                    size_t end = align_up(request.offset + request.length,
+                                          alignment);
+                    queue(slot, request.fd, bounce_buffers + slot * slot_bytes,
+                          end - begin, begin);
+                }
+            }
+
+            completions.clear();
+            submit_and_wait(completions);
+            for (auto& completion : completions) {
+                auto& request = requests[slot_request[completion.slot]];
+                size_t skip = alignment == 0 ? 0 :
+                    request.offset - align_down(request.offset, alignment);
+                if (completion.result < 0 ||
+                    static_cast<size_t>(completion.result) < skip + request.length)
+                    throw IOException("Fail to read closed list entry");
+                if (alignment != 0) {
+                    memcpy(request.destination,
+                           bounce_buffers + completion.slot * slot_bytes + skip,
+                           request.length);
+                }
+                free_slots.push_back(completion.slot);
+                ++n_completed;
+            }
+        }
+
+        ++n_batches;
+        n_reads += requests.size();
+        read_seconds += timer.get_seconds();
+    }
+
+    void BatchReader::print_statistics() const {
+        print_statistics(vector<const BatchReader *>{this});
+    }
+
+    void BatchReader::print_statistics(const vector<const BatchReader *>&
+                                       readers) {
+        auto& first = *readers.front();
+        size_t n_batches = 0;
+        size_t n_reads = 0;
+        double read_seconds = 0;
+        for (auto reader : readers) {
+            n_batches += reader->n_batches;
+            n_reads += reader->n_reads;
+            read_seconds += reader->read_seconds;
+        }
+        dfpair(stdout, "probe read backend", "%s", first.get_name());
+        dfpair(stdout, "probe queue depth", "%u", first.queue_depth);
+        dfpair(stdout, "probe direct io", "%s",
+               first.alignment != 0 ? "yes" : "no");
+        if (readers.size() > 1)
+            dfpair(stdout, "probe readers", "%lu", readers.size());
+        dfpair(stdout, "probe read batches", "%lu", n_batches);
+        dfpair(stdout, "probe reads", "%lu", n_reads);
+        // summed over readers, which read at the same time
+        dfpair(stdout, "probe read time (s)", "%g", read_seconds);
+        dfpair(stdout, "probe reads per second", "%g",
+               read_seconds > 0 ?
+               n_reads * readers.size() / read_seconds : 0.0);
+    }
+
+    unique_ptr<BatchReader> BatchReader::create(const string& backend,
+                                                unsigned queue_depth,
+                                                size_t alignment) {
+        if (backend != "io_uring" && backend != "aio" && backend != "pread")
+            throw IOException("Unknown probe read backend: " + backend);
+        if (backend == "io_uring") {
+            try {
+                return memory::make_unique<IoUringBatchReader>
+                    (queue_depth, alignment);
+            } catch (const IOException&) {
+                dfpair(stdout, "probe read backend fallback", "%s",
+                       "io_uring unavailable");
+            }
+        }
+        if (backend != "pread") {
+            try {
+                return memory::make_unique<AioBatchReader>
+                    (queue_depth, alignment);
+            } catch (const IOException&) {
+                dfpair(stdout, "probe read backend fallback", "%s",
+                       "aio unavailable");
+            }
+        }
+        return memory::make_unique<PreadBatchReader>(queue_depth, alignment);
+    }
+}
@@ -0,0 +1,91 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#ifndef BATCH_READER_HPP
+#define BATCH_READER_HPP
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+/*                                                                           \
+| BatchReader reads a batch of small, scattered records from a file with at  |
+| most queue_depth reads in flight, without creating threads.                |
+|                                                                            |
+| Backends:                                                                  |
+|   io_uring - submissions and completions through shared rings             |
+|   aio      - Linux native AIO (io_submit / io_getevents)                   |
+|   pread    - synchronous reads, one at a time                              |
+|                                                                            |
+| Requests may read from different files. If the files were opened with      |
+| O_DIRECT, requests are widened to aligned blocks and read through aligned  |
+| bounce buffers.                                                            |
+\===========================================================================*/
+
+namespace compress {
+
+    struct ReadRequest {
+        int fd;
+        std::uint64_t offset;
+        std::size_t length;
+        char *destination;
+    };
+
+    class BatchReader {
+        unsigned queue_depth;
+        std::size_t alignment; // 0 if files are not opened with O_DIRECT
+        std::size_t slot_bytes = 0;
+        char *bounce_buffers = nullptr;
+
+        // statistics
+        std::size_t n_batches = 0;
+        std::size_t n_reads = 0;
+        double read_seconds = 0;
+
+    protected:
+        struct Completion {
+            unsigned slot;
+            long result; // bytes read, or negative errno
+        };
+
+        // queue a read of length bytes at offset of fd into buffer, tagged by
+        // slot
+        virtual void queue(unsigned slot, int fd, char *buffer,
+                           std::size_t length, std::uint64_t offset) = 0;
+
+        // submit all queued reads and wait until at least one is complete,
+        // appending every available completion
+        virtual void submit_and_wait(std::vector<Completion>& completions) = 0;
+
+    public:
+        BatchReader(unsigned queue_depth, std::size_t alignment);
+        virtual ~BatchReader();
+
+        BatchReader(const BatchReader &other) = delete;
+        BatchReader& operator = (const BatchReader &other) = delete;
+
+        // Returns when all requests are complete. Throws IOException on a
+        // failed or short read.
+        void read_batch(const std::vector<ReadRequest>& requests);
+
+        virtual const char *get_name() const = 0;
+
+        unsigned get_queue_depth() const { return queue_depth; }
+
+        void print_statistics() const;
+        // of readers of the same backend and depth used at once, e.g. one
+        // per thread, as a whole
+        static void print_statistics(const std::vector<const BatchReader *>&
+                                     readers);
+
+        // Creates the named backend, falling back from io_uring to aio to
+        // pread if the kernel does not support it.
+        static std::unique_ptr<BatchReader> create(const std::string& backend,
+                                                   unsigned queue_depth,
+                                                   std::size_t alignment);
+    };
+}
+
+#endif
@@ -0,0 +1,108 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#ifndef BLOCK_FILTER_HPP
+#define BLOCK_FILTER_HPP
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+/*                                                                           \
+| Approximate membership filters, one per block of the external hash table   |
+| (the same blocks as the MappingTable). A lookup that reaches a pointer of  |
+| a block whose filter rejects the hash value of the entry can skip the disk |
+| read of that pointer.                                                      |
+|                                                                            |
+| Each filter is a blocked Bloom filter: a hash value selects a single       |
+| 512 bit line of the block's filter, in which all of its bits are set, so a |
+| test touches one cache line. Filters of a block are only written before    |
+| the pointers of the block are published, and are read only afterwards.    |
+\===========================================================================*/
+
+class BlockFilters {
+    static constexpr std::size_t line_bits = 512;
+    static constexpr std::size_t line_words = line_bits / 64;
+
+    std::size_t lines_per_block;
+    unsigned n_hashes;
+    std::vector<uint64_t> words;
+
+    // remix, the hash value is also used to index the pointer table
+    static uint64_t mix(uint64_t hash_value) {
+        hash_value ^= hash_value >> 33;
+        hash_value *= 0xff51afd7ed558ccdULL;
+        hash_value ^= hash_value >> 33;
+        hash_value *= 0xc4ceb9fe1a85ec53ULL;
+        hash_value ^= hash_value >> 33;
+        return hash_value;
+    }
+
+    const uint64_t *get_line(std::size_t block, uint64_t mixed) const {
+        auto line = (mixed >> 32) % lines_per_block;
+        return &words[(block * lines_per_block + line) * line_words];
+    }
+
+    // k bit positions from a double hashing sequence within the line
+    template<class Visit>
+    void for_each_bit(uint64_t mixed, Visit visit) const {
+        uint32_t a = static_cast<uint32_t>(mixed);
+        uint32_t b = static_cast<uint32_t>(mixed >> 32) | 1;
+        for (unsigned i = 0; i < n_hashes; ++i) {
+            visit((a + i * b) % line_bits);
+        }
+    }
+
+public:
+    // bits_per_entry of 0 disables the filters, everything may be contained
+    BlockFilters(std::size_t entries_per_block, std::size_t bits_per_entry) :
+        lines_per_block((entries_per_block * bits_per_entry + line_bits - 1)
+                        / line_bits),
+        n_hashes(std::max(1u, std::min(16u, static_cast<unsigned>
+                                       (std::round(bits_per_entry *
+                                                   std::log(2.0))))))
+    {}
+
+    bool is_enabled() const {
+        return lines_per_block != 0;
+    }
+
+    void reserve(std::size_t n_blocks) {
+        words.reserve(n_blocks * lines_per_block * line_words);
+    }
+
+    // appends the (empty) filter of the next block
+    void add_block() {
+        words.resize(words.size() + lines_per_block * line_words, 0);
+    }
+
+    // inserts into the last block
+    void insert(uint64_t hash_value) {
+        if (!is_enabled()) return;
+        auto mixed = mix(hash_value);
+        auto block = words.size() / (lines_per_block * line_words) - 1;
+        auto line = const_cast<uint64_t *>(get_line(block, mixed));
+        for_each_bit(mixed, [line](std::size_t bit) {
+                line[bit / 64] |= uint64_t(1) << (bit % 64);
+            });
+    }
+
+    bool may_contain(std::size_t block, uint64_t hash_value) const {
+        if (!is_enabled()) return true;
+        auto mixed = mix(hash_value);
+        auto line = get_line(block, mixed);
+        bool contained = true;
+        for_each_bit(mixed, [line, &contained](std::size_t bit) {
+                contained &= (line[bit / 64] >> (bit % 64)) & 1;
+            });
+        return contained;
+    }
+
+    std::size_t get_size_in_bytes() const {
+        return words.capacity() * sizeof(uint64_t);
+    }
+};
+
+#endif
@@ -0,0 +1,131 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#ifndef CLOSED_LIST_OPTIONS_HPP
+#define CLOSED_LIST_OPTIONS_HPP
+
+#include "../utils/options.hpp"
+#include "../utils/compunits.hpp"
+#include "../utils/storage.hpp"
+#include "../fatal.hpp"
+
+#include <cstddef>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace compress {
+
+    using namespace compunits;
+
+    // Sizing of the A*-IDD closed list, shared by the serial and the async
+    // variants.
+    struct ClosedListOptions {
+        // memory of the pointer table at the start of search, and the ceiling
+        // it may grow to
+        std::size_t initial_bytes = 32_MiB;
+        std::size_t max_bytes = 950_MiB;
+        // load factor at which the pointer table is grown
+        double max_load_factor = 0.75;
+        // granularity at which the external closed list file is extended,
+        // and striped across dirs if several are given
+        std::size_t extent_bytes = 64_MiB;
+        std::vector<std::string> dirs;
+        // backend of the files, see utils::Storage
+        utils::StorageBackend storage = utils::StorageBackend::mmap;
+        // budget of the user-space page cache of the external closed list,
+        // 0 to mmap the file and leave caching to the kernel
+        std::size_t cache_bytes = 0;
+        // memory of all partition buffers, which bounds the number of
+        // partitions, and the function mapping nodes to partitions
+        std::size_t buffer_bytes = 8_MiB;
+        std::string partition_function = "hash";
+        // flush full partition buffers on a background thread
+        bool background_flush = true;
+        // bits per node of the Bloom filters of flushed blocks, 0 to disable
+        std::size_t filter_bits = 8;
+        static constexpr long max_filter_bits = 64;
+        // batched probes of the async closed list: io_uring, aio or pread
+        std::string probe_backend = "io_uring";
+        unsigned probe_queue_depth = 32;
+        bool probe_direct_io = true;
+        // reopen the files of a checkpoint instead of creating them
+        bool resume = false;
+
+        static ClosedListOptions from(const utils::Options& options) {
+            ClosedListOptions closed_options;
+            closed_options.max_bytes =
+                options.get_bytes("closed-max-memory", closed_options.max_bytes);
+            closed_options.initial_bytes =
+                options.get_bytes("closed-initial-memory",
+                                  closed_options.initial_bytes);
+            closed_options.max_load_factor =
+                options.get_double("closed-max-load",
+                                   closed_options.max_load_factor);
+            // a full table is never grown, and probing it never ends
+            if (closed_options.max_load_factor <= 0 ||
+                closed_options.max_load_factor >= 1)
+                throw Fatal("--closed-max-load must be between 0 and 1, "
+                            "not %g", closed_options.max_load_factor);
+            closed_options.extent_bytes =
+                options.get_bytes("closed-extent", closed_options.extent_bytes);
+            auto dirs = options.get_string("closed-dirs", "");
+            for (std::size_t start = 0; start < dirs.size();) {
+                auto end = dirs.find(',', start);
+                if (end == std::string::npos) end = dirs.size();
+                if (end > start)
+                    closed_options.dirs.push_back(dirs.substr(start,
+                                                              end - start));
+                start = end + 1;
+            }
+            closed_options.storage =
+                utils::get_storage_backend(options, "closed-storage",
+                                           closed_options.storage);
+            closed_options.cache_bytes =
+                options.get_bytes("closed-cache", closed_options.cache_bytes);
+            closed_options.buffer_bytes =
+                options.get_bytes("closed-buffer-memory",
+                                  closed_options.buffer_bytes);
+            closed_options.partition_function =
+                options.get_string("closed-partition",
+                                   closed_options.partition_function);
+            closed_options.background_flush =
+                options.get_bool("closed-background-flush",
+                                 closed_options.background_flush);
+            auto filter_bits =
+                options.get_int("closed-filter-bits", closed_options.filter_bits);
+            // more bits add no hash functions, and only cost memory
+            if (filter_bits < 0 || filter_bits > max_filter_bits)
+                throw Fatal("--closed-filter-bits must be between 0 and %ld, "
+                            "not %ld", max_filter_bits, filter_bits);
+            closed_options.filter_bits = filter_bits;
+            closed_options.probe_backend =
+                options.get_string("probe-backend", closed_options.probe_backend);
+            auto probe_queue_depth =
+                options.get_int("probe-queue-depth",
+                                closed_options.probe_queue_depth);
+            if (probe_queue_depth < 1)
+                throw Fatal("--probe-queue-depth must be at least 1, not %ld",
+                            probe_queue_depth);
+            closed_options.probe_queue_depth = probe_queue_depth;
+            closed_options.probe_direct_io =
+                options.get_bool("probe-direct-io",
+                                 closed_options.probe_direct_io);
+            closed_options.resume = options.get_bool("resume", false);
+            return closed_options;
+        }
+
+        // --resume is the Checkpointer's
+        static void add_option_names(std::set<std::string>& names) {
+            names.insert({ "closed-max-memory", "closed-initial-memory",
+                        "closed-max-load", "closed-extent", "closed-dirs",
+                        "closed-storage", "closed-cache",
+                        "closed-buffer-memory", "closed-partition",
+                        "closed-background-flush", "closed-filter-bits",
+                        "probe-backend", "probe-queue-depth",
+                        "probe-direct-io" });
+        }
+    };
+}
+
+#endif
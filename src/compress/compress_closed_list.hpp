@@ -5,18 +5,30 @@
 #define COMPRESS_CLOSED_LIST_HPP
 
 #include "pointer_table.hpp"
+#include "growing_pointer_table.hpp"
+#include "external_closed_file.hpp"
+#include "closed_list_options.hpp"
+#include "partition_buffer.hpp"
+#include "partition_function.hpp"
 #include "mapping_table.hpp"
+#include "block_filter.hpp"
 #include "../utils/named_fstream.hpp"
 #include "../utils/memory.hpp"
 #include "../utils/errors.hpp"
+#include "../utils/scoped_thread.hpp"
+#include "../utils/wall_timer.hpp"
+#include "../utils/checkpoint.hpp"
 #include "../hash_functions/tabulation_hash.hpp"
 
 #include <iostream>
 #include <vector>
 #include <memory>
-#include <unordered_set>
 #include <cmath> // for pow
 #include <atomic>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
 
 #include <sys/mman.h>
 #include <sys/types.h>
@@ -37,19 +49,21 @@ namespace compress {
         bool double_hashing;
 
          TabulationHash<Entry> hasher;
-         TabulationHash<Entry> partition_hasher;
+         PartitionFunction<Entry> partition_function;
 
-        vector<unordered_set<Entry, decltype(hasher) > > buffers;
+        using Buffer = PartitionBuffer<Entry, TabulationHash<Entry> >;
+        vector<Buffer> buffers;
 
         // for compress with partitioning
         unique_ptr<MappingTable> partition_table;
-        unsigned n_partitions = 100;
+        unsigned n_partitions;
+
+        // membership filters of the flushed blocks of the external closed list
+        unique_ptr<BlockFilters> block_filters;
        
-        PointerTable internal_closed;
-        int external_closed_fd;
-        char *external_closed;
+        mutable ExternalClosedFile external_closed; // reads may fill cache
+        GrowingPointerTable<PointerTable> internal_closed;
         size_t external_closed_index = 0;
-        size_t external_closed_bytes = 0;
 
         size_t max_buffer_size_in_bytes = BUFFER_BYTES;
         size_t max_buffer_entries;
@@ -59,23 +73,77 @@ namespace compress {
         
         void flush_buffer(size_t partition_value);
 
+        // writes buffer to the external closed list and publishes its
+        // pointers, locking closed_mutex for chunks of flush_chunk_entries
+        void write_buffer(size_t partition_value, const Buffer& buffer);
+        static constexpr size_t flush_chunk_entries = 256;
+
+        // Background flushing: a full buffer is swapped with the (empty)
+        // flushing_buffer and written by the flusher thread, while lookups
+        // still search it. At most one flush is in flight; a buffer that
+        // fills up meanwhile waits for it. closed_mutex guards the pointer
+        // table, mapping table, filters and external closed list.
+        bool background_flush;
+        unique_ptr<Buffer> flushing_buffer;
+        size_t flushing_partition = SIZE_MAX; // SIZE_MAX if none
+        bool flush_pending = false;
+        bool stop_flusher = false;
+        // thrown by a flush, rethrown by the next wait for it
+        mutable exception_ptr flush_error;
+        mutable mutex closed_mutex;
+        mutable mutex flush_mutex;
+        mutable condition_variable flush_ready;
+        mutable condition_variable flush_done;
+        unique_ptr<scoped_thread> flusher;
+        size_t n_background_flushes = 0;
+        mutable double flush_wait_seconds = 0;
+
+        void flush_worker();
+        void wait_for_flush() const;
+        void stop_flush_worker();
+
+        // false if the filter of the block of ptr rules out hash_value
+        bool may_be_at(size_t hash_value, size_t ptr) const;
+
         void read_external_at(Entry& entry, size_t index) const;
         void write_external_at(const Entry& entry, size_t index);
 
+        // external read of a batch lookup, of a candidate pointer of
+        // batch_entries[entry_index]
+        struct BatchRead {
+            size_t entry_index;
+            size_t ptr;
+            size_t sweep_offset; // of the entry in sweep_buffer
+        };
+        static constexpr size_t sweep_page_bytes = 4096;
+        vector<Entry> batch_entries;
+        vector<BatchRead> batch_reads;
+        vector<pair<size_t, size_t> > sweep_runs; // first and last page
+        vector<char> sweep_buffer;
+
+        // reads all batch_reads in ascending order of pages, merging adjacent
+        // pages into runs
+        void sweep_batch_reads();
+
+        // batch statistics
+        size_t n_batches = 0;
+        size_t n_batch_reads = 0;
+        size_t n_batch_pages = 0;
+        size_t n_batch_runs = 0;
+
         // probe statistics, does not include probes for path reconstruction
         mutable size_t buffer_hits = 0;
         mutable size_t good_probes = 0;
         mutable size_t bad_probes = 0;
+        mutable size_t filtered_probes = 0;
 
-        size_t get_probe_value(size_t hash_value) const;
-        
     public:
         explicit CompressClosedList(bool reopen_closed,
                                     bool enable_partitioning,
                                     bool double_hashing,
-                                    size_t internal_closed_bytes);
+                                    const ClosedListOptions& options);
         
-        ~CompressClosedList() = default;
+        ~CompressClosedList();
 
         pair<found, reopened> find_in_buffers(const Entry &entry);
         pair<found, reopened> find_in_closed(const Entry &entry);
@@ -83,8 +151,28 @@ namespace compress {
 
         pair<found, reopened> find_insert(const Entry &entry);
 
+        // Looks up a batch of nodes, with the external reads of the whole
+        // batch sorted by offset and merged into sequential runs. Inserts the
+        // nodes that are new, and leaves in entries the nodes to expand: new
+        // and reopened ones, duplicates within the batch folded to the lowest
+        // g. Returns the number of reopened nodes.
+        size_t batch_find_insert(vector<Entry>& entries);
+
+        // Hints that entry will soon be looked up: issues read ahead of the
+        // external pages its lookup would read. Does not change the list.
+        void prefetch(const Entry &entry) const;
+
         Entry trace_parent(const Entry& entry) const;
 
+        // Saves what the external closed list does not hold, the buffered
+        // nodes and the mapping table, after syncing the external closed
+        // list. The pointer table and filters are not saved, restore()
+        // rebuilds them in one sequential pass over the external closed list.
+        void checkpoint(utils::Checkpointer& checkpointer,
+                        utils::Manifest& manifest);
+        void restore(utils::Checkpointer& checkpointer,
+                     const utils::Manifest& manifest);
+
         void clear();
         void print_statistics() const;
     };
@@ -93,83 +181,116 @@ namespace compress {
     CompressClosedList<Entry>::CompressClosedList(bool reopen_closed,
                                                   bool enable_partitioning,
                                                   bool double_hashing,
-                                                  size_t internal_closed_bytes)
+                                                  const ClosedListOptions& options)
         : reopen_closed(reopen_closed),
           enable_partitioning(enable_partitioning),
           double_hashing(double_hashing),
-          internal_closed(internal_closed_bytes) 
+          partition_function(options.partition_function),
+          external_closed("closed_list.bucket", options.dirs,
+                          Entry::get_size_in_bytes(),
+                          PointerTable::get_max_entries_bound(options.max_bytes),
+                          options.extent_bytes, options.storage,
+                          options.cache_bytes, options.resume),
+          internal_closed(options.initial_bytes, options.max_bytes,
+                          options.max_load_factor, double_hashing,
+                          [this](size_t ptr) {
+                              Entry node;
+                              read_external_at(node, ptr);
+                              return hasher(node);
+                          })
     {
         max_buffer_entries = max_buffer_size_in_bytes / Entry::get_size_in_bytes();
+
+        // as many partitions as buffers fit in the memory budget
+        partition_function.set_max_partitions
+            (options.buffer_bytes / Buffer::get_size_in_bytes(max_buffer_entries));
+        n_partitions = partition_function.get_n_partitions();
         
         // initialize partition table
         if (enable_partitioning) {
             partition_table =
-                memory::make_unique<MappingTable>(max_buffer_entries);
+                memory::make_unique<MappingTable>(max_buffer_entries,
+                                                  n_partitions);
            
-            buffers.resize(n_partitions);
-        } else {
-            buffers.resize(1); // use only buffers[0] if no partitioning
         }
+        block_filters = memory::make_unique<BlockFilters>(max_buffer_entries,
+                                                          options.filter_bits);
+        // use only buffers[0] if no partitioning
+        auto n_buffers = enable_partitioning ? n_partitions : 1;
+        buffers.reserve(n_buffers);
+        for (unsigned i = 0; i < n_buffers; ++i)
+            buffers.emplace_back(max_buffer_entries, hasher);
+
+        background_flush = options.background_flush;
+        if (background_flush) {
+            flushing_buffer = memory::make_unique<Buffer>(max_buffer_entries,
+                                                          hasher);
+            flusher = memory::make_unique<scoped_thread>
+                (thread(&CompressClosedList<Entry>::flush_worker, this));
+        }
+        dfpair(stdout, "background flush", "%s",
+               background_flush ? "true" : "false");
         
-        // initialize external closed list
-        external_closed_bytes =
-            internal_closed.get_max_entries() * Entry::get_size_in_bytes();
-        dfpair(stdout, "external closed (bytes)", "%lu", external_closed_bytes);
-
-        external_closed_fd = open("closed_list.bucket", O_CREAT | O_TRUNC | O_RDWR,
-                                  S_IRUSR | S_IWUSR);
-        if (external_closed_fd < 0)
-            throw IOException("Fail to create closed list file");
-        
-        if (posix_fallocate64(external_closed_fd, 0, external_closed_bytes) < 0)
-            throw IOException("Fail to fallocate closed list file");
-        
-        external_closed =
-            static_cast<char *>(mmap(NULL, external_closed_bytes,
-                                     PROT_READ | PROT_WRITE, MAP_SHARED,
-                                     external_closed_fd, 0));
-        if (external_closed == MAP_FAILED)
-            throw IOException("Fail to mmap closed list file");
-
-        if (madvise(external_closed, external_closed_bytes, MADV_RANDOM) < 0)
-            throw IOException("Fail to give madvise for closed list file");
+        dfpair(stdout, "external closed reserved (bytes)", "%lu",
+               external_closed.get_reserved_bytes());
+        dfpair(stdout, "external closed extent (bytes)", "%lu",
+               options.extent_bytes);
+        dfpair(stdout, "external closed files", "%lu",
+               external_closed.get_n_files());
 
         // Logging
-        if (enable_partitioning)
+        if (enable_partitioning) {
+            dfpair(stdout, "partition function", "%s",
+                   partition_function.get_name().c_str());
             dfpair(stdout, "number of partitions", "%u", n_partitions);
+        }
         if (double_hashing) {
             dfpair(stdout, "probe strategy", "%s", "double hashing");
         } else {
             dfpair(stdout, "probe strategy", "%s", "linear probing");
         }
-        dfpair(stdout, "max capacity of closed list (nodes)", "%lu",
+        dfpair(stdout, "initial capacity of closed list (nodes)", "%lu",
                internal_closed.get_max_entries());
+        dfpair(stdout, "max pointer table size (bytes)", "%lu",
+               options.max_bytes);
+        dfpair(stdout, "closed list filter bits per node", "%lu",
+               options.filter_bits);
+        cout << "#pair  \"pointer table growth load factor\"   "
+             << "\"" << options.max_load_factor << "\"" << endl;
     }
 
     template<class Entry>
-    size_t CompressClosedList<Entry>::get_probe_value(size_t hash_value) const {
-        if (!double_hashing) return 1; // linear probing
-        
-        // From Introduction to Algorithms 3rd Edition, pg 273
-        // This guarantees that double hashing does not cycle if max entries of
-        // internal_closed is prime.
-        return 1 + (hash_value % (internal_closed.get_max_entries() - 1));
+    CompressClosedList<Entry>::~CompressClosedList() {
+        stop_flush_worker();
     }
 
     template<class Entry>
     pair<found, reopened> CompressClosedList<Entry>::
     find_in_buffers(const Entry &entry) {
         auto partition_value = get_partition_value(entry);
+
+        // nodes being flushed are still looked up in their buffer
+        if (partition_value == flushing_partition) {
+            auto flushing_entry = flushing_buffer->find(entry);
+            if (flushing_entry) {
+                if (reopen_closed && entry.g < flushing_entry->g) {
+                    // reopen where the flush puts it, in the closed list
+                    wait_for_flush();
+                    return make_pair(false, false);
+                }
+                ++buffer_hits;
+                return make_pair(true, false);
+            }
+        }
         
         auto& buffer = buffers[partition_value];
         
-        auto buffer_it = buffer.find(entry);
-        if (buffer_it != buffer.end()) {
+        auto buffer_entry = buffer.find(entry);
+        if (buffer_entry) {
             ++buffer_hits;
             if (reopen_closed) {
-                if (entry.g < buffer_it->g) {
-                    buffer.erase(buffer_it);
-                    buffer.insert(entry);
+                if (entry.g < buffer_entry->g) {
+                    *buffer_entry = entry;
                     return make_pair(true, true);
                 }
             }
@@ -178,19 +299,23 @@ namespace compress {
         return make_pair(false, false);
     }
 
-    // TODO: ensure this is thread safe
+    // closed_mutex keeps the background flusher from inserting pointers,
+    // which may grow the pointer table, and extending the external closed
+    // list during the lookup
     template<class Entry>
     pair<found, reopened> CompressClosedList<Entry>::
     find_in_closed(const Entry &entry) {
+        lock_guard<mutex> lock(closed_mutex);
         auto partition_value = get_partition_value(entry);    
         auto hash_value = hasher(entry);
-        auto probe_value = get_probe_value(hash_value);
-        auto ptr = internal_closed.get_ptr_with_hash(hash_value, probe_value);
+        auto cursor = internal_closed.probe(hash_value);
+        auto ptr = internal_closed.get_ptr(cursor);
         while (!internal_closed.ptr_is_invalid(ptr)) {
 
-            // first check in partition table
-            if (!enable_partitioning ||
-                partition_value == partition_table->get_value_from_ptr(ptr)) {
+            // first check in partition table, then in the filter of the block
+            if ((!enable_partitioning ||
+                 partition_value == partition_table->get_value_from_ptr(ptr)) &&
+                may_be_at(hash_value, ptr)) {
                 // read node from pointer
                 Entry node;
                 read_external_at(node, ptr);
@@ -208,7 +333,8 @@ namespace compress {
             }
             // update pointer and resume while loop if partition values do not
             // match or if false positive probe
-            ptr = internal_closed.get_ptr_with_hash(hash_value, probe_value, false);
+            internal_closed.next(cursor);
+            ptr = internal_closed.get_ptr(cursor);
         }
         return make_pair(false, false);
     }
@@ -243,33 +369,267 @@ namespace compress {
         return make_pair(false, false);
     }
 
+    template<class Entry>
+    size_t CompressClosedList<Entry>::
+    batch_find_insert(vector<Entry>& entries) {
+        // fold duplicates, lowest g first
+        sort(entries.begin(), entries.end(),
+             [](const Entry& a, const Entry& b) {
+                 return a < b || (a == b && a.g < b.g);
+             });
+        entries.erase(unique(entries.begin(), entries.end()), entries.end());
+
+        vector<Entry> to_expand;
+        size_t n_reopened = 0;
+
+        // probe buffers and pointer table, collect candidate pointers
+        batch_entries.clear();
+        batch_reads.clear();
+        for (auto& entry : entries) {
+            bool found, reopened;
+            tie(found, reopened) = find_in_buffers(entry);
+            if (found) {
+                if (reopened) {
+                    to_expand.push_back(entry);
+                    ++n_reopened;
+                }
+                continue;
+            }
+            auto partition_value = get_partition_value(entry);
+            auto hash_value = hasher(entry);
+            lock_guard<mutex> lock(closed_mutex);
+            auto cursor = internal_closed.probe(hash_value);
+            auto ptr = internal_closed.get_ptr(cursor);
+            while (!internal_closed.ptr_is_invalid(ptr)) {
+                if ((!enable_partitioning ||
+                     partition_value ==
+                     partition_table->get_value_from_ptr(ptr)) &&
+                    may_be_at(hash_value, ptr)) {
+                    batch_reads.push_back(BatchRead{batch_entries.size(),
+                                                    ptr, 0});
+                }
+                internal_closed.next(cursor);
+                ptr = internal_closed.get_ptr(cursor);
+            }
+            batch_entries.push_back(entry);
+        }
+
+        sweep_batch_reads();
+
+        // resolve against the swept entries
+        vector<size_t> found_ptr(batch_entries.size(),
+                                 internal_closed.invalid_ptr);
+        vector<Entry> found_node(batch_entries.size());
+        for (auto& read : batch_reads) {
+            Entry node;
+            node.read(&sweep_buffer[read.sweep_offset]);
+            if (node == batch_entries[read.entry_index]) {
+                ++good_probes;
+                found_ptr[read.entry_index] = read.ptr;
+                found_node[read.entry_index] = node;
+            } else {
+                ++bad_probes;
+            }
+        }
+        for (size_t i = 0; i < batch_entries.size(); ++i) {
+            auto& entry = batch_entries[i];
+            if (internal_closed.ptr_is_invalid(found_ptr[i])) {
+                insert_in_buffer(entry);
+                to_expand.push_back(entry);
+            } else if (reopen_closed && entry.g < found_node[i].g) {
+                lock_guard<mutex> lock(closed_mutex);
+                write_external_at(entry, found_ptr[i]);
+                to_expand.push_back(entry);
+                ++n_reopened;
+            }
+        }
+        entries.swap(to_expand);
+        return n_reopened;
+    }
+
+    template<class Entry>
+    void CompressClosedList<Entry>::sweep_batch_reads() {
+        ++n_batches;
+        n_batch_reads += batch_reads.size();
+        sort(batch_reads.begin(), batch_reads.end(),
+             [](const BatchRead& a, const BatchRead& b) {
+                 return a.ptr < b.ptr;
+             });
+        auto entry_bytes = Entry::get_size_in_bytes();
+        sweep_runs.clear();
+        size_t run_offset = 0; // of the current run in sweep_buffer
+        for (auto& read : batch_reads) {
+            auto offset = read.ptr * entry_bytes;
+            auto first_page = offset / sweep_page_bytes;
+            auto last_page = (offset + entry_bytes - 1) / sweep_page_bytes;
+            if (!sweep_runs.empty() && first_page <= sweep_runs.back().second + 1) {
+                sweep_runs.back().second = max(sweep_runs.back().second,
+                                               last_page);
+            } else {
+                if (!sweep_runs.empty())
+                    run_offset += (sweep_runs.back().second -
+                                   sweep_runs.back().first + 1) *
+                        sweep_page_bytes;
+                sweep_runs.emplace_back(first_page, last_page);
+            }
+            read.sweep_offset = run_offset + offset -
+                sweep_runs.back().first * sweep_page_bytes;
+        }
+        size_t sweep_bytes = 0;
+        for (auto& run : sweep_runs)
+            sweep_bytes += (run.second - run.first + 1) * sweep_page_bytes;
+        sweep_buffer.resize(sweep_bytes);
+        lock_guard<mutex> lock(closed_mutex);
+        size_t buffer_offset = 0;
+        for (auto& run : sweep_runs) {
+            auto run_bytes = (run.second - run.first + 1) * sweep_page_bytes;
+            external_closed.read_range(run.first * sweep_page_bytes, run_bytes,
+                                       &sweep_buffer[buffer_offset]);
+            buffer_offset += run_bytes;
+        }
+        n_batch_pages += sweep_bytes / sweep_page_bytes;
+        n_batch_runs += sweep_runs.size();
+    }
+
+    template<class Entry>
+    void CompressClosedList<Entry>::
+    prefetch(const Entry &entry) const {
+        auto partition_value = get_partition_value(entry);
+        if (buffers[partition_value].find(entry)) return;
+        auto hash_value = hasher(entry);
+        lock_guard<mutex> lock(closed_mutex);
+        auto cursor = internal_closed.probe(hash_value);
+        auto ptr = internal_closed.get_ptr(cursor);
+        // same candidates as find_in_closed, without counting probes
+        while (!internal_closed.ptr_is_invalid(ptr)) {
+            if ((!enable_partitioning ||
+                 partition_value == partition_table->get_value_from_ptr(ptr)) &&
+                block_filters->may_contain(ptr / max_buffer_entries,
+                                           hash_value)) {
+                external_closed.prefetch_entry(ptr);
+            }
+            internal_closed.next(cursor);
+            ptr = internal_closed.get_ptr(cursor);
+        }
+    }
+
     template<class Entry>
     unsigned CompressClosedList<Entry>::get_partition_value(const Entry& entry) const {
         if (!enable_partitioning) return 0;
-        return partition_hasher(entry) % n_partitions;
+        return partition_function(entry);
     }
 
     template<class Entry>
     void CompressClosedList<Entry>::flush_buffer(size_t partition_value) {
-        for (auto& node : buffers[partition_value]) {
+        if (!background_flush) {
+            write_buffer(partition_value, buffers[partition_value]);
+            buffers[partition_value].clear();
+            return;
+        }
+        wait_for_flush();
+        // flushing_buffer was written out, and is in the closed list
+        flushing_buffer->clear();
+        swap(buffers[partition_value], *flushing_buffer);
+        flushing_partition = partition_value;
+        {
+            lock_guard<mutex> lock(flush_mutex);
+            flush_pending = true;
+        }
+        flush_ready.notify_one();
+        ++n_background_flushes;
+    }
+
+    template<class Entry>
+    void CompressClosedList<Entry>::
+    write_buffer(size_t partition_value, const Buffer& buffer) {
+        unique_lock<mutex> lock(closed_mutex);
+        external_closed.ensure_capacity(external_closed_index + buffer.size());
+        block_filters->add_block();
+        // the mapping table entry must be in place before any pointer to the
+        // flushed nodes is published to lookups
+        if (enable_partitioning)
+            partition_table->insert_map_value(partition_value);
+        size_t n_in_chunk = 0;
+        for (auto& node : buffer) {
             write_external_at(node, external_closed_index);
             auto hash_value = hasher(node);
+            block_filters->insert(hash_value);
             internal_closed.insert_ptr_with_hash(external_closed_index,
-                                        hash_value,
-                                        get_probe_value(hash_value));
-            
+                                                 hash_value);
             ++external_closed_index;
+            // let lookups of the search thread in between chunks
+            if (++n_in_chunk == flush_chunk_entries) {
+                n_in_chunk = 0;
+                lock.unlock();
+                lock.lock();
+            }
         }
-        if (enable_partitioning)
-            partition_table->insert_map_value(partition_value);
-        // release memory
-        unordered_set<Entry, decltype(hasher) >().swap(buffers[partition_value]);
+        external_closed.write_back();
     }
-    
-    
+
+    template<class Entry>
+    void CompressClosedList<Entry>::flush_worker() {
+        unique_lock<mutex> lock(flush_mutex);
+        while (true) {
+            flush_ready.wait(lock, [this] {
+                    return flush_pending || stop_flusher;
+                });
+            if (!flush_pending) return;
+            lock.unlock();
+            exception_ptr thrown;
+            try {
+                write_buffer(flushing_partition, *flushing_buffer);
+            } catch (...) {
+                thrown = current_exception();
+            }
+            lock.lock();
+            flush_error = thrown;
+            flush_pending = false;
+            flush_done.notify_all();
+        }
+    }
+
+    template<class Entry>
+    void CompressClosedList<Entry>::wait_for_flush() const {
+        if (!background_flush) return;
+        unique_lock<mutex> lock(flush_mutex);
+        if (flush_pending) {
+            utils::WallTimer timer;
+            flush_done.wait(lock, [this] { return !flush_pending; });
+            timer.stop();
+            flush_wait_seconds += timer.get_seconds();
+        }
+        if (flush_error) {
+            auto thrown = flush_error;
+            flush_error = nullptr;
+            rethrow_exception(thrown);
+        }
+    }
+
+    template<class Entry>
+    void CompressClosedList<Entry>::stop_flush_worker() {
+        if (!flusher) return;
+        {
+            lock_guard<mutex> lock(flush_mutex);
+            stop_flusher = true;
+        }
+        flush_ready.notify_one();
+        flusher.reset(); // joins after the pending flush
+    }
+
+    template<class Entry>
+    bool CompressClosedList<Entry>::
+    may_be_at(size_t hash_value, size_t ptr) const {
+        if (block_filters->may_contain(ptr / max_buffer_entries, hash_value))
+            return true;
+        ++filtered_probes;
+        return false;
+    }
+
     template<class Entry>
     Entry CompressClosedList<Entry>::
     trace_parent(const Entry &entry) const {
+        wait_for_flush();
         
         // first look in buffers
         for (auto& buffer : buffers) {
@@ -280,9 +640,8 @@ namespace compress {
             }
         }
         // Then look in hash tables
-        auto parent_hash_value = hasher(entry.parent_packed);
-        auto probe_value = get_probe_value(parent_hash_value);
-        auto ptr = internal_closed.get_ptr_with_hash(parent_hash_value, probe_value);
+        auto cursor = internal_closed.probe(hasher(entry.parent_packed));
+        auto ptr = internal_closed.get_ptr(cursor);
         while (!internal_closed.ptr_is_invalid(ptr)) {
             // read node from pointer
             Entry node;
@@ -292,9 +651,8 @@ namespace compress {
             }
             // update pointer and resume while loop if partition values do not
             // match or if false positive probe
-            ptr = internal_closed.get_ptr_with_hash(parent_hash_value,
-                                            probe_value,
-                                            false);
+            internal_closed.next(cursor);
+            ptr = internal_closed.get_ptr(cursor);
         }
         return Entry();
     }
@@ -302,46 +660,158 @@ namespace compress {
     template<class Entry>
     void CompressClosedList<Entry>::
     read_external_at(Entry& entry, size_t index) const {
-        entry.read(static_cast<char *>
-                   (external_closed + index * Entry::get_size_in_bytes()));
+        char buffer[sizeof(Entry)];
+        external_closed.read_entry(index, buffer);
+        entry.read(buffer);
     }
 
     template<class Entry>
     void CompressClosedList<Entry>::
     write_external_at(const Entry& entry, size_t index) {
-        entry.write(static_cast<char *>
-                    (external_closed + index * Entry::get_size_in_bytes()));
+        char buffer[sizeof(Entry)];
+        entry.write(buffer);
+        external_closed.write_entry(index, buffer);
+    }
+
+    template<class Entry>
+    void CompressClosedList<Entry>::
+    checkpoint(utils::Checkpointer& checkpointer, utils::Manifest& manifest) {
+        // the flusher is idle until the next flush_buffer
+        wait_for_flush();
+        external_closed.sync();
+
+        auto buffers_name = checkpointer.get_snapshot_name("closed_buffers");
+        auto buffers_path = checkpointer.get_path(buffers_name);
+        fstream buffers_file(buffers_path,
+                             ios::out | ios::trunc | ios::binary);
+        size_t n_buffered = 0;
+        for (auto& buffer : buffers) {
+            for (auto& node : buffer) {
+                node.write(buffers_file);
+                ++n_buffered;
+            }
+        }
+        if (enable_partitioning) partition_table->save(buffers_file);
+        if (!buffers_file.flush())
+            throw IOException("Fail to write closed list checkpoint");
+        utils::sync_file(buffers_path);
+
+        manifest.set_int("closed nodes", external_closed_index);
+        manifest.set_int("closed buffered nodes", n_buffered);
+        manifest.set_string("closed buffers file", buffers_name);
+        manifest.set_int("closed block nodes", max_buffer_entries);
+        manifest.set_int("closed files", external_closed.get_n_files());
+        manifest.set_string("closed partition function",
+                            partition_function.get_name());
+        manifest.set_int("closed partitions", n_partitions);
+        if (enable_partitioning)
+            manifest.set_int("closed maps", partition_table->size());
+    }
+
+    template<class Entry>
+    void CompressClosedList<Entry>::
+    restore(utils::Checkpointer& checkpointer,
+            const utils::Manifest& manifest) {
+        if (static_cast<size_t>(manifest.get_int("closed block nodes")) !=
+            max_buffer_entries ||
+            static_cast<size_t>(manifest.get_int("closed files")) !=
+            external_closed.get_n_files() ||
+            manifest.get_string("closed partition function") !=
+            partition_function.get_name() ||
+            manifest.get_int("closed partitions") != n_partitions)
+            throw Fatal("Checkpoint was written with other closed list options");
+
+        external_closed_index = manifest.get_int("closed nodes");
+        external_closed.restore(external_closed_index);
+
+        // flushed blocks are always full
+        auto entry_bytes = Entry::get_size_in_bytes();
+        auto n_blocks = external_closed_index / max_buffer_entries;
+        vector<char> block(max_buffer_entries * entry_bytes);
+        block_filters->reserve(n_blocks);
+        size_t ptr = 0;
+        for (size_t i = 0; i < n_blocks; ++i) {
+            external_closed.read_range(ptr * entry_bytes, block.size(),
+                                       block.data());
+            block_filters->add_block();
+            for (size_t j = 0; j < max_buffer_entries; ++j) {
+                Entry node;
+                node.read(&block[j * entry_bytes]);
+                auto hash_value = hasher(node);
+                block_filters->insert(hash_value);
+                internal_closed.insert_ptr_with_hash(ptr++, hash_value);
+            }
+        }
+
+        fstream buffers_file(checkpointer.get_path
+                             (manifest.get_string("closed buffers file")),
+                             ios::in | ios::binary);
+        auto n_buffered = manifest.get_int("closed buffered nodes");
+        for (long long i = 0; i < n_buffered; ++i) {
+            Entry node;
+            if (!node.read(buffers_file))
+                throw IOException("Fail to read closed list checkpoint");
+            buffers[get_partition_value(node)].insert(node);
+        }
+        if (enable_partitioning &&
+            !partition_table->load(buffers_file,
+                                   manifest.get_int("closed maps")))
+            throw IOException("Fail to read closed list checkpoint");
     }
 
     template<class Entry>
     void CompressClosedList<Entry>::clear() {
-        // Let errors go in clear() as we do not want termination at the end of
-        // search, and clean up of files is non-critical
-        munmap(external_closed, external_closed_bytes);
-        close(external_closed_fd);
-        remove("closed_list.bucket");
+        stop_flush_worker();
+        external_closed.clear();
     }
     
 
     template<class Entry>
     void CompressClosedList<Entry>::print_statistics() const {
+        wait_for_flush();
         dfpair(stdout, "size of node (bytes)", "%lu", Entry::get_size_in_bytes());
         dfpair(stdout, "nodes in closed list",
                "%lu", internal_closed.get_n_entries());
         cout << "#pair  \"load factor\"   "
              << "\"" << internal_closed.get_load_factor() << "\"" << endl; 
+        dfpair(stdout, "pointer table resizes", "%lu",
+               internal_closed.get_n_resizes());
+        dfpair(stdout, "pointer table size (bytes)", "%lu",
+               internal_closed.get_size_in_bytes());
         dfpair(stdout, "successful probes",
                "%lu", good_probes);
         dfpair(stdout, "usuccessful probes",
                "%lu", bad_probes);
         dfpair(stdout, "buffer hits",
                "%lu", buffer_hits);
+        dfpair(stdout, "probes rejected by filters",
+               "%lu", filtered_probes);
+        if (n_batches > 0) {
+            dfpair(stdout, "batch lookups", "%lu", n_batches);
+            cout << "#pair  \"pages read per batch\"   "
+                 << "\"" << double(n_batch_pages) / n_batches << "\"" << endl;
+            cout << "#pair  \"fraction of batch reads coalesced\"   "
+                 << "\"" << (n_batch_reads == 0 ? 0.0 :
+                             1.0 - double(n_batch_runs) / n_batch_reads)
+                 << "\"" << endl;
+        }
+        dfpair(stdout, "closed list filters (bytes)", "%lu",
+               block_filters->get_size_in_bytes());
         if (enable_partitioning) {
             dfpair(stdout, "mapping table entries", "%lu",
                    partition_table->size());
             dfpair(stdout, "mapping table size (bytes)", "%lu",
                    partition_table->get_size_in_bytes());
         }
+        dfpair(stdout, "closed list buffers (bytes)", "%lu",
+               (buffers.size() + (background_flush ? 1 : 0)) *
+               buffers[0].get_size_in_bytes());
+        if (background_flush) {
+            dfpair(stdout, "background flushes", "%lu", n_background_flushes);
+            cout << "#pair  \"flush wait time (s)\"   "
+                 << "\"" << flush_wait_seconds << "\"" << endl;
+        }
+        external_closed.print_statistics();
     }
 }
 
@@ -4,17 +4,24 @@
 #ifndef COMPRESS_CLOSED_LIST_ASYNC_HPP
 #define COMPRESS_CLOSED_LIST_ASYNC_HPP
 
-#include "pointer_table.hpp"
+#include "concurrent_pointer_table.hpp"
+#include "growing_pointer_table.hpp"
+#include "external_closed_file.hpp"
+#include "closed_list_options.hpp"
+#include "partition_buffer.hpp"
+#include "partition_function.hpp"
+#include "batch_reader.hpp"
 #include "mapping_table.hpp"
+#include "block_filter.hpp"
 #include "../utils/named_fstream.hpp"
 #include "../utils/memory.hpp"
 #include "../utils/errors.hpp"
+#include "../utils/worker_pool.hpp"
 #include "../hash_functions/tabulation_hash.hpp"
 
 #include <iostream>
 #include <vector>
 #include <memory>
-#include <unordered_set>
 #include <cmath> // for pow
 
 #include <sys/mman.h>
@@ -24,8 +31,8 @@
 #include <unistd.h>
 
 #include <atomic>
-#include <future>
-#include <functional>
+#include <mutex>
+#include <algorithm>
 
 using namespace std;
 
@@ -39,12 +46,24 @@ namespace compress {
         
         struct EntryStats {
             Entry entry;
+            size_t index; // in the batch
             bool valid = true;
             bool first_probe = true;
-            size_t probe_index = 0;
+            typename GrowingPointerTable<ConcurrentPointerTable>::ProbeCursor cursor;
             size_t pointer = 0;
-            Entry external_entry;
-            EntryStats(Entry entry) : entry(entry) {}
+            EntryStats(Entry entry, size_t index) :
+                entry(entry), index(index) {}
+        };
+
+        // probes of one thread of a batch, with reads batched on a reader
+        // of its own
+        struct Prober {
+            unique_ptr<BatchReader> batch_reader;
+            vector<EntryStats> entries_stats;
+            vector<ReadRequest> read_requests;
+            vector<char> read_buffer;
+            // found at a higher g, index in the batch and pointer
+            vector<pair<size_t, size_t> > reopened;
         };
 
         bool reopen_closed;
@@ -52,19 +71,29 @@ namespace compress {
         bool double_hashing;
 
          TabulationHash<Entry> hasher;
-         TabulationHash<Entry> partition_hasher;
+         PartitionFunction<Entry> partition_function;
 
-        vector<unordered_set<Entry, decltype(hasher) > > buffers;
+        vector<PartitionBuffer<Entry, decltype(hasher) > > buffers;
 
         // for compress with partitioning
         unique_ptr<MappingTable> partition_table;
-        unsigned n_partitions = 100;
+        unsigned n_partitions;
+
+        // membership filters of the flushed blocks of the external closed list
+        unique_ptr<BlockFilters> block_filters;
        
-        PointerTable internal_closed;
-        int external_closed_fd;
-        char *external_closed;
+        mutable ExternalClosedFile external_closed; // reads may fill cache
+        GrowingPointerTable<ConcurrentPointerTable> internal_closed;
         size_t external_closed_index = 0;
-        size_t external_closed_bytes = 0;
+
+        // one per thread of the batches, each reading the external entries
+        // of its probe rounds as a single batch
+        vector<Prober> probers;
+        string probe_backend;
+        unsigned probe_queue_depth;
+        size_t read_alignment;
+        // the user-space page cache is not safe to read from several threads
+        mutex cache_mutex;
 
         size_t max_buffer_size_in_bytes = BUFFER_BYTES;
         size_t max_buffer_entries;
@@ -74,25 +103,39 @@ namespace compress {
         
         void flush_buffer(size_t partition_value);
 
+        // false if the filter of the block of ptr rules out hash_value
+        bool may_be_at(size_t hash_value, size_t ptr) const;
+
         void read_external_at(Entry& entry, size_t index) const;
         void write_external_at(const Entry& entry, size_t index);
 
+        // Probes the entries of prober until they are found or ruled out,
+        // setting is_new of the batch for the latter, and collecting those
+        // found at a higher g in prober.reopened. Safe to call from several
+        // threads with distinct probers while nothing is inserted.
+        void probe_batch(Prober& prober, vector<char>& is_new);
+
         // probe statistics, does not include probes for path reconstruction
-        mutable size_t buffer_hits = 0;
-        mutable size_t good_probes = 0;
-        mutable size_t bad_probes = 0;
+        atomic<size_t> buffer_hits{0};
+        atomic<size_t> good_probes{0};
+        atomic<size_t> bad_probes{0};
+        mutable atomic<size_t> filtered_probes{0};
 
-        size_t get_probe_value(size_t hash_value) const;
-        
     public:
         explicit CompressClosedListAsync(bool reopen_closed,
                                     bool enable_partitioning,
                                     bool double_hashing,
-                                    size_t internal_closed_bytes);
+                                    const ClosedListOptions& options);
         
         ~CompressClosedListAsync() = default;
 
-        int batch_duplicate_detection(std::vector<Entry>& entries);
+        // Keeps the entries that are not in the closed list, in their
+        // order, and inserts them, as well as those reopened at a lower g,
+        // which replace the closed ones. The entries must be distinct, and
+        // are probed on the threads of pool. Returns the number of reopened
+        // entries.
+        int batch_duplicate_detection(std::vector<Entry>& entries,
+                                      utils::WorkerPool& pool);
         
         pair<found, reopened> find_in_buffers(const Entry &entry);
         pair<found, reopened> find_in_closed(const Entry &entry);
@@ -111,67 +154,89 @@ namespace compress {
     CompressClosedListAsync<Entry>::CompressClosedListAsync(bool reopen_closed,
                                                   bool enable_partitioning,
                                                   bool double_hashing,
-                                                  size_t internal_closed_bytes)
+                                                  const ClosedListOptions& options)
         : reopen_closed(reopen_closed),
           enable_partitioning(enable_partitioning),
           double_hashing(double_hashing),
-          internal_closed(internal_closed_bytes) 
+          partition_function(options.partition_function),
+          external_closed("closed_list.bucket", options.dirs,
+                          Entry::get_size_in_bytes(),
+                          ConcurrentPointerTable::get_max_entries_bound(options.max_bytes),
+                          options.extent_bytes, options.storage,
+                          options.cache_bytes),
+          internal_closed(options.initial_bytes, options.max_bytes,
+                          options.max_load_factor, double_hashing,
+                          [this](size_t ptr) {
+                              Entry node;
+                              read_external_at(node, ptr);
+                              return hasher(node);
+                          })
     {
         max_buffer_entries = max_buffer_size_in_bytes / Entry::get_size_in_bytes();
+
+        // as many partitions as buffers fit in the memory budget
+        using Buffer = PartitionBuffer<Entry, decltype(hasher)>;
+        partition_function.set_max_partitions
+            (options.buffer_bytes / Buffer::get_size_in_bytes(max_buffer_entries));
+        n_partitions = partition_function.get_n_partitions();
         
         // initialize partition table
         if (enable_partitioning) {
             partition_table =
-                memory::make_unique<MappingTable>(max_buffer_entries);
+                memory::make_unique<MappingTable>(max_buffer_entries,
+                                                  n_partitions);
+            // reserve up front so that concurrent lookups never observe a
+            // reallocation of the mapping table
+            partition_table->reserve(internal_closed.get_max_entries_bound() /
+                                     max_buffer_entries + 1);
            
-            buffers.resize(n_partitions);
-        } else {
-            buffers.resize(1); // use only buffers[0] if no partitioning
         }
+        block_filters = memory::make_unique<BlockFilters>(max_buffer_entries,
+                                                          options.filter_bits);
+        // as for the mapping table, filters must never be reallocated
+        block_filters->reserve(internal_closed.get_max_entries_bound() /
+                               max_buffer_entries + 1);
+        // use only buffers[0] if no partitioning
+        auto n_buffers = enable_partitioning ? n_partitions : 1;
+        buffers.reserve(n_buffers);
+        for (unsigned i = 0; i < n_buffers; ++i)
+            buffers.emplace_back(max_buffer_entries, hasher);
         
-        // initialize external closed list
-        external_closed_bytes =
-            internal_closed.get_max_entries() * Entry::get_size_in_bytes();
-        dfpair(stdout, "external closed (bytes)", "%lu", external_closed_bytes);
-
-        external_closed_fd = open("closed_list.bucket", O_CREAT | O_TRUNC | O_RDWR,
-                                  S_IRUSR | S_IWUSR);
-        if (external_closed_fd < 0)
-            throw IOException("Fail to create closed list file");
-        
-        if (posix_fallocate64(external_closed_fd, 0, external_closed_bytes) < 0)
-            throw IOException("Fail to fallocate closed list file");
-        
-        external_closed =
-            static_cast<char *>(mmap(NULL, external_closed_bytes,
-                                     PROT_READ | PROT_WRITE, MAP_SHARED,
-                                     external_closed_fd, 0));
-        if (external_closed == MAP_FAILED)
-            throw IOException("Fail to mmap closed list file");
-
-        if (madvise(external_closed, external_closed_bytes, MADV_RANDOM) < 0)
-            throw IOException("Fail to give madvise for closed list file");
+        probe_backend = options.probe_backend;
+        probe_queue_depth = options.probe_queue_depth;
+        read_alignment = external_closed.open_read_fds(options.probe_direct_io);
+        // the others once a batch is probed on more threads
+        probers.resize(1);
+        probers[0].batch_reader = BatchReader::create(probe_backend,
+                                                      probe_queue_depth,
+                                                      read_alignment);
+
+        dfpair(stdout, "external closed reserved (bytes)", "%lu",
+               external_closed.get_reserved_bytes());
+        dfpair(stdout, "external closed extent (bytes)", "%lu",
+               options.extent_bytes);
+        dfpair(stdout, "external closed files", "%lu",
+               external_closed.get_n_files());
 
         // Logging
-        if (enable_partitioning)
+        if (enable_partitioning) {
+            dfpair(stdout, "partition function", "%s",
+                   partition_function.get_name().c_str());
             dfpair(stdout, "number of partitions", "%u", n_partitions);
+        }
         if (double_hashing) {
             dfpair(stdout, "probe strategy", "%s", "double hashing");
         } else {
             dfpair(stdout, "probe strategy", "%s", "linear probing");
         }
-        dfpair(stdout, "max capacity of closed list (nodes)", "%lu",
+        dfpair(stdout, "initial capacity of closed list (nodes)", "%lu",
                internal_closed.get_max_entries());
-    }
-
-    template<class Entry>
-    size_t CompressClosedListAsync<Entry>::get_probe_value(size_t hash_value) const {
-        if (!double_hashing) return 1; // linear probing
-        
-        // From Introduction to Algorithms 3rd Edition, pg 273
-        // This guarantees that double hashing does not cycle if max entries of
-        // internal_closed is prime.
-        return 1 + (hash_value % (internal_closed.get_max_entries() - 1));
+        dfpair(stdout, "max pointer table size (bytes)", "%lu",
+               options.max_bytes);
+        dfpair(stdout, "closed list filter bits per node", "%lu",
+               options.filter_bits);
+        cout << "#pair  \"pointer table growth load factor\"   "
+             << "\"" << options.max_load_factor << "\"" << endl;
     }
 
     template<class Entry>
@@ -181,13 +246,12 @@ namespace compress {
         
         auto& buffer = buffers[partition_value];
         
-        auto buffer_it = buffer.find(entry);
-        if (buffer_it != buffer.end()) {
+        auto buffer_entry = buffer.find(entry);
+        if (buffer_entry) {
             ++buffer_hits;
             if (reopen_closed) {
-                if (entry.g < buffer_it->g) {
-                    buffer.erase(buffer_it);
-                    buffer.insert(entry);
+                if (entry.g < buffer_entry->g) {
+                    *buffer_entry = entry;
                     return make_pair(true, true);
                 }
             }
@@ -197,19 +261,22 @@ namespace compress {
         return make_pair(false, false);
     }
 
-    // TODO: ensure this is thread safe
+    // Safe to call from several threads, as the probe position is kept in a
+    // local cursor, but not while flush_buffer is inserting pointers, which
+    // may grow the pointer table and free the old one.
     template<class Entry>
     pair<found, reopened> CompressClosedListAsync<Entry>::
     find_in_closed(const Entry &entry) {
         auto partition_value = get_partition_value(entry);    
         auto hash_value = hasher(entry);
-        auto probe_value = get_probe_value(hash_value);
-        auto ptr = internal_closed.get_ptr_with_hash(hash_value, probe_value);
+        auto cursor = internal_closed.probe(hash_value);
+        auto ptr = internal_closed.get_ptr(cursor);
         while (!internal_closed.ptr_is_invalid(ptr)) {
 
-            // first check in partition table
-            if (!enable_partitioning ||
-                partition_value == partition_table->get_value_from_ptr(ptr)) {
+            // first check in partition table, then in the filter of the block
+            if ((!enable_partitioning ||
+                 partition_value == partition_table->get_value_from_ptr(ptr)) &&
+                may_be_at(hash_value, ptr)) {
                 // read node from pointer
                 Entry node;
                 read_external_at(node, ptr);
@@ -227,7 +294,8 @@ namespace compress {
             }
             // update pointer and resume while loop if partition values do not
             // match or if false positive probe
-            ptr = internal_closed.get_ptr_with_hash(hash_value, probe_value, false);
+            internal_closed.next(cursor);
+            ptr = internal_closed.get_ptr(cursor);
         }
         return make_pair(false, false);
     }
@@ -265,27 +333,40 @@ namespace compress {
     template<class Entry>
     unsigned CompressClosedListAsync<Entry>::get_partition_value(const Entry& entry) const {
         if (!enable_partitioning) return 0;
-        return partition_hasher(entry) % n_partitions;
+        return partition_function(entry);
     }
 
     template<class Entry>
     void CompressClosedListAsync<Entry>::flush_buffer(size_t partition_value) {
-        //std::cout << " flush " << std::endl;
+        external_closed.ensure_capacity(external_closed_index +
+                                        buffers[partition_value].size());
+        block_filters->add_block();
+        // the mapping table entry must be in place before any pointer to the
+        // flushed nodes is published to concurrent lookups
+        if (enable_partitioning)
+            partition_table->insert_map_value(partition_value);
         for (auto& node : buffers[partition_value]) {
             write_external_at(node, external_closed_index);
             auto hash_value = hasher(node);
+            block_filters->insert(hash_value);
             internal_closed.insert_ptr_with_hash(external_closed_index,
-                                        hash_value,
-                                        get_probe_value(hash_value));
+                                                 hash_value);
             ++external_closed_index;
         }
-        if (enable_partitioning)
-            partition_table->insert_map_value(partition_value);
-        // release memory
-        unordered_set<Entry, decltype(hasher) >().swap(buffers[partition_value]);
+        external_closed.write_back();
+        buffers[partition_value].clear();
     }
     
     
+    template<class Entry>
+    bool CompressClosedListAsync<Entry>::
+    may_be_at(size_t hash_value, size_t ptr) const {
+        if (block_filters->may_contain(ptr / max_buffer_entries, hash_value))
+            return true;
+        ++filtered_probes;
+        return false;
+    }
+
     template<class Entry>
     Entry CompressClosedListAsync<Entry>::
     trace_parent(const Entry &entry) const {
@@ -299,9 +380,8 @@ namespace compress {
             }
         }
         // Then look in hash tables
-        auto parent_hash_value = hasher(entry.parent_packed);
-        auto probe_value = get_probe_value(parent_hash_value);
-        auto ptr = internal_closed.get_ptr_with_hash(parent_hash_value, probe_value);
+        auto cursor = internal_closed.probe(hasher(entry.parent_packed));
+        auto ptr = internal_closed.get_ptr(cursor);
         while (!internal_closed.ptr_is_invalid(ptr)) {
             // read node from pointer
             Entry node;
@@ -311,9 +391,8 @@ namespace compress {
             }
             // update pointer and resume while loop if partition values do not
             // match or if false positive probe
-            ptr = internal_closed.get_ptr_with_hash(parent_hash_value,
-                                            probe_value,
-                                            false);
+            internal_closed.next(cursor);
+            ptr = internal_closed.get_ptr(cursor);
         }
         return Entry();
     }
@@ -321,24 +400,22 @@ namespace compress {
     template<class Entry>
     void CompressClosedListAsync<Entry>::
     read_external_at(Entry& entry, size_t index) const {
-        entry.read(static_cast<char *>
-                   (external_closed + index * Entry::get_size_in_bytes()));
+        char buffer[sizeof(Entry)];
+        external_closed.read_entry(index, buffer);
+        entry.read(buffer);
     }
 
     template<class Entry>
     void CompressClosedListAsync<Entry>::
     write_external_at(const Entry& entry, size_t index) {
-        entry.write(static_cast<char *>
-                    (external_closed + index * Entry::get_size_in_bytes()));
+        char buffer[sizeof(Entry)];
+        entry.write(buffer);
+        external_closed.write_entry(index, buffer);
     }
 
     template<class Entry>
     void CompressClosedListAsync<Entry>::clear() {
-        // Let errors go in clear() as we do not want termination at the end of
-        // search, and clean up of files is non-critical
-        munmap(external_closed, external_closed_bytes);
-        close(external_closed_fd);
-        remove("closed_list.bucket");
+        external_closed.clear();
     }
     
 
@@ -349,70 +426,66 @@ namespace compress {
                "%lu", internal_closed.get_n_entries());
         cout << "#pair  \"load factor\"   "
              << "\"" << internal_closed.get_load_factor() << "\"" << endl; 
+        dfpair(stdout, "pointer table resizes", "%lu",
+               internal_closed.get_n_resizes());
+        dfpair(stdout, "pointer table size (bytes)", "%lu",
+               internal_closed.get_size_in_bytes());
         dfpair(stdout, "successful probes",
-               "%lu", good_probes);
+               "%lu", good_probes.load());
         dfpair(stdout, "usuccessful probes",
-               "%lu", bad_probes);
+               "%lu", bad_probes.load());
         dfpair(stdout, "buffer hits",
-               "%lu", buffer_hits);
+               "%lu", buffer_hits.load());
+        dfpair(stdout, "probes rejected by filters",
+               "%lu", filtered_probes.load());
+        dfpair(stdout, "closed list filters (bytes)", "%lu",
+               block_filters->get_size_in_bytes());
         if (enable_partitioning) {
             dfpair(stdout, "mapping table entries", "%lu",
                    partition_table->size());
             dfpair(stdout, "mapping table size (bytes)", "%lu",
                    partition_table->get_size_in_bytes());
         }
+        dfpair(stdout, "closed list buffers (bytes)", "%lu",
+               buffers.size() * buffers[0].get_size_in_bytes());
+        external_closed.print_statistics();
+        vector<const BatchReader *> readers;
+        for (auto& prober : probers)
+            readers.push_back(prober.batch_reader.get());
+        BatchReader::print_statistics(readers);
     }
 
     template<class Entry>
-    int CompressClosedListAsync<Entry>::
-    batch_duplicate_detection(std::vector<Entry>& entries) {
-        //std::cout << "enter " << std::endl;
-        // assume no reopenings TODO:fix this 
-        std::vector<Entry> to_expand;
-        std::vector<EntryStats> entries_stats;
-
-        int reopen = 0;
-
-        // check against buffers
-        for (auto& entry : entries) {
-            bool found, reopened;
-            tie(found, reopened) = find_in_buffers(entry);
-            /*(if (reopened) {
-                to_expand.emplace_back(entry);
-                ++reopen;
-                }*/
-            if (!found) {
-                entries_stats.push_back(EntryStats(entry));
-            }
-        }
-        
+    void CompressClosedListAsync<Entry>::
+    probe_batch(Prober& prober, vector<char>& is_new) {
+        auto& entries_stats = prober.entries_stats;
+        auto& read_requests = prober.read_requests;
+        auto& read_buffer = prober.read_buffer;
         while (entries_stats.size() != 0) {
-            //std::cout << "entries size " << entries_stats.size() << std::endl;
             // get pointers
             for (auto& entry_stats : entries_stats) {
+                auto hash_value = hasher(entry_stats.entry);
                 do {
-                    // update probe index
+                    // update probe cursor
                     if (entry_stats.first_probe) {
-                        entry_stats.probe_index =
-                            hasher(entry_stats.entry) % internal_closed.get_max_entries();
+                        entry_stats.cursor = internal_closed.probe(hash_value);
                         entry_stats.first_probe = false;
                     } else {
-                        entry_stats.probe_index =
-                            (entry_stats.probe_index +
-                             get_probe_value(hasher(entry_stats.entry)))
-                            % internal_closed.get_max_entries();
+                        internal_closed.next(entry_stats.cursor);
                     }
-                    entry_stats.pointer =
-                        internal_closed.get_ptr_at_index(entry_stats.probe_index);
+                    entry_stats.pointer = internal_closed.get_ptr(entry_stats.cursor);
                     if (internal_closed.ptr_is_invalid(entry_stats.pointer)) {
-                        to_expand.emplace_back(entry_stats.entry);
+                        is_new[entry_stats.index] = true;
                         entry_stats.valid = false;
                     }
                 }
-                // if filtered by mapping table, update probe index
+                // if filtered by mapping table or block filter, update probe
+                // index
                 while (entry_stats.valid &&
-                       get_partition_value(entry_stats.entry) !=
-                       partition_table->get_value_from_ptr(entry_stats.pointer));
+                       ((enable_partitioning &&
+                         get_partition_value(entry_stats.entry) !=
+                         partition_table->get_value_from_ptr(entry_stats.pointer)) ||
+                        !may_be_at(hash_value, entry_stats.pointer)));
                        
             }
             // remove unecessary entries
@@ -422,23 +495,52 @@ namespace compress {
                  entries_stats.end());
             
             if (entries_stats.size() == 0) break; // nothing to probe
-            // check in external hash table
-            std::vector<std::future<void> > futures;
-            for (auto& entry_stats : entries_stats) {
-
-                futures.push_back(std::async(std::launch::async,
-                                             &CompressClosedListAsync<Entry>::read_external_at,
-                                             this,
-                                             std::ref(entry_stats.external_entry),
-                                             entry_stats.pointer));
+            // check in external hash table, all reads of the round in one
+            // batch
+            auto entry_bytes = Entry::get_size_in_bytes();
+            read_buffer.resize(entries_stats.size() * entry_bytes);
+            read_requests.clear();
+            for (size_t i = 0; i < entries_stats.size(); ++i) {
+                // pages resident in the user-space cache need no device read
+                if (external_closed.is_cached()) {
+                    lock_guard<mutex> lock(cache_mutex);
+                    if (external_closed.read_entry_if_cached
+                        (entries_stats[i].pointer, &read_buffer[i * entry_bytes]))
+                        continue;
+                }
+                int fd;
+                uint64_t file_offset;
+                if (!external_closed.get_read_location
+                    (entries_stats[i].pointer * entry_bytes, entry_bytes,
+                     fd, file_offset)) {
+                    // straddles two files of the stripe
+                    lock_guard<mutex> lock(cache_mutex);
+                    external_closed.read_entry(entries_stats[i].pointer,
+                                               &read_buffer[i * entry_bytes]);
+                    continue;
+                }
+                read_requests.push_back(
+                    ReadRequest{fd, file_offset, entry_bytes,
+                            &read_buffer[i * entry_bytes]});
             }
+            // submit in file order, for near sequential device access
+            sort(read_requests.begin(), read_requests.end(),
+                 [](const ReadRequest& a, const ReadRequest& b) {
+                     return a.fd < b.fd ||
+                         (a.fd == b.fd && a.offset < b.offset);
+                 });
+            prober.batch_reader->read_batch(read_requests);
 
             for (size_t i = 0; i < entries_stats.size(); ++ i) {
-                futures[i].get();
-                  if (entries_stats[i].entry ==
-                      entries_stats[i].external_entry) {
+                  Entry external_entry;
+                  external_entry.read(&read_buffer[i * entry_bytes]);
+                  if (entries_stats[i].entry == external_entry) {
                       ++good_probes;
                       entries_stats[i].valid = false;
+                      if (reopen_closed &&
+                          entries_stats[i].entry.g < external_entry.g)
+                          prober.reopened.emplace_back
+                              (entries_stats[i].index, entries_stats[i].pointer);
                   } else {
                       ++bad_probes;
                   }
@@ -450,11 +552,66 @@ namespace compress {
                                 [](EntryStats& entrystats) {return !entrystats.valid;}),
                  entries_stats.end());
         }
-        for (auto& entry : to_expand) {
-            insert_in_buffer(entry);
+    }
+
+    template<class Entry>
+    int CompressClosedListAsync<Entry>::
+    batch_duplicate_detection(std::vector<Entry>& entries,
+                              utils::WorkerPool& pool) {
+        auto n_threads = pool.get_n_threads();
+        while (probers.size() < n_threads) {
+            probers.emplace_back();
+            probers.back().batch_reader =
+                BatchReader::create(probe_backend, probe_queue_depth,
+                                    read_alignment);
+        }
+
+        // check against buffers, then split the rest evenly among the
+        // threads, in order
+        vector<char> is_new(entries.size(), false);
+        vector<char> is_reopened(entries.size(), false);
+        vector<size_t> probed;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            bool found, reopened;
+            tie(found, reopened) = find_in_buffers(entries[i]);
+            if (!found) probed.push_back(i);
+            is_reopened[i] = reopened;
+        }
+        for (unsigned thread = 0; thread < n_threads; ++thread) {
+            auto& entries_stats = probers[thread].entries_stats;
+            entries_stats.clear();
+            probers[thread].reopened.clear();
+            for (auto i = pool.get_first(probed.size(), thread);
+                 i < pool.get_first(probed.size(), thread + 1); ++i)
+                entries_stats.push_back(EntryStats(entries[probed[i]],
+                                                   probed[i]));
+        }
+        pool.run([this, &is_new](unsigned thread) {
+                probe_batch(probers[thread], is_new);
+            });
+
+        // written after all probes, as reads of other threads may cover the
+        // same pages, and inserted after, as flushes publish pointers
+        for (unsigned thread = 0; thread < n_threads; ++thread) {
+            for (auto& reopened : probers[thread].reopened) {
+                write_external_at(entries[reopened.first], reopened.second);
+                is_reopened[reopened.first] = true;
+            }
+        }
+        size_t n_kept = 0;
+        int n_reopened = 0;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (is_new[i]) {
+                insert_in_buffer(entries[i]);
+            } else if (is_reopened[i]) {
+                ++n_reopened;
+            } else {
+                continue;
+            }
+            entries[n_kept++] = entries[i];
         }
-        entries.swap(to_expand);
-        return reopen;
+        entries.resize(n_kept);
+        return n_reopened;
     }
 }
 
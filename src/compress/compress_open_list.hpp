@@ -5,10 +5,17 @@
 #define COMPRESS_OPEN_LIST_HPP
 
 #include "../utils/errors.hpp"
-#include "../utils/named_fstream.hpp"
+#include "../utils/memory.hpp"
+#include "../utils/record_file.hpp"
+#include "../utils/checkpoint.hpp"
+#include "../hash_functions/tabulation_hash.hpp"
+#include "push_buffer.hpp"
 
 #include <utility>
+#include <vector>
+#include <algorithm>
 #include <map>
+#include <unordered_map>
 #include <set>
 #include <string>
 #include <sstream>
@@ -22,30 +29,147 @@ using namespace std;
 namespace compress {
     template<class Entry>
     class CompressOpenList  {
-        
-        map<int, map<int, named_fstream> > fg_buckets;
-        
-        int size;
 
-        string get_bucket_string(int f, int g) const;
-        bool exists_bucket(int f, int g) const;
-        void create_bucket(int f, int g);
+        // before the buckets, which wait for their reads and writes when
+        // destroyed, and give back their segments
+        unique_ptr<utils::CompressionStats> compression;
+        unique_ptr<utils::SegmentFile> segments;
+        unique_ptr<utils::WriteBehind> writer;
+        unique_ptr<utils::ReadAhead> reader;
+
+        // Entries are appended at the end and popped FIFO from the read
+        // cursor, so that the file is not overwritten while the bucket lives,
+        // and a checkpoint can refer to it by offset. The space of popped
+        // entries is given back as the cursor moves on.
+        map<int, map<int, RecordFile> > fg_buckets;
+
+        int size = 0;
+
+        utils::Checkpointer& checkpointer;
+        RecordFileOptions bucket_options;
+        size_t n_created_buckets = 0; // file names are never reused
+
+        // Buckets are created on the memory backend while their records fit
+        // in bucket_options.memory_bytes. Past it, those to be popped last,
+        // of highest f and then lowest g, are moved to files.
+        bool hybrid;
+        RecordFileOptions memory_options;
+        size_t memory_bytes = 0;
+        size_t max_memory_bytes = 0;
+        size_t n_spilled_buckets = 0;
+        size_t spilled_bytes = 0;
+
+        // Entries pushed to a bucket are staged in a push buffer of its
+        // own until it is full, or the bucket is the next to be read, so that
+        // duplicates among them are combined. Buffers are reused once their
+        // entries are written.
+        using Staging = PushBuffer<Entry, TabulationHash<Entry> >;
+        unique_ptr<TabulationHash<Entry> > hasher;
+        unordered_map<RecordFile *, unique_ptr<Staging> > staged;
+        vector<unique_ptr<Staging> > spare_buffers;
+        size_t n_combined = 0;
+
+        void flush_staged(RecordFile& bucket);
+        void flush_all_staged();
+        bool is_staged(RecordFile& bucket) const {
+            return !staged.empty() && staged.count(&bucket) > 0;
+        }
+
+        // after n entries were written to the bucket
+        void count_written(RecordFile& bucket, size_t n);
+        void spill();
+        void move_to_file(RecordFile& bucket);
+
+        string get_bucket_string(int f, int g, size_t id) const;
+        RecordFile& create_bucket(int f, int g);
+        // reads ahead the first bucket to be popped other than current
+        void prefetch_next(const RecordFile *current);
+        // first bucket in the order of popping with entries left, nullptr if
+        // there is none
+        RecordFile *get_front_bucket(int& f, int& g);
+        // after n entries were read from the bucket of f and g
+        void finish_read(int f, int g, size_t n);
 
     public:
-        CompressOpenList();
-        
+        CompressOpenList(utils::Checkpointer& checkpointer,
+                         const RecordFileOptions& bucket_options =
+                         RecordFileOptions());
+
         Entry pop();
+        // Appends to entries up to max entries of the next bucket to be
+        // popped, all of the same f and g and read at once, and returns
+        // their number, 0 if the list is empty.
+        size_t pop_batch(size_t max, vector<Entry>& entries);
         void push(const Entry &entry);
+        // f of the next entry to be popped, false if the list is empty
+        bool get_front_f(int& f);
+
+        // Reads up to k entries in the order they would be popped if nothing
+        // else was pushed, without removing them.
+        void peek(vector<Entry>& entries, size_t k);
         void clear();
         bool isempty() const;
+
+        // Records buckets and offsets in the manifest, with their files synced
+        void checkpoint(utils::Manifest& manifest);
+        void restore(const utils::Manifest& manifest);
+
+        void print_statistics() {
+            if (writer) writer->print_statistics();
+            if (reader) reader->print_statistics();
+            if (segments) segments->print_statistics();
+            if (compression) compression->print_statistics();
+            dfpair(stdout, "open list peak memory (bytes)", "%lu",
+                   max_memory_bytes);
+            dfpair(stdout, "open list spilled buckets", "%lu",
+                   n_spilled_buckets);
+            dfpair(stdout, "open list spilled (bytes)", "%lu", spilled_bytes);
+            dfpair(stdout, "open list combined duplicates", "%lu", n_combined);
+            dfpair(stdout, "open list peak disk (bytes)", "%ld",
+                   RecordFile::get_peak_disk_bytes());
+        }
     };
 
-    
+
     template<class Entry>
-    CompressOpenList<Entry>::CompressOpenList()
+    CompressOpenList<Entry>::CompressOpenList(utils::Checkpointer& checkpointer,
+                                              const RecordFileOptions& bucket_options) :
+        checkpointer(checkpointer),
+        bucket_options(bucket_options),
+        hybrid(bucket_options.memory_bytes > 0 &&
+               bucket_options.backend != utils::StorageBackend::memory)
     {
         // create directory for open list files if not exist
         mkdir("open_list_buckets", 0744);
+        if (bucket_options.segment_bytes > 0) {
+            segments = memory::make_unique<utils::SegmentFile>
+                (bucket_options.backend, "open_list_buckets/segments",
+                 bucket_options.segment_bytes);
+            this->bucket_options.segments = segments.get();
+        }
+        if (bucket_options.compress) {
+            compression = memory::make_unique<utils::CompressionStats>();
+            this->bucket_options.compression = compression.get();
+        }
+        if (bucket_options.write_behind > 0) {
+            writer = memory::make_unique<utils::WriteBehind>
+                (bucket_options.write_behind);
+            this->bucket_options.writer = writer.get();
+        }
+        if (bucket_options.read_ahead) {
+            reader = memory::make_unique<utils::ReadAhead>();
+            this->bucket_options.reader = reader.get();
+        }
+        if (bucket_options.push_buffer > 0)
+            hasher = memory::make_unique<TabulationHash<Entry> >();
+        memory_options = this->bucket_options;
+        memory_options.backend = utils::StorageBackend::memory;
+        dfpair(stdout, "open list storage", "%s",
+               utils::get_storage_backend_name(bucket_options.backend));
+        dfpair(stdout, "open list memory (bytes)", "%lu",
+               hybrid ? bucket_options.memory_bytes : 0);
+        dfpair(stdout, "open list push buffer (nodes)", "%lu",
+               bucket_options.push_buffer);
     }
 
     template<class Entry>
@@ -54,10 +178,83 @@ namespace compress {
         auto f = entry.f;
         auto g = entry.g;
 
-        if (!exists_bucket(f, g)) create_bucket(f, g);
-        if (!entry.write(fg_buckets[f][g]))
-            throw IOException("Fail to write state to fstream.");
+        auto& g_buckets = fg_buckets[f];
+        auto g_bucket = g_buckets.find(g);
+        auto& bucket = g_bucket != g_buckets.end() ? g_bucket->second :
+            create_bucket(f, g);
+        if (!hasher) {
+            entry.write(bucket);
+            ++size;
+            count_written(bucket, 1);
+            return;
+        }
+
+        auto& buffer = staged[&bucket];
+        if (!buffer) {
+            if (spare_buffers.empty()) {
+                buffer = memory::make_unique<Staging>
+                    (bucket_options.push_buffer, *hasher);
+            } else {
+                buffer = move(spare_buffers.back());
+                spare_buffers.pop_back();
+            }
+        }
+        if (!buffer->push(entry)) {
+            ++n_combined;
+            return;
+        }
         ++size;
+        if (buffer->is_full()) flush_staged(bucket);
+    }
+
+    template<class Entry>
+    void CompressOpenList<Entry>::flush_staged(RecordFile& bucket) {
+        auto buffer = staged.find(&bucket);
+        if (buffer == staged.end()) return;
+        auto& entries = buffer->second->get_entries();
+        auto n = entries.size();
+        Entry::write_many(bucket, entries.data(), n);
+        buffer->second->clear();
+        spare_buffers.push_back(move(buffer->second));
+        staged.erase(buffer);
+        count_written(bucket, n);
+    }
+
+    template<class Entry>
+    void CompressOpenList<Entry>::flush_all_staged() {
+        while (!staged.empty()) flush_staged(*staged.begin()->first);
+    }
+
+    template<class Entry>
+    void CompressOpenList<Entry>::count_written(RecordFile& bucket, size_t n) {
+        if (!bucket.is_in_memory()) return;
+        memory_bytes += n * Entry::get_size_in_bytes();
+        max_memory_bytes = max(max_memory_bytes, memory_bytes);
+        if (memory_bytes > bucket_options.memory_bytes) spill();
+    }
+
+    template<class Entry>
+    void CompressOpenList<Entry>::spill() {
+        // down to 7/8 of the budget, so that the pushes right after do not
+        // move a bucket each
+        auto target = bucket_options.memory_bytes / 8 * 7;
+        for (auto f_bucket = fg_buckets.rbegin();
+             f_bucket != fg_buckets.rend(); ++f_bucket) {
+            for (auto& g_bucket : f_bucket->second) {
+                if (memory_bytes <= target) return;
+                move_to_file(g_bucket.second);
+            }
+        }
+    }
+
+    template<class Entry>
+    void CompressOpenList<Entry>::move_to_file(RecordFile& bucket) {
+        if (!bucket.is_in_memory()) return;
+        auto bytes = bucket.get_size() - bucket.get_reclaimed();
+        memory_bytes -= bytes;
+        spilled_bytes += bytes;
+        ++n_spilled_buckets;
+        bucket.move_to_file(bucket_options);
     }
 
     template<class Entry>
@@ -65,32 +262,114 @@ namespace compress {
         assert(size > 0);
         Entry min_entry;
 
-        //TODO: Forloop unecessary? Always returns on first iteration.
+        int f, g;
+        auto bucket = get_front_bucket(f, g);
+        if (!bucket) return min_entry;
+        // FIFO
+        if (!min_entry.read(*bucket))
+            throw IOException("Fail to read state from open list.");
+        finish_read(f, g, 1);
+        return min_entry;
+    }
+
+    template<class Entry>
+    size_t CompressOpenList<Entry>::pop_batch(size_t max,
+                                              vector<Entry>& entries) {
+        int f, g;
+        auto bucket = get_front_bucket(f, g);
+        if (!bucket || max == 0) return 0;
+        auto first = entries.size();
+        entries.resize(first + max);
+        auto n = Entry::read_many(*bucket, &entries[first], max);
+        entries.resize(first + n);
+        if (n == 0)
+            throw IOException("Fail to read states from open list.");
+        finish_read(f, g, n);
+        return n;
+    }
+
+    template<class Entry>
+    bool CompressOpenList<Entry>::get_front_f(int& f) {
+        int g;
+        return get_front_bucket(f, g) != nullptr;
+    }
+
+    template<class Entry>
+    RecordFile *CompressOpenList<Entry>::get_front_bucket(int& f, int& g) {
         // tiebreak by lowest f value
-        for (auto f_bucket = fg_buckets.begin();
-             f_bucket != fg_buckets.end(); ++f_bucket) {
+        for (auto& f_bucket : fg_buckets) {
             // tiebreak by highest g value
-            for (auto g_bucket = f_bucket->second.rbegin();
-                 g_bucket != f_bucket->second.rend(); ++g_bucket) {
-                // FIFO 
-                g_bucket->second.seekp(-Entry::get_size_in_bytes(), ios::cur);
-                min_entry.read(g_bucket->second);
-                g_bucket->second.seekp(-Entry::get_size_in_bytes(), ios::cur);
-
-                // remove files if empty
-                if (g_bucket->second.tellp() == 0) {
-                    auto g = g_bucket->first;
-                    f_bucket->second.erase(g);
-                    if (f_bucket->second.empty()) {
-                        auto f = f_bucket->first;
-                        fg_buckets.erase(f);
-                    }
-                }
-                --size;
-                return min_entry;
+            for (auto g_bucket = f_bucket.second.rbegin();
+                 g_bucket != f_bucket.second.rend(); ++g_bucket) {
+                // the staged entries of the front bucket are read after the
+                // written ones
+                if (is_staged(g_bucket->second))
+                    flush_staged(g_bucket->second);
+                if (g_bucket->second.is_read_done()) continue;
+                f = f_bucket.first;
+                g = g_bucket->first;
+                return &g_bucket->second;
+            }
+        }
+        return nullptr;
+    }
+
+    template<class Entry>
+    void CompressOpenList<Entry>::finish_read(int f, int g, size_t n) {
+        auto f_bucket = fg_buckets.find(f);
+        auto g_bucket = f_bucket->second.find(g);
+
+        // Remove files if empty. With checkpoints, an empty bucket is kept
+        // and appended to again, instead of retiring a file per emptied
+        // bucket; checkpoint() drops it.
+        auto& bucket = g_bucket->second;
+        const RecordFile *current = &bucket;
+        if (bucket.is_read_done() && !is_staged(bucket) &&
+            !checkpointer.is_enabled()) {
+            if (bucket.is_in_memory())
+                memory_bytes -= bucket.get_size() - bucket.get_reclaimed();
+            current = nullptr;
+            f_bucket->second.erase(g_bucket);
+            if (f_bucket->second.empty()) fg_buckets.erase(f_bucket);
+        } else {
+            auto reclaimed = bucket.reclaim();
+            if (bucket.is_in_memory()) memory_bytes -= reclaimed;
+        }
+        if (reader) prefetch_next(current);
+        size -= n;
+    }
+
+    template<class Entry>
+    void CompressOpenList<Entry>::prefetch_next(const RecordFile *current) {
+        for (auto& f_bucket : fg_buckets) {
+            for (auto g_bucket = f_bucket.second.rbegin();
+                 g_bucket != f_bucket.second.rend(); ++g_bucket) {
+                auto& bucket = g_bucket->second;
+                if (&bucket == current ||
+                    (bucket.is_read_done() && !is_staged(bucket))) continue;
+                bucket.prefetch();
+                return;
+            }
+        }
+    }
+
+    template<class Entry>
+    void CompressOpenList<Entry>::peek(vector<Entry>& entries, size_t k) {
+        entries.clear();
+        for (auto& f_bucket : fg_buckets) {
+            for (auto g_bucket = f_bucket.second.rbegin();
+                 g_bucket != f_bucket.second.rend(); ++g_bucket) {
+                auto& bucket = g_bucket->second;
+                flush_staged(bucket);
+                auto head = bucket.get_read_offset();
+                auto first = entries.size();
+                entries.resize(k);
+                entries.resize(first + Entry::read_many
+                               (bucket, &entries[first], k - first));
+                bucket.set_read_offset(head);
+                if (entries.size() == k) return;
             }
         }
-        return min_entry;
     }
 
     template<class Entry>
@@ -100,41 +379,106 @@ namespace compress {
 
     template<class Entry>
     void CompressOpenList<Entry>::clear() {
+        staged.clear();
         fg_buckets.clear();
         size = 0;
+        memory_bytes = 0;
         rmdir("open_list_buckets");
     }
-    
+
     template<class Entry>
-    string CompressOpenList<Entry>::
-    get_bucket_string(int f, int g) const {
-        std::ostringstream oss;
-        oss << "open_list_buckets/" <<  f << "_" << g << ".bucket";
-        return oss.str();
+    void CompressOpenList<Entry>::checkpoint(utils::Manifest& manifest) {
+        flush_all_staged();
+        // empty buckets are left out, and their files removed after commit
+        for (auto f_bucket = fg_buckets.begin(); f_bucket != fg_buckets.end();) {
+            auto& g_buckets = f_bucket->second;
+            for (auto g_bucket = g_buckets.begin(); g_bucket != g_buckets.end();) {
+                auto& bucket = g_bucket->second;
+                if (bucket.is_read_done()) {
+                    if (bucket.is_in_memory())
+                        memory_bytes -= bucket.get_size() -
+                            bucket.get_reclaimed();
+                    checkpointer.retire(bucket);
+                    g_bucket = g_buckets.erase(g_bucket);
+                } else {
+                    ++g_bucket;
+                }
+            }
+            if (g_buckets.empty()) {
+                f_bucket = fg_buckets.erase(f_bucket);
+            } else {
+                ++f_bucket;
+            }
+        }
+
+        size_t n_buckets = 0;
+        for (auto& f_bucket : fg_buckets) {
+            for (auto& g_bucket : f_bucket.second) {
+                auto& bucket = g_bucket.second;
+                // a checkpoint refers to files
+                move_to_file(bucket);
+                bucket.sync();
+                // what a resumed search reads
+                bucket.keep_from(bucket.get_read_offset());
+                std::ostringstream oss;
+                oss << f_bucket.first << " " << g_bucket.first << " "
+                    << bucket.get_read_offset() << " " << bucket.get_size()
+                    << " " << bucket.get_file_name();
+                manifest.set_string("open bucket " + to_string(n_buckets++),
+                                    oss.str());
+            }
+        }
+        manifest.set_int("open buckets", n_buckets);
+        manifest.set_int("open size", size);
+        manifest.set_int("open created buckets", n_created_buckets);
     }
 
     template<class Entry>
-    bool CompressOpenList<Entry>::
-    exists_bucket(int f, int g) const {
-        auto f_bucket = fg_buckets.find(f);
-        if (f_bucket == fg_buckets.end()) return false;
-        auto g_bucket = f_bucket->second.find(g);
-        if (g_bucket == f_bucket->second.end()) return false;
-        return true;
+    void CompressOpenList<Entry>::restore(const utils::Manifest& manifest) {
+        fg_buckets.clear();
+        auto n_buckets = manifest.get_int("open buckets");
+        for (long long i = 0; i < n_buckets; ++i) {
+            std::istringstream iss(manifest.get_string("open bucket " +
+                                                       to_string(i)));
+            int f, g;
+            off_t head, tail;
+            string file_name;
+            iss >> f >> g >> head >> tail >> file_name;
+            // drop what was appended after the checkpoint
+            utils::truncate_file(file_name, tail);
+            auto& bucket = fg_buckets[f].emplace
+                (piecewise_construct, forward_as_tuple(g),
+                 forward_as_tuple(file_name, Entry::get_size_in_bytes(),
+                                  bucket_options, false)).first->second;
+            bucket.set_read_offset(head);
+            bucket.keep_from(head);
+        }
+        size = manifest.get_int("open size");
+        n_created_buckets = manifest.get_int("open created buckets");
+        memory_bytes = 0;
     }
 
     template<class Entry>
-    void CompressOpenList<Entry>::
+    string CompressOpenList<Entry>::
+    get_bucket_string(int f, int g, size_t id) const {
+        std::ostringstream oss;
+        oss << "open_list_buckets/" <<  f << "_" << g << "_" << id << ".bucket";
+        return oss.str();
+    }
+
+    template<class Entry>
+    RecordFile& CompressOpenList<Entry>::
     create_bucket(int f, int g) {
         // to prevent copying of strings, in-place construction
-        fg_buckets[f].emplace(piecewise_construct,
-                              forward_as_tuple(g),
-                              forward_as_tuple(get_bucket_string(f, g)));
-        
-        if (!fg_buckets[f][g].is_open())
-            throw IOException("Fail to open open list fstream.");
+        auto& options = hybrid && memory_bytes < bucket_options.memory_bytes ?
+            memory_options : bucket_options;
+        return fg_buckets[f].emplace
+            (piecewise_construct, forward_as_tuple(g),
+             forward_as_tuple(get_bucket_string(f, g, n_created_buckets++),
+                              Entry::get_size_in_bytes(), options))
+            .first->second;
     }
 }
 
 #endif
-        
+
@@ -0,0 +1,156 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#include "concurrent_pointer_table.hpp"
+#include <limits>
+#include <climits>
+#include <stdexcept>
+#include <iostream>
+#include "../utils/wall_timer.hpp"
+
+// for primality testing
+#include <boost/multiprecision/miller_rabin.hpp>
+
+using namespace std;
+using namespace boost::multiprecision;
+
+constexpr size_t word_bits = sizeof(uint64_t) * CHAR_BIT;
+
+// Note: slot i lives in word (i / ptrs_per_word), at bit offset
+// (i % ptrs_per_word) * ptr_size_in_bits. Unused high bits of a word stay set.
+
+ConcurrentPointerTable::
+ConcurrentPointerTable(size_t ptr_table_size_limit_in_bytes) :
+    n_words(ptr_table_size_limit_in_bytes / sizeof(uint64_t)),
+    n_entries(0)
+{
+    utils::WallTimer timer;
+
+    size_t best_entries =
+        get_ptr_layout(ptr_table_size_limit_in_bytes, ptr_size_in_bits);
+    ptrs_per_word = word_bits / ptr_size_in_bits;
+
+    for (max_entries = best_entries; max_entries > 0; --max_entries) {
+        if (miller_rabin_test(max_entries, 25)) break;
+    }
+    if (max_entries < 2)
+        throw runtime_error("Concurrent pointer table is too small");
+    n_words = (max_entries + ptrs_per_word - 1) / ptrs_per_word;
+
+    words.reset(new atomic<uint64_t>[n_words]);
+    for (size_t i = 0; i < n_words; ++i)
+        words[i].store(numeric_limits<uint64_t>::max(), memory_order_relaxed);
+
+    // invalid pointer representation: pointer with all bits set
+    invalid_ptr = numeric_limits<uint64_t>::max() >> (word_bits - ptr_size_in_bits);
+
+    // For logging purposes.
+    // Due to primality tests, initialization may take some time.
+    cout << "Time taken to initialize concurrent pointer table: " << timer << "\n"
+         << "Size of pointer in pointer table: " << get_ptr_size_in_bits() << " bits\n"
+         << "Size of pointer table: " << get_max_size_in_bytes() << " bytes\n"
+         << "Max entries of pointer table: " << get_max_entries() << endl;
+}
+
+// Chooses the pointer size that gives max table size in entries. A pointer
+// must be able to address every slot and still leave room for the invalid
+// representation. Returns the number of entries before primality rounding.
+size_t ConcurrentPointerTable::
+get_ptr_layout(size_t ptr_table_size_limit_in_bytes, size_t& ptr_size_in_bits) {
+    size_t n_words = ptr_table_size_limit_in_bytes / sizeof(uint64_t);
+    size_t best_entries = 0;
+    ptr_size_in_bits = 1;
+    for (size_t ptr_sz = 1; ptr_sz < word_bits; ++ptr_sz) {
+        size_t addressable = (static_cast<size_t>(1) << ptr_sz) - 1;
+        size_t capacity = (word_bits / ptr_sz) * n_words;
+        size_t entries = capacity < addressable ? capacity : addressable;
+        if (entries > best_entries) {
+            best_entries = entries;
+            ptr_size_in_bits = ptr_sz;
+        }
+    }
+    return best_entries;
+}
+
+size_t ConcurrentPointerTable::
+get_max_entries_bound(size_t ptr_table_size_limit_in_bytes) {
+    size_t ptr_size_in_bits;
+    return get_ptr_layout(ptr_table_size_limit_in_bytes, ptr_size_in_bits);
+}
+
+uint64_t ConcurrentPointerTable::load_word(size_t index) const {
+    return words[index / ptrs_per_word].load(memory_order_acquire);
+}
+
+bool ConcurrentPointerTable::ptr_is_invalid(size_t ptr) const {
+    return ptr == invalid_ptr;
+}
+
+size_t ConcurrentPointerTable::get_ptr_at_index(size_t index) const {
+    size_t shift = (index % ptrs_per_word) * ptr_size_in_bits;
+    return (load_word(index) >> shift) & invalid_ptr;
+}
+
+ConcurrentPointerTable::ProbeCursor
+ConcurrentPointerTable::probe(size_t hash_value, size_t probe_value) const {
+    ProbeCursor cursor;
+    cursor.index = hash_value % max_entries;
+    cursor.probe_value = probe_value % max_entries;
+    return cursor;
+}
+
+void ConcurrentPointerTable::next(ProbeCursor& cursor) const {
+    cursor.index = (cursor.index + cursor.probe_value) % max_entries;
+}
+
+size_t ConcurrentPointerTable::get_ptr(const ProbeCursor& cursor) const {
+    return get_ptr_at_index(cursor.index);
+}
+
+void ConcurrentPointerTable::insert_ptr_with_hash(size_t pointer,
+                                                  size_t hash_value,
+                                                  size_t probe_value) {
+    if (n_entries.fetch_add(1, memory_order_relaxed) >= max_entries) {
+        n_entries.fetch_sub(1, memory_order_relaxed);
+        throw runtime_error("Attempting to insert in full pointer table");
+    }
+    auto cursor = probe(hash_value, probe_value);
+    while (true) {
+        auto& word = words[cursor.index / ptrs_per_word];
+        size_t shift = (cursor.index % ptrs_per_word) * ptr_size_in_bits;
+        uint64_t slot_mask = static_cast<uint64_t>(invalid_ptr) << shift;
+        uint64_t expected = word.load(memory_order_acquire);
+        // retry the same slot until it is either published by us or taken
+        // by a concurrent insert
+        while ((expected & slot_mask) == slot_mask) {
+            uint64_t desired = (expected & ~slot_mask) |
+                (static_cast<uint64_t>(pointer) << shift);
+            if (word.compare_exchange_weak(expected, desired,
+                                           memory_order_release,
+                                           memory_order_acquire))
+                return;
+        }
+        next(cursor);
+    }
+}
+
+size_t ConcurrentPointerTable::get_n_entries() const {
+    return n_entries.load(memory_order_relaxed);
+}
+
+size_t ConcurrentPointerTable::get_max_entries() const {
+    return max_entries;
+}
+
+size_t ConcurrentPointerTable::get_max_size_in_bytes() const {
+    return n_words * sizeof(uint64_t);
+}
+
+size_t ConcurrentPointerTable::get_ptr_size_in_bits() const {
+    return ptr_size_in_bits;
+}
+
+double ConcurrentPointerTable::get_load_factor() const {
+    return static_cast<double>(get_n_entries()) /
+        static_cast<double>(get_max_entries());
+}
@@ -0,0 +1,85 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#ifndef CONCURRENT_POINTER_TABLE_HPP
+#define CONCURRENT_POINTER_TABLE_HPP
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+/*                                                                         \
+| ConcurrentPointerTable is a thread safe variant of PointerTable.         |
+|                                                                          |
+| Pointers are packed into 64 bit words such that no pointer straddles two |
+| words, so that a slot can be published with a single compare-and-swap.   |
+| Probe positions are kept in ProbeCursor objects owned by the caller      |
+| instead of inside the table, so lookups from several threads may run     |
+| concurrently with each other and with insertions.                        |
+|                                                                          |
+| The closed lists wrap it in a GrowingPointerTable, whose insertions may  |
+| replace and free the table, so there lookups must not overlap them.      |
+\=========================================================================*/
+
+class ConcurrentPointerTable {
+    std::size_t ptr_size_in_bits;
+    std::size_t ptrs_per_word;
+    std::size_t max_entries;
+    std::size_t n_words;
+    std::unique_ptr<std::atomic<std::uint64_t>[]> words;
+    std::atomic<std::size_t> n_entries;
+    std::uint64_t invalid_ptr; // representation of invalid (unset) pointer
+
+    std::uint64_t load_word(std::size_t index) const;
+    static std::size_t get_ptr_layout(std::size_t ptr_table_size_limit_in_bytes,
+                                      std::size_t& ptr_size_in_bits);
+
+public:
+    // Probe position of a single lookup or insertion. Cursors are cheap to
+    // copy and are not shared between threads.
+    class ProbeCursor {
+        std::size_t index = 0;
+        std::size_t probe_value = 1;
+        friend class ConcurrentPointerTable;
+    public:
+        std::size_t get_index() const { return index; }
+    };
+
+    ConcurrentPointerTable(std::size_t ptr_table_size_limit_in_bytes);
+
+    // Upper bound on the max entries of a table of the given size, without
+    // allocating it.
+    static std::size_t get_max_entries_bound(std::size_t ptr_table_size_limit_in_bytes);
+
+    bool ptr_is_invalid(std::size_t ptr) const;
+
+    std::size_t get_ptr_at_index(std::size_t index) const;
+
+    // Start a probe sequence at the home slot of hash_value. Default probe
+    // value of 1 for linear probing.
+    ProbeCursor probe(std::size_t hash_value, std::size_t probe_value=1) const;
+
+    // Advance cursor to the next slot in its probe sequence.
+    void next(ProbeCursor& cursor) const;
+
+    // Pointer stored at the slot the cursor is on.
+    std::size_t get_ptr(const ProbeCursor& cursor) const;
+
+    // Publishes pointer in the first free slot of the probe sequence of
+    // hash_value. Safe to call concurrently with lookups and other inserts.
+    void insert_ptr_with_hash(std::size_t pointer, std::size_t hash_value,
+                              std::size_t probe_value=1);
+
+    std::size_t get_n_entries() const;
+
+    std::size_t get_max_entries() const;
+
+    std::size_t get_max_size_in_bytes() const;
+
+    std::size_t get_ptr_size_in_bits() const;
+
+    double get_load_factor() const;
+};
+
+#endif
@@ -0,0 +1,285 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#include "external_closed_file.hpp"
+#include "../utils/errors.hpp"
+#include "../utils/memory.hpp"
+#include "../fatal.hpp"
+#include "../utils.hpp"
+
+#include <cstdio>
+#include <algorithm>
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+// logical block size that satisfies O_DIRECT on common devices
+constexpr size_t direct_io_alignment = 4096;
+
+ExternalClosedFile::ExternalClosedFile(const string& file_name,
+                                       const vector<string>& dirs,
+                                       size_t entry_bytes,
+                                       size_t max_entries,
+                                       size_t extent_bytes,
+                                       utils::StorageBackend backend,
+                                       size_t cache_bytes,
+                                       bool resume) :
+    backend(backend),
+    entry_bytes(entry_bytes),
+    reserved_bytes(max_entries * entry_bytes),
+    extent_bytes(extent_bytes),
+    file_reads(max<size_t>(1, dirs.size())),
+    file_writes(max<size_t>(1, dirs.size()))
+{
+    if (extent_bytes == 0)
+        throw IOException("Closed list extent must not be empty");
+
+    // keep extents aligned, so that direct reads of the last entries do not
+    // run past the end of file, and stripes hold whole pages
+    this->extent_bytes = (extent_bytes + direct_io_alignment - 1) /
+        direct_io_alignment * direct_io_alignment;
+    reserved_bytes = (reserved_bytes + direct_io_alignment - 1) /
+        direct_io_alignment * direct_io_alignment;
+
+    if (dirs.empty()) {
+        file_names.push_back(file_name);
+    } else if (dirs.size() == 1) {
+        file_names.push_back(dirs[0] + "/" + file_name);
+    } else {
+        for (size_t i = 0; i < dirs.size(); ++i)
+            file_names.push_back(dirs[i] + "/" + file_name + "." +
+                                 to_string(i));
+    }
+    layout = StripeLayout{file_names.size(), this->extent_bytes};
+
+    if (backend == utils::StorageBackend::memory) {
+        if (cache_bytes > 0)
+            throw Fatal("--closed-cache needs files, not --closed-storage=memory");
+        file_names.clear();
+        layout = StripeLayout{1, this->extent_bytes};
+        // extents are made accessible by ensure_capacity
+        data = static_cast<char *>(mmap(NULL, reserved_bytes, PROT_NONE,
+                                        MAP_PRIVATE | MAP_ANONYMOUS |
+                                        MAP_NORESERVE, -1, 0));
+        if (data == MAP_FAILED)
+            throw IOException("Fail to reserve memory of closed list");
+        return;
+    }
+
+    // the cache is a replacement for the mapping, in front of O_DIRECT
+    if (cache_bytes > 0 && backend == utils::StorageBackend::mmap)
+        this->backend = utils::StorageBackend::direct;
+
+    if (this->backend != utils::StorageBackend::mmap) {
+        vector<utils::Storage *> storages;
+        for (auto& name : file_names) {
+            files.push_back(utils::open_storage(this->backend, name, !resume));
+            storages.push_back(files.back().get());
+        }
+        if (cache_bytes > 0)
+            cache = memory::make_unique<PageCache>(storages, this->extent_bytes,
+                                                   reserved_bytes, cache_bytes,
+                                                   direct_io_alignment);
+        return;
+    }
+
+    int flags = O_CREAT | O_RDWR | (resume ? 0 : O_TRUNC);
+    for (auto& name : file_names) {
+        int fd = open(name.c_str(), flags, S_IRUSR | S_IWUSR);
+        if (fd < 0)
+            throw IOException("Fail to create closed list file " + name);
+        fds.push_back(fd);
+    }
+
+    // Only reserve the address range, extents of the files are mapped into
+    // it by ensure_capacity.
+    data = static_cast<char *>(mmap(NULL, reserved_bytes, PROT_NONE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                                    -1, 0));
+    if (data == MAP_FAILED)
+        throw IOException("Fail to reserve address range of closed list");
+}
+
+void ExternalClosedFile::ensure_capacity(size_t n_entries) {
+    size_t needed_bytes = n_entries * entry_bytes;
+    if (needed_bytes <= file_bytes) return;
+    if (needed_bytes > reserved_bytes)
+        throw IOException("Closed list file exceeds reserved size");
+    while (file_bytes < needed_bytes) {
+        size_t length = min(extent_bytes, reserved_bytes - file_bytes);
+        size_t file_offset = layout.get_file_offset(file_bytes);
+        if (backend == utils::StorageBackend::memory) {
+            if (mprotect(data + file_bytes, length, PROT_READ | PROT_WRITE) < 0)
+                throw IOException("Fail to allocate memory of closed list");
+            file_bytes += length;
+            continue;
+        }
+        // files of a resumed search already hold later stripes, which must
+        // not be cut off
+        if (!files.empty()) {
+            auto& file = *files[layout.get_file(file_bytes)];
+            if (file.get_size() < static_cast<off_t>(file_offset + length))
+                file.resize(file_offset + length);
+            file_bytes += length;
+            continue;
+        }
+        int fd = fds[layout.get_file(file_bytes)];
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) < 0)
+            throw IOException("Fail to stat closed list file");
+        if (static_cast<size_t>(file_stat.st_size) < file_offset + length &&
+            ftruncate(fd, file_offset + length) < 0)
+            throw IOException("Fail to extend closed list file");
+        if (mmap(data + file_bytes, length, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, fd, file_offset) == MAP_FAILED)
+            throw IOException("Fail to mmap closed list file");
+        if (madvise(data + file_bytes, length, MADV_RANDOM) < 0)
+            throw IOException("Fail to give madvise for closed list file");
+        file_bytes += length;
+    }
+}
+
+void ExternalClosedFile::restore(size_t n_entries) {
+    ensure_capacity(n_entries);
+    if (cache) cache->assume_written(n_entries * entry_bytes);
+}
+
+void ExternalClosedFile::sync() {
+    if (cache) {
+        cache->write_back();
+    } else if (!fds.empty() && file_bytes > 0 &&
+               msync(data, file_bytes, MS_SYNC) < 0) {
+        throw IOException("Fail to msync closed list file");
+    }
+    for (auto fd : fds) {
+        if (fsync(fd) < 0)
+            throw IOException("Fail to fsync closed list file");
+    }
+    for (auto& file : files) file->sync();
+}
+
+void ExternalClosedFile::read_range(size_t offset, size_t length,
+                                    char *destination) {
+    count(file_reads, offset);
+    if (cache) {
+        cache->read(offset, length, destination);
+        return;
+    }
+    if (!data) {
+        read_files(offset, length, destination);
+        return;
+    }
+    static const size_t page_bytes = sysconf(_SC_PAGESIZE);
+    size_t first_page = offset / page_bytes * page_bytes;
+    madvise(data + first_page, offset + length - first_page, MADV_WILLNEED);
+    memcpy(destination, data + offset, length);
+}
+
+void ExternalClosedFile::read_files(size_t offset, size_t length,
+                                    char *destination) {
+    while (length > 0) {
+        size_t n = min(length, extent_bytes - offset % extent_bytes);
+        files[layout.get_file(offset)]->read(destination, n,
+                                              layout.get_file_offset(offset));
+        offset += n;
+        destination += n;
+        length -= n;
+    }
+}
+
+void ExternalClosedFile::write_files(size_t offset, size_t length,
+                                     const char *source) {
+    while (length > 0) {
+        size_t n = min(length, extent_bytes - offset % extent_bytes);
+        files[layout.get_file(offset)]->write(source, n,
+                                               layout.get_file_offset(offset));
+        offset += n;
+        source += n;
+        length -= n;
+    }
+}
+
+void ExternalClosedFile::prefetch_entry(size_t index) {
+    if (fds.empty()) return;
+    static const size_t page_bytes = sysconf(_SC_PAGESIZE);
+    size_t offset = index * entry_bytes;
+    size_t first_page = offset / page_bytes * page_bytes;
+    size_t length = offset + entry_bytes - first_page;
+    // only a hint, errors are of no consequence
+    madvise(data + first_page, length, MADV_WILLNEED);
+    ++n_prefetches;
+}
+
+size_t ExternalClosedFile::open_read_fds(bool direct_io) {
+    for (auto read_fd : read_fds) close(read_fd);
+    read_fds.clear();
+    if (file_names.empty()) return 0;
+    if (direct_io) {
+        for (auto& name : file_names) {
+            int read_fd = open(name.c_str(), O_RDONLY | O_DIRECT);
+            if (read_fd < 0) break;
+            read_fds.push_back(read_fd);
+        }
+        if (read_fds.size() == file_names.size()) return direct_io_alignment;
+        for (auto read_fd : read_fds) close(read_fd);
+        read_fds.clear();
+    }
+    // file systems such as tmpfs do not support O_DIRECT
+    for (auto& name : file_names) {
+        int read_fd = open(name.c_str(), O_RDONLY);
+        if (read_fd < 0)
+            throw IOException("Fail to open closed list file for reading");
+        read_fds.push_back(read_fd);
+    }
+    return 0;
+}
+
+size_t ExternalClosedFile::get_size_in_bytes() const {
+    return file_bytes;
+}
+
+size_t ExternalClosedFile::get_reserved_bytes() const {
+    return reserved_bytes;
+}
+
+void ExternalClosedFile::clear() {
+    // Let errors go in clear() as we do not want termination at the end of
+    // search, and clean up of files is non-critical
+    cache.reset();
+    if (data) munmap(data, reserved_bytes);
+    for (auto read_fd : read_fds) close(read_fd);
+    for (auto fd : fds) close(fd);
+    files.clear();
+    for (auto& name : file_names) remove(name.c_str());
+}
+
+void ExternalClosedFile::print_statistics() const {
+    dfpair(stdout, "closed list storage", "%s",
+           utils::get_storage_backend_name(backend));
+    dfpair(stdout, "external closed file (bytes)", "%lu", file_bytes);
+    if (n_prefetches > 0)
+        dfpair(stdout, "external closed prefetch hints", "%lu", n_prefetches);
+    if (layout.n_files > 1) {
+        for (size_t i = 0; i < file_names.size(); ++i) {
+            // extents are dealt round robin
+            size_t n_extents = (file_bytes + extent_bytes - 1) / extent_bytes;
+            size_t file_extents = n_extents / layout.n_files +
+                (i < n_extents % layout.n_files ? 1 : 0);
+            char key[64];
+            snprintf(key, sizeof(key), "closed stripe %lu file", i);
+            dfpair(stdout, key, "%s", file_names[i].c_str());
+            snprintf(key, sizeof(key), "closed stripe %lu extents", i);
+            dfpair(stdout, key, "%lu", file_extents);
+            snprintf(key, sizeof(key), "closed stripe %lu reads", i);
+            dfpair(stdout, key, "%lu", file_reads[i].load());
+            snprintf(key, sizeof(key), "closed stripe %lu writes", i);
+            dfpair(stdout, key, "%lu", file_writes[i].load());
+        }
+    }
+    if (cache) cache->print_statistics();
+}
@@ -0,0 +1,175 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#ifndef EXTERNAL_CLOSED_FILE_HPP
+#define EXTERNAL_CLOSED_FILE_HPP
+
+#include "page_cache.hpp"
+#include "stripe_layout.hpp"
+#include "../utils/storage.hpp"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+
+/*                                                                          \
+| File backing the external hash table of the closed list.                  |
+|                                                                           |
+| The address range for the largest possible closed list is reserved up     |
+| front, but the file itself is only extended (sparsely, with ftruncate) in |
+| extents as entries are flushed, each extent being mapped into its place   |
+| in the range, so small searches do not allocate the whole closed list on  |
+| disk.                                                                     |
+|                                                                           |
+| Given several directories, for example on different devices, the file is |
+| striped across one file per directory, round robin by extent.             |
+|                                                                           |
+| The files are mapped with the mmap storage backend. With the memory       |
+| backend, the reserved range is backed by anonymous memory instead, and    |
+| with the other backends, entries are read and written through the         |
+| storage of each file. With a cache budget, they go through a user-space   |
+| PageCache in front of the storage, which is direct for mmap.              |
+\==========================================================================*/
+
+class ExternalClosedFile {
+    std::vector<std::string> file_names;
+    utils::StorageBackend backend;
+    std::vector<int> fds; // of mapped files
+    std::vector<std::unique_ptr<utils::Storage> > files; // of unmapped files
+    std::vector<int> read_fds;
+    StripeLayout layout; // stripes of one extent
+    char *data = nullptr; // of mapped files and of memory
+    std::unique_ptr<PageCache> cache;
+    std::size_t entry_bytes;
+    std::size_t reserved_bytes; // size of mapping, upper bound of file size
+    std::size_t extent_bytes;
+    std::size_t file_bytes = 0; // of the striped file, in whole extents
+    std::size_t n_prefetches = 0;
+
+    // per file statistics, only counted if striped
+    std::vector<std::atomic<std::size_t> > file_reads;
+    std::vector<std::atomic<std::size_t> > file_writes;
+
+    void count(std::vector<std::atomic<std::size_t> >& counters,
+               std::size_t offset) {
+        if (layout.n_files > 1)
+            counters[layout.get_file(offset)].fetch_add
+                (1, std::memory_order_relaxed);
+    }
+
+    // access to the storage of unmapped files, split at stripe boundaries
+    void read_files(std::size_t offset, std::size_t length, char *destination);
+    void write_files(std::size_t offset, std::size_t length, const char *source);
+
+public:
+    // With no directories, file_name is created in the working directory.
+    // With resume, existing files are opened as they are, see restore().
+    ExternalClosedFile(const std::string& file_name,
+                       const std::vector<std::string>& dirs,
+                       std::size_t entry_bytes,
+                       std::size_t max_entries,
+                       std::size_t extent_bytes,
+                       utils::StorageBackend backend =
+                       utils::StorageBackend::mmap,
+                       std::size_t cache_bytes = 0,
+                       bool resume = false);
+
+    ExternalClosedFile(const ExternalClosedFile &other) = delete;
+    ExternalClosedFile& operator = (const ExternalClosedFile &other) = delete;
+
+    // grow file in extents until it can hold n_entries
+    void ensure_capacity(std::size_t n_entries);
+
+    // makes the first n_entries of files opened with resume accessible
+    void restore(std::size_t n_entries);
+
+    // makes all entries written so far durable
+    void sync();
+
+    void read_entry(std::size_t index, char *destination) {
+        count(file_reads, index * entry_bytes);
+        if (cache) {
+            cache->read(index * entry_bytes, entry_bytes, destination);
+        } else if (data) {
+            memcpy(destination, data + index * entry_bytes, entry_bytes);
+        } else {
+            read_files(index * entry_bytes, entry_bytes, destination);
+        }
+    }
+
+    // Reads length bytes at offset, e.g. a run of pages of a batch sorted by
+    // offset. Mapped pages are hinted first, so that the run is read ahead
+    // despite MADV_RANDOM.
+    void read_range(std::size_t offset, std::size_t length, char *destination);
+
+    void write_entry(std::size_t index, const char *source) {
+        count(file_writes, index * entry_bytes);
+        if (cache) {
+            cache->write(index * entry_bytes, entry_bytes, source);
+        } else if (data) {
+            memcpy(data + index * entry_bytes, source, entry_bytes);
+        } else {
+            write_files(index * entry_bytes, entry_bytes, source);
+        }
+    }
+
+    // Hints that the entry will be read soon, so that the kernel reads its
+    // page ahead asynchronously. Only has effect on mapped files.
+    void prefetch_entry(std::size_t index);
+
+    // Reads entry if it is resident in the user-space cache. Always fails
+    // without a cache, as residency of mapped pages is not known.
+    bool read_entry_if_cached(std::size_t index, char *destination) {
+        if (cache)
+            return cache->read_if_resident(index * entry_bytes, entry_bytes,
+                                           destination);
+        return false;
+    }
+
+    // writes dirty cached pages back to the device, e.g. after a flush
+    void write_back() {
+        if (cache) cache->write_back();
+    }
+
+    bool is_cached() const {
+        return cache != nullptr;
+    }
+
+    // Opens second, read-only descriptors of the files for batched reads,
+    // with O_DIRECT if requested and supported by the file systems. Returns
+    // the alignment required of direct reads, or 0 for buffered reads. There
+    // are no descriptors with the memory backend.
+    std::size_t open_read_fds(bool direct_io);
+
+    // Locates length bytes at offset for a batched read on the read
+    // descriptors. Fails if the bytes straddle two stripes, or there are no
+    // descriptors, and then have to be read with read_entry.
+    bool get_read_location(std::size_t offset, std::size_t length,
+                           int& fd, std::uint64_t& file_offset) {
+        if (read_fds.empty() || !layout.is_in_one_stripe(offset, length))
+            return false;
+        count(file_reads, offset);
+        fd = read_fds[layout.get_file(offset)];
+        file_offset = layout.get_file_offset(offset);
+        return true;
+    }
+
+    std::size_t get_n_files() const {
+        return file_names.size();
+    }
+
+    std::size_t get_size_in_bytes() const;
+
+    std::size_t get_reserved_bytes() const;
+
+    void print_statistics() const;
+
+    // unmaps or drops cache, closes and removes files
+    void clear();
+};
+
+#endif
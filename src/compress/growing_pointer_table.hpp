@@ -0,0 +1,256 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#ifndef GROWING_POINTER_TABLE_HPP
+#define GROWING_POINTER_TABLE_HPP
+
+#include "../utils/memory.hpp"
+#include "../utils.hpp"
+#include "../fatal.hpp"
+
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <cstddef>
+
+/*                                                                           \
+| GrowingPointerTable wraps a PointerTable (or ConcurrentPointerTable) and   |
+| grows it online, up to a memory ceiling.                                   |
+|                                                                            |
+| Pointers are indices into the external closed list, and every index below |
+| the number of entries is in the table. Once the load factor threshold is   |
+| crossed, a table of twice the size is allocated and the old one is         |
+| rehashed into it incrementally: each insertion also moves a few of the     |
+| old entries, scanning the external closed list sequentially by index.      |
+| Until the migration is done, lookups probe the new table, then the old.    |
+|                                                                            |
+| Both tables count against the ceiling. Doubling stops when the old and the |
+| new table would not fit in it together; the last growth takes what is left |
+| next to the old table instead, which is between one and two times its     |
+| size, e.g. 256MiB to 694MiB under a 950MiB ceiling. Once it cannot grow,  |
+| reaching the load factor threshold is fatal, instead of filling the table  |
+| until probing never ends.                                                  |
+|                                                                            |
+| Table replacement happens inside insert_ptr_with_hash, which must not run  |
+| concurrently with lookups.                                                 |
+\===========================================================================*/
+
+namespace compress {
+
+    template<class Table>
+    class GrowingPointerTable {
+        size_t table_bytes;
+        size_t max_table_bytes;
+        double max_load_factor;
+        bool double_hashing;
+
+        std::unique_ptr<Table> table;
+        std::unique_ptr<Table> old_table; // being migrated into table
+
+        // pointers below n_migrated are in table, pointers between
+        // n_migrated and n_to_migrate are only in old_table
+        size_t n_migrated = 0;
+        size_t n_to_migrate = 0;
+        size_t n_resizes = 0;
+
+        // old entries moved per insertion, enough to finish a migration long
+        // before the new table reaches the threshold
+        static constexpr size_t migration_rate = 4;
+
+        std::function<size_t(size_t)> hash_of_ptr;
+
+        size_t get_probe_value(const Table& t, size_t hash_value) const {
+            if (!double_hashing) return 1; // linear probing
+
+            // From Introduction to Algorithms 3rd Edition, pg 273
+            // This guarantees that double hashing does not cycle if max entries
+            // of the table is prime.
+            return 1 + (hash_value % (t.get_max_entries() - 1));
+        }
+
+        // size of the next table, table_bytes if it cannot grow
+        size_t get_grown_bytes() const;
+        void grow();
+        void migrate(size_t n_entries);
+
+    public:
+        static constexpr size_t invalid_ptr = std::numeric_limits<size_t>::max();
+
+        struct ProbeCursor {
+            typename Table::ProbeCursor cursor;
+            size_t hash_value;
+            bool in_old_table = false;
+        };
+
+        // hash_of_ptr returns the hash value of the entry stored at the given
+        // pointer, used for rehashing.
+        GrowingPointerTable(size_t initial_table_bytes,
+                            size_t max_table_bytes,
+                            double max_load_factor,
+                            bool double_hashing,
+                            std::function<size_t(size_t)> hash_of_ptr);
+
+        ProbeCursor probe(size_t hash_value) const;
+
+        // Pointer at the slot the cursor is on. Falls through to the old
+        // table at the end of the probe sequence of the new table.
+        size_t get_ptr(ProbeCursor& cursor) const;
+
+        void next(ProbeCursor& cursor) const;
+
+        bool ptr_is_invalid(size_t ptr) const {
+            return ptr == invalid_ptr;
+        }
+
+        void insert_ptr_with_hash(size_t pointer, size_t hash_value);
+
+        size_t get_n_entries() const;
+
+        size_t get_max_entries() const;
+
+        // Upper bound on the entries of the table at its memory ceiling.
+        size_t get_max_entries_bound() const;
+
+        size_t get_size_in_bytes() const;
+
+        size_t get_n_resizes() const {
+            return n_resizes;
+        }
+
+        // of the new table, including the entries still to be migrated
+        double get_load_factor() const {
+            return static_cast<double>(get_n_entries()) /
+                table->get_max_entries();
+        }
+    };
+
+    template<class Table>
+    GrowingPointerTable<Table>::
+    GrowingPointerTable(size_t initial_table_bytes,
+                        size_t max_table_bytes,
+                        double max_load_factor,
+                        bool double_hashing,
+                        std::function<size_t(size_t)> hash_of_ptr) :
+        table_bytes(initial_table_bytes < max_table_bytes ?
+                    initial_table_bytes : max_table_bytes),
+        max_table_bytes(max_table_bytes),
+        max_load_factor(max_load_factor),
+        double_hashing(double_hashing),
+        table(memory::make_unique<Table>(table_bytes)),
+        hash_of_ptr(hash_of_ptr) {}
+
+    template<class Table>
+    size_t GrowingPointerTable<Table>::get_grown_bytes() const {
+        if (table_bytes >= max_table_bytes) return table_bytes;
+        // a doubled table could not double again next to it, so this is the
+        // last growth, taking what is left next to the old table
+        if (table_bytes * 6 > max_table_bytes)
+            return std::max(table_bytes, max_table_bytes - table_bytes);
+        return table_bytes * 2;
+    }
+
+    template<class Table>
+    void GrowingPointerTable<Table>::grow() {
+        n_to_migrate = table->get_n_entries();
+        n_migrated = 0;
+        table_bytes = get_grown_bytes();
+        old_table = std::move(table);
+        table = memory::make_unique<Table>(table_bytes);
+        ++n_resizes;
+        dfpair(stdout, "closed list pointer table resized (bytes)", "%lu",
+               table_bytes);
+    }
+
+    template<class Table>
+    void GrowingPointerTable<Table>::migrate(size_t n_entries) {
+        for (size_t i = 0; i < n_entries && n_migrated < n_to_migrate; ++i) {
+            auto hash_value = hash_of_ptr(n_migrated);
+            table->insert_ptr_with_hash(n_migrated, hash_value,
+                                        get_probe_value(*table, hash_value));
+            ++n_migrated;
+        }
+        if (n_migrated == n_to_migrate) old_table.reset();
+    }
+
+    template<class Table>
+    typename GrowingPointerTable<Table>::ProbeCursor
+    GrowingPointerTable<Table>::probe(size_t hash_value) const {
+        ProbeCursor cursor;
+        cursor.hash_value = hash_value;
+        cursor.cursor = table->probe(hash_value,
+                                     get_probe_value(*table, hash_value));
+        return cursor;
+    }
+
+    template<class Table>
+    size_t GrowingPointerTable<Table>::get_ptr(ProbeCursor& cursor) const {
+        if (!cursor.in_old_table) {
+            auto ptr = table->get_ptr(cursor.cursor);
+            if (!table->ptr_is_invalid(ptr)) return ptr;
+            if (!old_table) return invalid_ptr;
+            cursor.in_old_table = true;
+            cursor.cursor =
+                old_table->probe(cursor.hash_value,
+                                 get_probe_value(*old_table, cursor.hash_value));
+        }
+        // skip entries that were already found missing in the new table
+        auto ptr = old_table->get_ptr(cursor.cursor);
+        while (!old_table->ptr_is_invalid(ptr) && ptr < n_migrated) {
+            old_table->next(cursor.cursor);
+            ptr = old_table->get_ptr(cursor.cursor);
+        }
+        if (old_table->ptr_is_invalid(ptr)) return invalid_ptr;
+        return ptr;
+    }
+
+    template<class Table>
+    void GrowingPointerTable<Table>::next(ProbeCursor& cursor) const {
+        if (cursor.in_old_table) {
+            old_table->next(cursor.cursor);
+        } else {
+            table->next(cursor.cursor);
+        }
+    }
+
+    template<class Table>
+    void GrowingPointerTable<Table>::
+    insert_ptr_with_hash(size_t pointer, size_t hash_value) {
+        if (old_table) migrate(migration_rate);
+        if (table->get_load_factor() >= max_load_factor) {
+            if (get_grown_bytes() == table_bytes)
+                throw Fatal("Closed list pointer table is full at "
+                            "--closed-max-memory=%lu", max_table_bytes);
+            if (old_table) migrate(n_to_migrate); // finish pending migration
+            grow();
+            migrate(migration_rate);
+        }
+        table->insert_ptr_with_hash(pointer, hash_value,
+                                    get_probe_value(*table, hash_value));
+    }
+
+    template<class Table>
+    size_t GrowingPointerTable<Table>::get_n_entries() const {
+        return table->get_n_entries() + (n_to_migrate - n_migrated);
+    }
+
+    template<class Table>
+    size_t GrowingPointerTable<Table>::get_max_entries() const {
+        return table->get_max_entries();
+    }
+
+    template<class Table>
+    size_t GrowingPointerTable<Table>::get_max_entries_bound() const {
+        return Table::get_max_entries_bound(max_table_bytes);
+    }
+
+    template<class Table>
+    size_t GrowingPointerTable<Table>::get_size_in_bytes() const {
+        size_t bytes = table->get_max_size_in_bytes();
+        if (old_table) bytes += old_table->get_max_size_in_bytes();
+        return bytes;
+    }
+}
+
+#endif
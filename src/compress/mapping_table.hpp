@@ -6,6 +6,10 @@
 
 #include <vector>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
 
 /*                                                                           \
 | Table to store abstraction values of portions of the nodes in the external |
@@ -14,31 +18,78 @@
 | before looking into the external hash table for a particular node, one can |
 | look into the mapping table to check first if the abstraction value of the |
 | state is equivalent the one hashed; if not, this saves a disk lookup.      |
+|                                                                            |
+| Values are stored in the narrowest of 1, 2 or 4 bytes that holds n_values. |
 \===========================================================================*/
 
 class MappingTable {
-    std::vector<unsigned> table;
+    std::vector<uint8_t> table;
     std::size_t nodes_per_map;
+    std::size_t value_bytes;
+    std::size_t n_maps = 0;
 public:
-    MappingTable(std::size_t nodes_per_map) :
-        nodes_per_map(nodes_per_map) {}
+    MappingTable(std::size_t nodes_per_map, std::size_t n_values) :
+        nodes_per_map(nodes_per_map),
+        value_bytes(n_values <= (1u << 8) ? 1 : n_values <= (1u << 16) ? 2 : 4)
+        {}
+
+    void reserve(std::size_t n_maps) {
+        table.reserve(n_maps * value_bytes);
+    }
 
     void insert_map_value(unsigned map_value) {
-	table.push_back(map_value);
+        switch (value_bytes) {
+        case 1: table.push_back(static_cast<uint8_t>(map_value)); break;
+        case 2: {
+            auto value = static_cast<uint16_t>(map_value);
+            auto bytes = reinterpret_cast<const uint8_t *>(&value);
+            table.insert(table.end(), bytes, bytes + sizeof(value));
+            break;
+        }
+        default: {
+            auto value = static_cast<uint32_t>(map_value);
+            auto bytes = reinterpret_cast<const uint8_t *>(&value);
+            table.insert(table.end(), bytes, bytes + sizeof(value));
+        }
+        }
+        ++n_maps;
     }
 
     unsigned get_value_from_ptr(std::size_t ptr) const {
 	auto map_index = ptr / nodes_per_map;
-	assert(map_index < table.size());
-	return table[map_index];
+	assert(map_index < n_maps);
+        auto bytes = &table[map_index * value_bytes];
+        switch (value_bytes) {
+        case 1: return *bytes;
+        case 2: { uint16_t value; memcpy(&value, bytes, 2); return value; }
+        default: { uint32_t value; memcpy(&value, bytes, 4); return value; }
+        }
+    }
+
+    // raw values, e.g. for a checkpoint
+    bool save(std::ostream& stream) const {
+        stream.write(reinterpret_cast<const char *>(table.data()),
+                     table.size());
+        return !stream.fail();
+    }
+
+    bool load(std::istream& stream, std::size_t n_maps) {
+        table.resize(n_maps * value_bytes);
+        stream.read(reinterpret_cast<char *>(table.data()), table.size());
+        this->n_maps = n_maps;
+        return !stream.fail();
+    }
+
+    std::size_t get_nodes_per_map() const {
+        return nodes_per_map;
     }
 
     std::size_t size() const {
-        return table.size();
+        return n_maps;
     }
     
     std::size_t get_size_in_bytes() const {
-        return table.capacity() * sizeof(unsigned);
+        return table.capacity();
     }
 };
 
@@ -0,0 +1,159 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#include "page_cache.hpp"
+#include "../utils/errors.hpp"
+#include "../utils.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+PageCache::PageCache(const vector<utils::Storage *>& files,
+                     size_t stripe_bytes, size_t max_file_bytes,
+                     size_t budget_bytes, size_t page_bytes) :
+    files(files),
+    layout{files.size(), stripe_bytes},
+    page_bytes(page_bytes),
+    n_frames(budget_bytes / page_bytes),
+    frames(n_frames),
+    page_table((max_file_bytes + page_bytes - 1) / page_bytes, no_frame)
+{
+    if (n_frames < 2)
+        throw IOException("Page cache budget must hold at least two pages");
+    if (stripe_bytes % page_bytes != 0)
+        throw IOException("Page cache pages must not straddle stripes");
+    void *data;
+    if (posix_memalign(&data, page_bytes, n_frames * page_bytes) != 0)
+        throw IOException("Fail to allocate page cache");
+    frames_data = static_cast<char *>(data);
+}
+
+PageCache::~PageCache() {
+    free(frames_data);
+}
+
+void PageCache::write_back_frame(uint32_t frame) {
+    auto& f = frames[frame];
+    get_file(f.page).write(get_frame_data(frame), page_bytes,
+                           get_file_offset(f.page));
+    f.dirty = false;
+    ++write_backs;
+}
+
+uint32_t PageCache::evict() {
+    // CLOCK: give referenced pages a second chance
+    while (true) {
+        auto frame = static_cast<uint32_t>(clock_hand);
+        clock_hand = (clock_hand + 1) % n_frames;
+        auto& f = frames[frame];
+        if (!f.valid) return frame;
+        if (f.referenced) {
+            f.referenced = false;
+            continue;
+        }
+        if (f.dirty) write_back_frame(frame);
+        page_table[f.page] = no_frame;
+        f.valid = false;
+        ++evictions;
+        return frame;
+    }
+}
+
+uint32_t PageCache::get_frame(size_t page) {
+    if (page >= page_table.size())
+        throw IOException("Page cache access beyond end of file");
+    auto frame = page_table[page];
+    if (frame != no_frame) {
+        ++hits;
+        frames[frame].referenced = true;
+        return frame;
+    }
+    frame = evict();
+    size_t offset = page * page_bytes;
+    if (offset >= written_bytes) {
+        // never written, nothing to read from the device
+        memset(get_frame_data(frame), 0, page_bytes);
+    } else {
+        ++misses;
+        get_file(page).read(get_frame_data(frame), page_bytes,
+                            get_file_offset(page));
+    }
+    auto& f = frames[frame];
+    f.page = page;
+    f.valid = true;
+    f.referenced = true;
+    f.dirty = false;
+    page_table[page] = frame;
+    return frame;
+}
+
+void PageCache::read(size_t offset, size_t length, char *destination) {
+    while (length > 0) {
+        size_t page = offset / page_bytes;
+        size_t in_page = offset % page_bytes;
+        size_t n = min(length, page_bytes - in_page);
+        memcpy(destination, get_frame_data(get_frame(page)) + in_page, n);
+        offset += n;
+        destination += n;
+        length -= n;
+    }
+}
+
+bool PageCache::read_if_resident(size_t offset, size_t length,
+                                 char *destination) {
+    size_t first = offset / page_bytes;
+    size_t last = (offset + length - 1) / page_bytes;
+    for (size_t page = first; page <= last; ++page) {
+        if (page >= page_table.size() || page_table[page] == no_frame)
+            return false;
+    }
+    read(offset, length, destination);
+    return true;
+}
+
+void PageCache::write(size_t offset, size_t length, const char *source) {
+    while (length > 0) {
+        size_t page = offset / page_bytes;
+        size_t in_page = offset % page_bytes;
+        size_t n = min(length, page_bytes - in_page);
+        auto frame = get_frame(page);
+        memcpy(get_frame_data(frame) + in_page, source, n);
+        if (!frames[frame].dirty) {
+            frames[frame].dirty = true;
+            dirty_frames.push_back(frame);
+        }
+        offset += n;
+        source += n;
+        length -= n;
+        written_bytes = max(written_bytes, offset);
+    }
+}
+
+void PageCache::write_back() {
+    // write in file order, so that flushed partitions go out sequentially
+    sort(dirty_frames.begin(), dirty_frames.end(),
+         [this](uint32_t a, uint32_t b) {
+             return frames[a].page < frames[b].page;
+         });
+    for (auto frame : dirty_frames) {
+        if (frames[frame].valid && frames[frame].dirty)
+            write_back_frame(frame);
+    }
+    dirty_frames.clear();
+}
+
+size_t PageCache::get_size_in_bytes() const {
+    return n_frames * page_bytes + frames.size() * sizeof(Frame) +
+        page_table.size() * sizeof(uint32_t);
+}
+
+void PageCache::print_statistics() const {
+    dfpair(stdout, "page cache size (bytes)", "%lu", get_size_in_bytes());
+    dfpair(stdout, "page cache hits", "%lu", hits);
+    dfpair(stdout, "page cache device reads", "%lu", misses);
+    dfpair(stdout, "page cache evictions", "%lu", evictions);
+    dfpair(stdout, "page cache write backs", "%lu", write_backs);
+}
@@ -0,0 +1,105 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#ifndef PAGE_CACHE_HPP
+#define PAGE_CACHE_HPP
+
+#include "stripe_layout.hpp"
+#include "../utils/storage.hpp"
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/*                                                                          \
+| User-space page cache in front of a file, used instead of mmap for the    |
+| external closed list so that its memory use is fixed by a byte budget.    |
+| The file may be striped across several files, with stripes of a whole    |
+| number of pages.                                                          |
+|                                                                           |
+| Pages are evicted with the CLOCK algorithm. Dirty pages are only written  |
+| back on eviction or on an explicit write_back(). Device reads and writes  |
+| are of whole pages on page aligned buffers, which direct storage passes   |
+| to the device without bounce buffers.                                     |
+\==========================================================================*/
+
+class PageCache {
+    static constexpr uint32_t no_frame = UINT32_MAX;
+
+    struct Frame {
+        std::size_t page;
+        bool valid = false;
+        bool referenced = false;
+        bool dirty = false;
+    };
+
+    std::vector<utils::Storage *> files;
+    StripeLayout layout;
+    std::size_t page_bytes;
+    std::size_t n_frames;
+    char *frames_data;
+    std::vector<Frame> frames;
+    std::vector<uint32_t> page_table; // page -> frame, no_frame if absent
+    std::vector<uint32_t> dirty_frames;
+    std::size_t clock_hand = 0;
+
+    // bytes of the file that have ever been written through the cache,
+    // pages beyond are zero filled instead of read
+    std::size_t written_bytes = 0;
+
+    // statistics
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+    std::size_t evictions = 0;
+    std::size_t write_backs = 0;
+
+    char *get_frame_data(uint32_t frame) const {
+        return frames_data + frame * page_bytes;
+    }
+
+    // file and offset within it of a page
+    utils::Storage& get_file(std::size_t page) const {
+        return *files[layout.get_file(page * page_bytes)];
+    }
+    std::size_t get_file_offset(std::size_t page) const {
+        return layout.get_file_offset(page * page_bytes);
+    }
+
+    uint32_t get_frame(std::size_t page);
+    uint32_t evict();
+    void write_back_frame(uint32_t frame);
+
+public:
+    // max_file_bytes bounds the page table, budget_bytes the cached pages
+    PageCache(const std::vector<utils::Storage *>& files,
+              std::size_t stripe_bytes,
+              std::size_t max_file_bytes, std::size_t budget_bytes,
+              std::size_t page_bytes = 4096);
+    ~PageCache();
+
+    PageCache(const PageCache &other) = delete;
+    PageCache& operator = (const PageCache &other) = delete;
+
+    void read(std::size_t offset, std::size_t length, char *destination);
+
+    // copies from cache if all touched pages are resident, without going
+    // to the device
+    bool read_if_resident(std::size_t offset, std::size_t length,
+                          char *destination);
+
+    void write(std::size_t offset, std::size_t length, const char *source);
+
+    // writes all dirty pages to the device
+    void write_back();
+
+    // takes the first bytes of the file as written, e.g. by a previous run
+    void assume_written(std::size_t bytes) {
+        written_bytes = bytes;
+    }
+
+    std::size_t get_size_in_bytes() const;
+
+    void print_statistics() const;
+};
+
+#endif
@@ -0,0 +1,131 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#ifndef PARTITION_BUFFER_HPP
+#define PARTITION_BUFFER_HPP
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+/*                                                                           \
+| In-memory buffer of one closed list partition, waiting to be flushed.      |
+|                                                                            |
+| An open addressing hash set with linear probing over a single slab of      |
+| slots, allocated once for the maximum number of entries of the buffer, so  |
+| that insertions do not allocate and memory use is known up front. Slots    |
+| are tagged with a generation, which makes clear() O(1).                    |
+\===========================================================================*/
+
+namespace compress {
+
+    template<class Entry, class Hash>
+    class PartitionBuffer {
+        struct Slot {
+            uint32_t generation = 0; // occupied iff equal to current generation
+            Entry entry;
+        };
+
+        const Hash *hasher;
+        std::size_t capacity;
+        std::size_t mask;
+        std::vector<Slot> slots;
+        uint32_t generation = 1;
+        std::size_t n_entries = 0;
+
+        std::size_t find_slot(const Entry& entry) const {
+            auto index = (*hasher)(entry) & mask;
+            while (slots[index].generation == generation &&
+                   !(slots[index].entry == entry)) {
+                index = (index + 1) & mask;
+            }
+            return index;
+        }
+
+    public:
+        class const_iterator {
+            const PartitionBuffer *buffer;
+            std::size_t index;
+            void skip_empty() {
+                while (index < buffer->slots.size() &&
+                       buffer->slots[index].generation != buffer->generation)
+                    ++index;
+            }
+        public:
+            const_iterator(const PartitionBuffer *buffer, std::size_t index) :
+                buffer(buffer), index(index) { skip_empty(); }
+            const Entry& operator*() const { return buffer->slots[index].entry; }
+            const Entry* operator->() const { return &buffer->slots[index].entry; }
+            const_iterator& operator++() { ++index; skip_empty(); return *this; }
+            bool operator!=(const const_iterator& other) const {
+                return index != other.index;
+            }
+        };
+
+        // Slots are kept at most half full.
+        PartitionBuffer(std::size_t capacity, const Hash& hasher) :
+            hasher(&hasher), capacity(capacity) {
+            auto n_slots = get_n_slots(capacity);
+            mask = n_slots - 1;
+            slots.resize(n_slots);
+        }
+
+        static std::size_t get_n_slots(std::size_t capacity) {
+            std::size_t n_slots = 1;
+            while (n_slots < 2 * capacity) n_slots <<= 1;
+            return n_slots;
+        }
+
+        // memory of a buffer of the given capacity
+        static std::size_t get_size_in_bytes(std::size_t capacity) {
+            return get_n_slots(capacity) * sizeof(Slot);
+        }
+
+        Entry *find(const Entry& entry) {
+            auto& slot = slots[find_slot(entry)];
+            return slot.generation == generation ? &slot.entry : nullptr;
+        }
+
+        const Entry *find(const Entry& entry) const {
+            auto& slot = slots[find_slot(entry)];
+            return slot.generation == generation ? &slot.entry : nullptr;
+        }
+
+        // Inserts entry, or overwrites the equal entry already in the buffer.
+        void insert(const Entry& entry) {
+            auto& slot = slots[find_slot(entry)];
+            if (slot.generation != generation) {
+                if (n_entries == capacity)
+                    throw std::length_error("Partition buffer is full");
+                slot.generation = generation;
+                ++n_entries;
+            }
+            slot.entry = entry;
+        }
+
+        // Empties buffer without touching the slots.
+        void clear() {
+            ++generation;
+            n_entries = 0;
+        }
+
+        std::size_t size() const {
+            return n_entries;
+        }
+
+        std::size_t get_size_in_bytes() const {
+            return slots.size() * sizeof(Slot);
+        }
+
+        const_iterator begin() const {
+            return const_iterator(this, 0);
+        }
+
+        const_iterator end() const {
+            return const_iterator(this, slots.size());
+        }
+    };
+}
+
+#endif
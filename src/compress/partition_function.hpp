@@ -0,0 +1,148 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#ifndef PARTITION_FUNCTION_HPP
+#define PARTITION_FUNCTION_HPP
+
+#include "../hash_functions/tabulation_hash.hpp"
+#include "../fatal.hpp"
+
+#include <string>
+#include <vector>
+#include <limits>
+#include <cstddef>
+#include <cstdlib>
+#include <algorithm>
+
+/*                                                                           \
+| Maps a node to the partition of the closed list it is buffered and flushed |
+| in. Nodes of one partition end up in the same blocks of the external hash  |
+| table, so an abstraction that groups nodes looked up close in time also    |
+| groups their pages.                                                        |
+|                                                                            |
+| Functions, given by name:                                                  |
+|   hash       - random tabulation hash of the state                         |
+|   blank      - position of the blank (the variable of value 0)             |
+|   h          - heuristic value, f - g                                      |
+|   tiles:a,b  - positions of the chosen tiles (values), a pattern           |
+|                abstraction                                                 |
+| If an abstraction has more values than partitions, values are folded.     |
+\===========================================================================*/
+
+namespace compress {
+
+    template<class Entry>
+    class PartitionFunction {
+        enum class Kind { hash, blank, h, tiles };
+
+        Kind kind;
+        std::string name;
+        std::vector<int> tiles;
+        TabulationHash<Entry> hasher;
+        std::size_t n_partitions = 1;
+
+        static std::vector<int> parse_tiles(const std::string& list) {
+            std::vector<int> tiles;
+            std::size_t start = 0;
+            while (start < list.size()) {
+                auto end = list.find(',', start);
+                if (end == std::string::npos) end = list.size();
+                char *parse_end;
+                auto tile = std::strtol(list.c_str() + start, &parse_end, 10);
+                if (parse_end != list.c_str() + end || tile < 0 ||
+                    tile >= static_cast<long>(Entry::get_n_val()))
+                    throw Fatal("Invalid tile in partition function: %s",
+                                list.c_str());
+                tiles.push_back(static_cast<int>(tile));
+                start = end + 1;
+            }
+            if (tiles.empty())
+                throw Fatal("No tiles given to partition function");
+            return tiles;
+        }
+
+        int get_position(const Entry& entry, int value) const {
+            for (int i = 0; i < Entry::get_n_var(); ++i) {
+                if (entry[i] == value) return i;
+            }
+            return 0;
+        }
+
+        std::size_t get_abstract_value(const Entry& entry) const {
+            switch (kind) {
+            case Kind::blank:
+                return get_position(entry, 0);
+            case Kind::h:
+                return static_cast<std::size_t>(entry.f - entry.g);
+            case Kind::tiles: {
+                std::size_t value = 0;
+                for (auto tile : tiles)
+                    value = value * Entry::get_n_var() +
+                        get_position(entry, tile);
+                return value;
+            }
+            default:
+                return hasher(entry);
+            }
+        }
+
+    public:
+        explicit PartitionFunction(const std::string& name) : name(name) {
+            if (name == "hash") {
+                kind = Kind::hash;
+            } else if (name == "blank") {
+                kind = Kind::blank;
+            } else if (name == "h") {
+                kind = Kind::h;
+            } else if (name.compare(0, 6, "tiles:") == 0) {
+                kind = Kind::tiles;
+                tiles = parse_tiles(name.substr(6));
+            } else {
+                throw Fatal("Unknown partition function: %s", name.c_str());
+            }
+        }
+
+        // number of distinct abstract values
+        std::size_t get_n_values() const {
+            switch (kind) {
+            case Kind::blank:
+                return Entry::get_n_var();
+            case Kind::h:
+                return std::numeric_limits<signed char>::max() + 1;
+            case Kind::tiles: {
+                std::size_t n_values = 1;
+                for (std::size_t i = 0; i < tiles.size(); ++i) {
+                    if (n_values > std::numeric_limits<unsigned>::max() /
+                        Entry::get_n_var())
+                        return std::numeric_limits<std::size_t>::max();
+                    n_values *= Entry::get_n_var();
+                }
+                return n_values;
+            }
+            default:
+                return std::numeric_limits<std::size_t>::max();
+            }
+        }
+
+        // uses at most max_partitions, fewer if the abstraction has fewer
+        // values
+        void set_max_partitions(std::size_t max_partitions) {
+            n_partitions = std::max<std::size_t>
+                (1, std::min(get_n_values(), max_partitions));
+        }
+
+        std::size_t get_n_partitions() const {
+            return n_partitions;
+        }
+
+        const std::string& get_name() const {
+            return name;
+        }
+
+        unsigned operator()(const Entry& entry) const {
+            return get_abstract_value(entry) % n_partitions;
+        }
+    };
+}
+
+#endif
@@ -10,6 +10,7 @@
 #include <climits>
 #include <stdexcept>
 #include <iostream>
+#include <algorithm>
 #include "../utils/wall_timer.hpp"
 
 // for primality testing
@@ -64,9 +65,17 @@ PointerTable::PointerTable(size_t ptr_table_size_limit_in_bytes)
          << "Max entries of pointer table: " << get_max_entries() << endl;
 }
 
+size_t PointerTable::get_max_entries_bound(size_t ptr_table_size_limit_in_bytes) {
+    size_t big_ptr_size_in_bits = get_ptr_size_in_bits(ptr_table_size_limit_in_bytes);
+    if (big_ptr_size_in_bits == 0) return 0;
+    size_t big_ptr_entries = ptr_table_size_limit_in_bytes * 8 / big_ptr_size_in_bits;
+    size_t small_ptr_entries = pow(2, big_ptr_size_in_bits - 1);
+    return max(big_ptr_entries, small_ptr_entries);
+}
+
 // Returns the biggest pointer size, may not be optimal in terms of size of
 // pointer table.
-size_t PointerTable::get_ptr_size_in_bits(size_t ptr_table_size_limit_in_bytes) const {
+size_t PointerTable::get_ptr_size_in_bits(size_t ptr_table_size_limit_in_bytes) {
     size_t ptr_size_in_bits = 0;
     auto max_ptr_bits = size_t_bits;
     for (size_t ptr_sz = 0; ptr_sz < max_ptr_bits; ++ptr_sz) {
@@ -120,17 +129,21 @@ void PointerTable::insert_ptr_with_hash(size_t pointer,
     insert_ptr_at_index(pointer, probe_index);
 }
 
-size_t PointerTable::get_ptr_with_hash(size_t hash_value,
-                               size_t probe_value,
-                               bool first_probe) const {
+PointerTable::ProbeCursor PointerTable::probe(size_t hash_value,
+                                              size_t probe_value) const {
     auto max_entries = get_max_entries();
-    if (first_probe) {
-	current_probe_index = hash_value % max_entries;
-    } else {
-        current_probe_index =
-            (current_probe_index + (probe_value % max_entries)) % max_entries; 
-    }
-    return get_ptr_at_index(current_probe_index);
+    ProbeCursor cursor;
+    cursor.index = hash_value % max_entries;
+    cursor.probe_value = probe_value % max_entries;
+    return cursor;
+}
+
+void PointerTable::next(ProbeCursor& cursor) const {
+    cursor.index = (cursor.index + cursor.probe_value) % get_max_entries();
+}
+
+size_t PointerTable::get_ptr(const ProbeCursor& cursor) const {
+    return get_ptr_at_index(cursor.index);
 }
 
 size_t PointerTable::get_n_entries() const {
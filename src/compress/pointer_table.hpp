@@ -21,13 +21,25 @@ class PointerTable {
     size_t n_entries = 0;
     vector<bool> bit_vector;
     size_t invalid_ptr; // representation of invalid (unset) pointer
-    mutable size_t current_probe_index = 0;
-    size_t get_ptr_size_in_bits(size_t ptr_table_size_limit_in_bytes) const;
+    static size_t get_ptr_size_in_bits(size_t ptr_table_size_limit_in_bytes);
     void insert_ptr_at_index(size_t ptr, size_t index);
         
 public:
+    // Probe position of a single lookup, kept by the caller.
+    class ProbeCursor {
+        size_t index = 0;
+        size_t probe_value = 1;
+        friend class PointerTable;
+    public:
+        size_t get_index() const { return index; }
+    };
+
     PointerTable(std::size_t ptr_table_size_limit_in_bytes);
 
+    // Upper bound on the max entries of a table of the given size, without
+    // allocating it.
+    static size_t get_max_entries_bound(size_t ptr_table_size_limit_in_bytes);
+
     bool ptr_is_invalid(size_t ptr) const;
     
     size_t get_ptr_at_index(size_t index) const;
@@ -35,10 +47,15 @@ public:
     // Default probe value of 1 for linear probing.
     void insert_ptr_with_hash(size_t pointer, size_t hash_value, size_t probe_value=1);
     
-    // If first_probe=false, triggers probe sequence. Default probe value of 1
-    // for linear probing.
-    size_t get_ptr_with_hash(size_t hash_value, size_t probe_value=1, bool
-                             first_probe=true) const;
+    // Start a probe sequence at the home slot of hash_value. Default probe
+    // value of 1 for linear probing.
+    ProbeCursor probe(size_t hash_value, size_t probe_value=1) const;
+
+    // Advance cursor to the next slot in its probe sequence.
+    void next(ProbeCursor& cursor) const;
+
+    // Pointer stored at the slot the cursor is on.
+    size_t get_ptr(const ProbeCursor& cursor) const;
 
     size_t get_n_entries() const;
     
@@ -0,0 +1,88 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#ifndef PUSH_BUFFER_HPP
+#define PUSH_BUFFER_HPP
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/*                                                                           \
+| In-memory buffer of the entries pushed to one open list bucket, waiting to |
+| be written to its file.                                                    |
+|                                                                            |
+| Entries of the same state are combined as they are pushed, keeping the one |
+| of lowest g, so that duplicates generated close together, e.g. by cousins, |
+| are neither written nor read back. Entries are kept in the order they were |
+| pushed, and indexed by an open addressing table with linear probing of     |
+| twice their number of slots, allocated once. Slots are tagged with a       |
+| generation, as in PartitionBuffer, which makes clear() O(1).               |
+\===========================================================================*/
+
+namespace compress {
+
+    template<class Entry, class Hash>
+    class PushBuffer {
+        struct Slot {
+            uint32_t generation = 0; // occupied iff equal to current generation
+            uint32_t index;          // of the entry
+        };
+
+        const Hash *hasher;
+        std::size_t capacity;
+        std::size_t mask;
+        std::vector<Entry> entries;
+        std::vector<Slot> slots;
+        uint32_t generation = 1;
+
+    public:
+        PushBuffer(std::size_t capacity, const Hash& hasher) :
+            hasher(&hasher), capacity(capacity) {
+            std::size_t n_slots = 1;
+            while (n_slots < 2 * capacity) n_slots <<= 1;
+            mask = n_slots - 1;
+            slots.resize(n_slots);
+            entries.reserve(capacity);
+        }
+
+        // Adds entry, or combines it with the staged entry of the same
+        // state. Returns false if it was combined.
+        bool push(const Entry& entry) {
+            auto index = (*hasher)(entry) & mask;
+            while (slots[index].generation == generation) {
+                auto& staged = entries[slots[index].index];
+                if (staged == entry) {
+                    if (entry.g < staged.g) staged = entry;
+                    return false;
+                }
+                index = (index + 1) & mask;
+            }
+            slots[index].generation = generation;
+            slots[index].index = entries.size();
+            entries.push_back(entry);
+            return true;
+        }
+
+        bool is_full() const {
+            return entries.size() == capacity;
+        }
+
+        bool is_empty() const {
+            return entries.empty();
+        }
+
+        // in the order they were pushed
+        const std::vector<Entry>& get_entries() const {
+            return entries;
+        }
+
+        // Empties the buffer without touching the slots.
+        void clear() {
+            entries.clear();
+            ++generation;
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,33 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#ifndef STRIPE_LAYOUT_HPP
+#define STRIPE_LAYOUT_HPP
+
+#include <cstddef>
+
+/*                                                                           \
+| Layout of a logical file striped across n_files files, round robin by      |
+| stripes of stripe_bytes: stripe k of the logical file is stripe            |
+| k / n_files of file k % n_files.                                           |
+\===========================================================================*/
+
+struct StripeLayout {
+    std::size_t n_files;
+    std::size_t stripe_bytes;
+
+    std::size_t get_file(std::size_t offset) const {
+        return offset / stripe_bytes % n_files;
+    }
+
+    std::size_t get_file_offset(std::size_t offset) const {
+        auto stripe = offset / stripe_bytes;
+        return stripe / n_files * stripe_bytes + offset % stripe_bytes;
+    }
+
+    bool is_in_one_stripe(std::size_t offset, std::size_t length) const {
+        return offset / stripe_bytes == (offset + length - 1) / stripe_bytes;
+    }
+};
+
+#endif
@@ -8,71 +8,204 @@
 
 #include "compress/compress_open_list.hpp"
 #include "compress/compress_closed_list.hpp"
-#include "utils/compunits.hpp" // TODO: move to user option
+#include "utils/compunits.hpp"
+#include "utils/options.hpp"
+#include "utils/checkpoint.hpp"
+#include "hash_functions/tabulation_hash.hpp"
+
+#include <algorithm>
 
 using namespace compunits;
 using namespace std;
 
 namespace compress {
 
-    template<class D> class CompressAstar : public SearchAlg<D> {
+    template<class D, class Layout = FullLayout>
+    class CompressAstar : public SearchAlg<D> {
 
-        CompressClosedList<Node<D> > closed;
-        CompressOpenList<Node<D> > open;
+        utils::Checkpointer checkpointer;
+        // parsed before the closed list creates its files, so that an
+        // invalid option leaves none behind
+        RecordFileOptions bucket_options;
+        size_t lookahead; // nodes of a window, see look_ahead
+        CompressClosedList<Node<D, Layout> > closed;
+        CompressOpenList<Node<D, Layout> > open;
     
         std::vector<typename D::State> path;
 
+        // Nodes are looked ahead in windows of lookahead nodes: every
+        // lookahead pops, the window after the next one is prefetched, so
+        // that its pages are read while the next window is expanded.
+        size_t pops_until_lookahead = 0;
+        bool first_window = true; // not prefetched yet, also after resuming
+        std::vector<Node<D, Layout> > peeked;
+
+        void look_ahead() {
+            if (lookahead == 0) return;
+            if (pops_until_lookahead-- > 0) return;
+            pops_until_lookahead = lookahead - 1;
+            open.peek(peeked, 2 * lookahead);
+            size_t first = first_window ? 0 : lookahead;
+            first_window = false;
+            for (size_t i = first; i < peeked.size(); ++i)
+                closed.prefetch(peeked[i]);
+        }
+
+        static size_t get_lookahead(const utils::Options& options) {
+            long lookahead = options.get_int("lookahead", 16);
+            if (lookahead < 0)
+                throw Fatal("--lookahead must be at least 0, not %ld",
+                            lookahead);
+            return lookahead;
+        }
+
+        // nodes looked up in the closed list at once, 1 for one at a time
+        size_t batch_size;
+        std::vector<Node<D, Layout> > batch;
+
+        // Expands n, or reconstructs the path if n is a goal. Returns true
+        // if the goal was reached.
+        bool expand(Node<D, Layout> n) {
+            typename D::State state;
+            this->dom.unpack(state, n.packed);
+
+            if (this->dom.isgoal(state)) {
+                // trace path here
+                path.push_back(state);
+                while(n.packed != n.parent_packed) {
+                    Node<D, Layout> parent = closed.trace_parent(n);
+                    typename D::State parent_state;
+                    this->dom.unpack(parent_state, parent.packed);
+                    path.push_back(parent_state);
+                    n = parent;
+                }
+                closed.print_statistics();
+                open.print_statistics();
+                checkpointer.print_statistics();
+                checkpointer.clear();
+                open.clear();
+                closed.clear();
+                return true;
+            }
+
+            this->expd++;
+            for (int i = 0; i < this->dom.nops(state); i++) {
+                int op = this->dom.nthop(state, i);
+                if (op == n.pop)
+                    continue;
+                this->gend++;
+                Edge<D> e = this->dom.apply(state, op);
+                open.push(wrap(state, &n, e.cost, e.pop));
+                this->dom.undo(state, e);
+            }
+            return false;
+        }
+
+        void save(utils::Manifest& manifest, typename D::State &init) {
+            manifest.set_string("algorithm", "astar_idd");
+            manifest.set_int("initial state", wrap(init, nullptr, 0, -1)
+                             .packed.hash());
+            manifest.set_int("expanded", this->expd);
+            manifest.set_int("generated", this->gend);
+            manifest.set_string("hash generator",
+                                TabulationHash<Node<D, Layout> >::get_generator_state());
+            manifest.set_int("reopened", this->reopd);
+            manifest.set_string("node layout", Layout::get_name());
+            open.checkpoint(manifest);
+            closed.checkpoint(checkpointer, manifest);
+        }
+
+        void restore(typename D::State &init) {
+            auto manifest = checkpointer.load();
+            if (manifest.get_string("algorithm") != "astar_idd" ||
+                static_cast<unsigned long>(manifest.get_int("initial state")) !=
+                wrap(init, nullptr, 0, -1).packed.hash())
+                throw Fatal("Checkpoint is of another search");
+            if (manifest.get_string("node layout") != Layout::get_name())
+                throw Fatal("Checkpoint was written with another node layout");
+            this->expd = manifest.get_int("expanded");
+            this->gend = manifest.get_int("generated");
+            TabulationHash<Node<D, Layout> >::set_generator_state
+                (manifest.get_string("hash generator"));
+            this->reopd = manifest.get_int("reopened");
+            open.restore(manifest);
+            closed.restore(checkpointer, manifest);
+        }
+
     public:
-        CompressAstar(D &d) : SearchAlg<D>(d),
-            closed(true, true, true, 950_MiB), // TODO: move to user option
-            open() { }
+        // --lookahead and --batch, and those of its parts
+        static void add_option_names(std::set<std::string>& names) {
+            utils::Checkpointer::add_option_names(names);
+            ClosedListOptions::add_option_names(names);
+            RecordFileOptions::add_option_names(names);
+            names.insert({ "lookahead", "batch" });
+        }
+
+        CompressAstar(D &d, const utils::Options& options = utils::Options()) :
+            SearchAlg<D>(d),
+            checkpointer(options),
+            bucket_options(RecordFileOptions::from(options)),
+            lookahead(get_lookahead(options)),
+            closed(true, true, true, ClosedListOptions::from(options)),
+            open(checkpointer, bucket_options),
+            batch_size(std::max(1l, options.get_int("batch", 1))) {
+            dfpair(stdout, "lookahead (nodes)", "%lu", lookahead);
+            dfpair(stdout, "closed list batch (nodes)", "%lu", batch_size);
+        }
 
         std::vector<typename D::State> search(typename D::State &init) {
-            open.push(wrap(init, nullptr, 0, -1));
+            if (checkpointer.is_resuming()) {
+                restore(init);
+            } else {
+                this->reopd = 0;
+                open.push(wrap(init, nullptr, 0, -1));
+            }
 
             while (!open.isempty() && path.size() == 0) {
-                Node<D> n = open.pop();
+                if (checkpointer.is_due()) {
+                    checkpointer.write([this, &init](utils::Manifest& manifest) {
+                            save(manifest, init);
+                        });
+                }
+
+                if (batch_size > 1) {
+                    batch.clear();
+                    // a run of each bucket at once, all of the lowest f, so
+                    // that no goal of a higher f is expanded before the
+                    // nodes of the lowest f are
+                    int f, front_f;
+                    open.get_front_f(f);
+                    while (batch.size() < batch_size &&
+                           open.get_front_f(front_f) && front_f == f)
+                        open.pop_batch(batch_size - batch.size(), batch);
+                    this->reopd += closed.batch_find_insert(batch);
+                    // back to the order of the open list
+                    std::sort(batch.begin(), batch.end(),
+                              [](const Node<D, Layout>& a, const Node<D, Layout>& b) {
+                                  return a.f < b.f ||
+                                      (a.f == b.f && a.g > b.g);
+                              });
+                    for (auto& n : batch) {
+                        if (expand(n)) break;
+                    }
+                    continue;
+                }
+
+                look_ahead();
+                Node<D, Layout> n = open.pop();
 
                 bool found, reopened;
                 tie(found, reopened) = closed.find_insert(n);
                 if (found && reopened) this->reopd++;
                 if (found && !reopened) continue;
 
-                typename D::State state;
-                this->dom.unpack(state, n.packed);
-
-                if (this->dom.isgoal(state)) {
-                    // trace path here
-                    path.push_back(state);
-                    while(n.packed != n.parent_packed) {
-                        Node<D> parent = closed.trace_parent(n);
-                        typename D::State parent_state;
-                        this->dom.unpack(parent_state, parent.packed);
-                        path.push_back(parent_state);
-                        n = parent;
-                    }
-                    closed.print_statistics();
-                    open.clear();
-                    closed.clear();
-                    break;
-                }
-
-                this->expd++;
-                for (int i = 0; i < this->dom.nops(state); i++) {
-                    int op = this->dom.nthop(state, i);
-                    if (op == n.pop)
-                        continue;
-                    this->gend++;
-                    Edge<D> e = this->dom.apply(state, op);
-                    open.push(wrap(state, &n, e.cost, e.pop));
-                    this->dom.undo(state, e);
-                }
+                if (expand(n)) break;
             }
             return path;
         }
 
-        Node<D> wrap(typename D::State &s, Node<D>* p, int c, int pop) {
-            Node<D> n;
+        Node<D, Layout> wrap(typename D::State &s, Node<D, Layout>* p, int c, int pop) {
+            Node<D, Layout> n;
             n.g = c;
             if (p)
                 n.g += p->g;
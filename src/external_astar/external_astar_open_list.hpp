@@ -6,10 +6,12 @@
 
 //#define TEST
 
+#include "../node.hpp"
 #include "../utils/memory.hpp"
-#include "../utils/named_fstream.hpp"
+#include "../utils/record_file.hpp"
 #include "../utils/errors.hpp"
 #include "../utils/compunits.hpp"
+#include "../utils/checkpoint.hpp"
 
 #include <utility>
 #include <map>
@@ -38,31 +40,91 @@ namespace external_astar {
     template<class Entry>
     class ExternalAstarOpenList {
 
-        map<int, map<int, named_fstream> > fg_buckets;
+        // before the buckets, which wait for their reads and writes when
+        // destroyed, and give back their segments
+        unique_ptr<utils::CompressionStats> compression;
+        unique_ptr<utils::SegmentFile> segments;
+        unique_ptr<utils::WriteBehind> writer;
+        unique_ptr<utils::ReadAhead> reader;
+        map<int, map<int, RecordFile> > fg_buckets;
         pair<int, int> current_fg; // to track when merge needs to be performed
         void remove_duplicates(int f, int g);
         bool first_insert = true; // to initialize current_fg
 
+        // a merged bucket is written to a new file, the old one is retired
+        utils::Checkpointer& checkpointer;
+        RecordFileOptions bucket_options;
+        size_t n_created_buckets = 0; // file names are never reused
+
         bool exists_bucket(int f, int g) const;
-        void create_bucket(int f, int g);
-        string get_bucket_string(int f, int g) const;
+        RecordFile& create_bucket(int f, int g);
+        string get_bucket_string(int f, int g, size_t id) const;
+        // reads ahead the bucket to be merged after that of f and g
+        void prefetch_next(int f, int g);
+        // moves current_fg to the next bucket, and removes its duplicates
+        void next_bucket();
 
     public:
-        ExternalAstarOpenList();
+        ExternalAstarOpenList(utils::Checkpointer& checkpointer,
+                              const RecordFileOptions& bucket_options =
+                              RecordFileOptions());
         ~ExternalAstarOpenList() = default;
 
         void push(const Entry& entry);
         Entry pop();
+        // Appends to entries up to max entries of the current bucket, all of
+        // the same f and g and read at once, and returns their number. Moves
+        // to the next bucket first if the current one is done, throws
+        // OpenListEmpty if there is none.
+        size_t pop_batch(size_t max, vector<Entry>& entries);
         void clear();
 
+        // Records buckets and offsets in the manifest, with their files synced
+        void checkpoint(utils::Manifest& manifest);
+        void restore(const utils::Manifest& manifest);
+
         Entry trace_parent(const Entry &entry);
+
+        void print_statistics() {
+            if (writer) writer->print_statistics();
+            if (reader) reader->print_statistics();
+            if (segments) segments->print_statistics();
+            if (compression) compression->print_statistics();
+            dfpair(stdout, "open list peak disk (bytes)", "%ld",
+                   RecordFile::get_peak_disk_bytes());
+        }
     };
     
     template<class Entry>
-    ExternalAstarOpenList<Entry>::ExternalAstarOpenList()
+    ExternalAstarOpenList<Entry>::
+    ExternalAstarOpenList(utils::Checkpointer& checkpointer,
+                          const RecordFileOptions& bucket_options) :
+        checkpointer(checkpointer),
+        bucket_options(bucket_options)
     {
         // create directory for open list files if not exist
         mkdir("open_list_buckets", 0744);
+        if (bucket_options.segment_bytes > 0) {
+            segments = memory::make_unique<utils::SegmentFile>
+                (bucket_options.backend, "open_list_buckets/segments",
+                 bucket_options.segment_bytes);
+            this->bucket_options.segments = segments.get();
+        }
+        if (bucket_options.compress) {
+            compression = memory::make_unique<utils::CompressionStats>();
+            this->bucket_options.compression = compression.get();
+        }
+        if (bucket_options.write_behind > 0) {
+            writer = memory::make_unique<utils::WriteBehind>
+                (bucket_options.write_behind);
+            this->bucket_options.writer = writer.get();
+        }
+        if (bucket_options.read_ahead) {
+            reader = memory::make_unique<utils::ReadAhead>();
+            this->bucket_options.reader = reader.get();
+        }
+        dfpair(stdout, "open list storage", "%s",
+               utils::get_storage_backend_name(bucket_options.backend));
         dfpair(stdout, "merge chunk (bytes)", "%lu", MERGE_CHUNK_BYTES);
     }
 
@@ -74,42 +136,39 @@ namespace external_astar {
         // Also performs duplicate detection against itself, and the buffers
         // f-1, g-1 and f-2, g-2, as per External A* (Edelkamp)
 
-        named_fstream * target_stream = &fg_buckets[f][g];
-        target_stream->clear();
-        target_stream->seekg(0, ios::beg);
+        RecordFile * target_stream = &fg_buckets[f].at(g);
+        target_stream->set_read_offset(0);
         
-        vector<streampos> k_offsets; // keeps track of divisions in merge file
+        vector<off_t> k_offsets; // keeps track of divisions in merge file
 
         // Allocate ~500mb for one block
         size_t block_entries = MERGE_CHUNK_BYTES / sizeof(Entry); // round down
         vector<Entry> block;
         block.reserve(block_entries);
         
-        named_fstream sorted_blocks("temp.bucket");
+        RecordFile sorted_blocks("temp.bucket", Entry::get_size_in_bytes(),
+                                 bucket_options);
  
+        NodeReader<Entry> target_reader(*target_stream);
         Entry entry;
-        entry.read(*target_stream);
-        while (!target_stream->eof()) {
+        while (target_reader.read(entry)) {
             block.push_back(entry);
             // flush block if full
             if (block.size() == block_entries) {
                 // sort
                 sort(block.begin(), block.end());
-                for (auto& blk_entry: block) {
-                    blk_entry.write(sorted_blocks);
-                }
-                k_offsets.push_back(sorted_blocks.tellg());
+                Entry::write_many(sorted_blocks, block.data(), block.size());
+                k_offsets.push_back(sorted_blocks.get_size());
+                block.clear();
             }
-            entry.read(*target_stream);
         }
         // flush remainder
         sort(block.begin(), block.end());
-        for (auto& blk_entry : block) {
-            blk_entry.write(sorted_blocks);
-        }
-        k_offsets.push_back(sorted_blocks.tellg());
+        Entry::write_many(sorted_blocks, block.data(), block.size());
+        k_offsets.push_back(sorted_blocks.get_size());
 
         vector<Entry>().swap(block); // clear block
+        checkpointer.retire(fg_buckets[f].at(g));
         fg_buckets[f].erase(g); // erase bucket to remove file
         target_stream = nullptr;
         
@@ -118,48 +177,56 @@ namespace external_astar {
         auto k_value = k_offsets.size();
         vector< deque<Entry> > merge_buffers(k_value);
 
-        vector<streampos> current_k_offsets; //track increment to offsets
+        vector<off_t> current_k_offsets; //track increment to offsets
         current_k_offsets.push_back(0);
         current_k_offsets.insert(current_k_offsets.end(), k_offsets.begin(),
                                  k_offsets.end() - 1);
 
+        // fills merge buffer k with the next entries of its block
+        vector<Entry> run(buffer_entries);
+        auto fill_merge_buffer = [&](size_t k) {
+            size_t remaining = (k_offsets[k] - current_k_offsets[k]) /
+                Entry::get_size_in_bytes();
+            sorted_blocks.set_read_offset(current_k_offsets[k]);
+            size_t n_read = Entry::read_many(sorted_blocks, run.data(),
+                                             min(buffer_entries, remaining));
+            merge_buffers[k].insert(merge_buffers[k].end(), run.begin(),
+                                    run.begin() + n_read);
+            current_k_offsets[k] += n_read * Entry::get_size_in_bytes();
+        };
+
         // initial fill of buffers
         for (size_t k = 0; k < k_value; ++k) {
-            sorted_blocks.seekg(current_k_offsets[k]);
-            for (size_t i = 0; i < buffer_entries; ++i) {
-                if (sorted_blocks.tellg() >= k_offsets[k]) break; // end of block
-                Entry entry;
-                entry.read(sorted_blocks);
-                merge_buffers[k].push_back(entry);
-            }
-            current_k_offsets[k] = sorted_blocks.tellg();
+            fill_merge_buffer(k);
         }
 
         // For duplicate detection against other buckets
-        named_fstream* duplicate_stream_1 = nullptr;
-        Entry duplicate_entry_1;
+        unique_ptr<NodeReader<Entry> > duplicate_reader_1;
+        Entry duplicate_entry_1{};
 
-        named_fstream* duplicate_stream_2 = nullptr;
-        Entry duplicate_entry_2;
+        unique_ptr<NodeReader<Entry> > duplicate_reader_2;
+        Entry duplicate_entry_2{};
  
         if (exists_bucket(f-1, g-1)) {
-            duplicate_stream_1 = &(fg_buckets[f-1][g-1]);
-            duplicate_stream_1->clear();   
-            duplicate_stream_1->seekg(0, ios::beg);
-            duplicate_entry_1.read(*duplicate_stream_1);
+            auto& duplicate_stream_1 = fg_buckets[f-1].at(g-1);
+            duplicate_stream_1.set_read_offset(0);
+            duplicate_reader_1 =
+                memory::make_unique<NodeReader<Entry> >(duplicate_stream_1);
+            if (!duplicate_reader_1->read(duplicate_entry_1))
+                duplicate_reader_1 = nullptr;
         }
         if (exists_bucket(f-2, g-2)) {
-            duplicate_stream_2 = &(fg_buckets[f-2][g-2]);
-            duplicate_stream_2->clear();
-            duplicate_stream_2->seekg(0, ios::beg);
-            duplicate_entry_2.read(*duplicate_stream_2);
+            auto& duplicate_stream_2 = fg_buckets[f-2].at(g-2);
+            duplicate_stream_2.set_read_offset(0);
+            duplicate_reader_2 =
+                memory::make_unique<NodeReader<Entry> >(duplicate_stream_2);
+            if (!duplicate_reader_2->read(duplicate_entry_2))
+                duplicate_reader_2 = nullptr;
         }
 
         // create output bucket to store non-duplicate entries
         create_bucket(f, g);
-        target_stream = &fg_buckets[f][g];
-        target_stream->clear();
-        target_stream->seekg(0, ios::beg);
+        target_stream = &fg_buckets[f].at(g);
         
         // output buffer
         vector<Entry> output_buffer;
@@ -170,20 +237,13 @@ namespace external_astar {
             bool end_of_merge = true; // flag to terminate output step
 
             // look for minimum entry amongst all buffers
-            size_t min_index;
+            size_t min_index = 0;
             unique_ptr<Entry> min_entry = nullptr;
            
             for (size_t k = 0; k < k_value; ++k) {
                 if (merge_buffers[k].empty()) {
                     if (current_k_offsets[k] == k_offsets[k]) continue; // nothing to fetch
-                    sorted_blocks.seekg(current_k_offsets[k]); // fill empty merge buffer
-                    for (size_t i = 0; i < buffer_entries; ++i) {
-                        if (sorted_blocks.tellg() >= k_offsets[k]) break; // end of block
-                        Entry entry;
-                        entry.read(sorted_blocks);
-                        merge_buffers[k].push_back(entry); // change this to a deque
-                    }
-                    current_k_offsets[k] = sorted_blocks.tellg();
+                    fill_merge_buffer(k);
                 }
                 end_of_merge = false; // exists an unprocessed entry
                 auto& entry = merge_buffers[k].front();
@@ -205,29 +265,27 @@ namespace external_astar {
             }
 
             // inter bucket duplicate detection
-            if (duplicate_stream_1 != nullptr) {
+            if (duplicate_reader_1) {
                 while (*min_entry > duplicate_entry_1) { // align streams
-                    duplicate_entry_1.read(*duplicate_stream_1);
-                    if (duplicate_stream_1->eof()) {
-                        duplicate_stream_1 = nullptr;
+                    if (!duplicate_reader_1->read(duplicate_entry_1)) {
+                        duplicate_reader_1 = nullptr;
                         break;
                     }
                 }
-                if (*min_entry == duplicate_entry_1) {
+                if (duplicate_reader_1 && *min_entry == duplicate_entry_1) {
                     continue;
-                } 
+                }
             }
 
             // inter bucket duplicate detection
-            if (duplicate_stream_2 != nullptr) {
+            if (duplicate_reader_2) {
                 while (*min_entry > duplicate_entry_2) { // align streams
-                    duplicate_entry_2.read(*duplicate_stream_2);
-                    if (duplicate_stream_2->eof()) {
-                        duplicate_stream_2 = nullptr;
+                    if (!duplicate_reader_2->read(duplicate_entry_2)) {
+                        duplicate_reader_2 = nullptr;
                         break;
                     }
                 }
-                if (*min_entry == duplicate_entry_2) {
+                if (duplicate_reader_2 && *min_entry == duplicate_entry_2) {
                     continue;
                 }
             }
@@ -237,20 +295,15 @@ namespace external_astar {
             previous_entry = memory::make_unique<Entry>(*min_entry);
             // flush
             if (output_buffer.size() == buffer_entries) {
-                for (auto& entry : output_buffer) {
-                    entry.write(*target_stream);
-                }
-            output_buffer.clear();
+                Entry::write_many(*target_stream, output_buffer.data(),
+                                  output_buffer.size());
+                output_buffer.clear();
             }
         }
 
         // flush any remainders
-        for (auto& entry : output_buffer) {
-            entry.write(*target_stream);
-        }
-
-        target_stream->clear();
-        target_stream->seekg(0, ios::beg);
+        Entry::write_many(*target_stream, output_buffer.data(),
+                          output_buffer.size());
     }
 
     template<class Entry>
@@ -259,89 +312,117 @@ namespace external_astar {
         auto f = entry.f;
         auto g = entry.g;
 
-        if (!exists_bucket(f, g)) create_bucket(f, g);
-        if (!entry.write(fg_buckets[f][g]))
-            throw IOException("Fail to write state to fstream.");
+        auto& g_buckets = fg_buckets[f];
+        auto g_bucket = g_buckets.find(g);
+        entry.write(g_bucket != g_buckets.end() ? g_bucket->second :
+                    create_bucket(f, g));
 
         if (first_insert) {
             current_fg = make_pair(f, g);
-            fg_buckets[f][g].seekg(0, ios::beg);
-            fg_buckets[f][g].clear();
             first_insert = false;
         }
     }
 
     template<class Entry>
-    Entry ExternalAstarOpenList<Entry>::pop() {  
+    Entry ExternalAstarOpenList<Entry>::pop() {
         Entry min_entry;
 
         int f, g;
         tie(f, g) = current_fg;
 
-        // attempt to read
-        min_entry.read(fg_buckets[f][g]);
-
-        // update f, g values, and perform duplicate detection
-        if (fg_buckets[f][g].eof()) {
-            auto g_bucket = fg_buckets[f].begin();
-            while (g_bucket != fg_buckets[f].end() && g_bucket->first <= g) ++g_bucket;
-            if (g_bucket == fg_buckets[f].end()) {
-                // find lowest f
-                auto f_bucket = fg_buckets.begin();
-                while (f_bucket != fg_buckets.end() && f_bucket->first <= f) ++f_bucket;
-                if (f_bucket == fg_buckets.end()) throw OpenListEmpty();
-                f = f_bucket->first;
-                g = f_bucket->second.begin()->first;
-            } else {
-                g = g_bucket->first;
-            }
-            current_fg = make_pair(f, g);
+        // attempt to read, else update f, g values, and perform duplicate
+        // detection
+        if (!min_entry.read(fg_buckets[f].at(g))) {
+            next_bucket();
+            return pop();
+        }
+        if (reader) prefetch_next(f, g);
+        return min_entry;
+    }
+
+    template<class Entry>
+    size_t ExternalAstarOpenList<Entry>::
+    pop_batch(size_t max, vector<Entry>& entries) {
+        int f, g;
+        tie(f, g) = current_fg;
+
+        auto first = entries.size();
+        entries.resize(first + max);
+        auto n = Entry::read_many(fg_buckets[f].at(g), &entries[first], max);
+        entries.resize(first + n);
+        if (n == 0 && max > 0) {
+            next_bucket();
+            return pop_batch(max, entries);
+        }
+        if (reader) prefetch_next(f, g);
+        return n;
+    }
+
+    template<class Entry>
+    void ExternalAstarOpenList<Entry>::next_bucket() {
+        int f, g;
+        tie(f, g) = current_fg;
+
+        auto g_bucket = fg_buckets[f].begin();
+        while (g_bucket != fg_buckets[f].end() && g_bucket->first <= g) ++g_bucket;
+        if (g_bucket == fg_buckets[f].end()) {
+            // find lowest f
+            auto f_bucket = fg_buckets.begin();
+            while (f_bucket != fg_buckets.end() && f_bucket->first <= f) ++f_bucket;
+            if (f_bucket == fg_buckets.end()) throw OpenListEmpty();
+            f = f_bucket->first;
+            g = f_bucket->second.begin()->first;
+        } else {
+            g = g_bucket->first;
+        }
+        current_fg = make_pair(f, g);
             
-            remove_duplicates(f, g);
+        remove_duplicates(f, g);
             
 #ifdef TEST
-            // The following code is to test if vector is duplicate free
-            
-            vector<Entry> duplicate_vector;
-            if (exists_bucket(f-1, g-1)) {
-                fg_buckets[f-1][g-1].clear();
-                fg_buckets[f-1][g-1].seekg(0);
-                Entry entry;
-                entry.read(fg_buckets[f-1][g-1]);
-                while (!fg_buckets[f-1][g-1].eof()) {
-                    duplicate_vector.push_back(entry);
-                    entry.read(fg_buckets[f-1][g-1]);
-                }
-            }
-            if (exists_bucket(f-2, g-2)) {
-                fg_buckets[f-2][g-2].clear();
-                fg_buckets[f-2][g-2].seekg(0);
-                Entry entry;
-                entry.read(fg_buckets[f-2][g-2]);
-                while (!fg_buckets[f-2][g-2].eof()) {
-                    duplicate_vector.push_back(entry);
-                    entry.read(fg_buckets[f-2][g-2]);
-                }
+        // The following code is to test if vector is duplicate free
+        
+        vector<Entry> duplicate_vector;
+        if (exists_bucket(f-1, g-1)) {
+            fg_buckets[f-1].at(g-1).set_read_offset(0);
+            Entry entry;
+            while (entry.read(fg_buckets[f-1].at(g-1))) {
+                duplicate_vector.push_back(entry);
             }
+        }
+        if (exists_bucket(f-2, g-2)) {
+            fg_buckets[f-2].at(g-2).set_read_offset(0);
             Entry entry;
-            entry.read(fg_buckets[f][g]);
-            while (!fg_buckets[f][g].eof()) {
+            while (entry.read(fg_buckets[f-2].at(g-2))) {
                 duplicate_vector.push_back(entry);
-                entry.read(fg_buckets[f][g]);
             }
+        }
+        Entry entry;
+        while (entry.read(fg_buckets[f].at(g))) {
+            duplicate_vector.push_back(entry);
+        }
 
-            set<Entry> duplicate_set(duplicate_vector.begin(), duplicate_vector.end());
-            cout << "duplicate set size : " << duplicate_set.size()
-                 << "duplicate vec size : " << duplicate_vector.size() << endl;
-            if (duplicate_set.size() != duplicate_vector.size()) throw;
+        set<Entry> duplicate_set(duplicate_vector.begin(), duplicate_vector.end());
+        cout << "duplicate set size : " << duplicate_set.size()
+             << "duplicate vec size : " << duplicate_vector.size() << endl;
+        if (duplicate_set.size() != duplicate_vector.size()) throw;
 
-            fg_buckets[f][g].clear();
-            fg_buckets[f][g].seekg(0, ios::beg);
+        fg_buckets[f].at(g).set_read_offset(0);
 
-#endif          
-            return pop();
+#endif
+    }
+
+    template<class Entry>
+    void ExternalAstarOpenList<Entry>::prefetch_next(int f, int g) {
+        // by lowest f, then lowest g
+        auto f_bucket = fg_buckets.find(f);
+        auto g_bucket = f_bucket->second.upper_bound(g);
+        if (g_bucket == f_bucket->second.end()) {
+            if (++f_bucket == fg_buckets.end() || f_bucket->second.empty())
+                return;
+            g_bucket = f_bucket->second.begin();
         }
-        return min_entry;
+        g_bucket->second.prefetch();
     }
 
     template<class Entry>
@@ -351,11 +432,63 @@ namespace external_astar {
         rmdir("open_list_buckets");
     }
 
+    template<class Entry>
+    void ExternalAstarOpenList<Entry>::checkpoint(utils::Manifest& manifest) {
+        size_t n_buckets = 0;
+        for (auto& f_bucket : fg_buckets) {
+            for (auto& g_bucket : f_bucket.second) {
+                auto& file = g_bucket.second;
+                // only the current bucket is read from between merges
+                off_t offset = 0;
+                if (make_pair(f_bucket.first, g_bucket.first) == current_fg)
+                    offset = file.get_read_offset();
+                file.sync();
+                std::ostringstream oss;
+                oss << f_bucket.first << " " << g_bucket.first << " "
+                    << offset << " " << file.get_size() << " "
+                    << file.get_file_name();
+                manifest.set_string("open bucket " + to_string(n_buckets++),
+                                    oss.str());
+            }
+        }
+        manifest.set_int("open buckets", n_buckets);
+        manifest.set_int("open current f", current_fg.first);
+        manifest.set_int("open current g", current_fg.second);
+        manifest.set_int("open first insert", first_insert);
+        manifest.set_int("open created buckets", n_created_buckets);
+    }
+
+    template<class Entry>
+    void ExternalAstarOpenList<Entry>::restore(const utils::Manifest& manifest) {
+        fg_buckets.clear();
+        current_fg = make_pair(manifest.get_int("open current f"),
+                               manifest.get_int("open current g"));
+        auto n_buckets = manifest.get_int("open buckets");
+        for (long long i = 0; i < n_buckets; ++i) {
+            std::istringstream iss(manifest.get_string("open bucket " +
+                                                       to_string(i)));
+            int f, g;
+            off_t offset;
+            size_t size;
+            string file_name;
+            iss >> f >> g >> offset >> size >> file_name;
+            // drop what was appended after the checkpoint
+            utils::truncate_file(file_name, size);
+            auto& file = fg_buckets[f].emplace
+                (piecewise_construct, forward_as_tuple(g),
+                 forward_as_tuple(file_name, Entry::get_size_in_bytes(),
+                                  bucket_options, false)).first->second;
+            file.set_read_offset(offset);
+        }
+        first_insert = manifest.get_int("open first insert");
+        n_created_buckets = manifest.get_int("open created buckets");
+    }
+
     template<class Entry>
     string ExternalAstarOpenList<Entry>::
-    get_bucket_string(int f, int g) const {
+    get_bucket_string(int f, int g, size_t id) const {
         std::ostringstream oss;
-        oss << "open_list_buckets/" <<  f << "_" << g << ".bucket";
+        oss << "open_list_buckets/" <<  f << "_" << g << "_" << id << ".bucket";
         return oss.str();
     }
 
@@ -370,14 +503,14 @@ namespace external_astar {
     }
 
     template<class Entry>
-    void ExternalAstarOpenList<Entry>::
+    RecordFile& ExternalAstarOpenList<Entry>::
     create_bucket(int f, int g) {
         // to prevent copying of strings, in-place construction
-        fg_buckets[f].emplace(piecewise_construct,
-                              forward_as_tuple(g),
-                              forward_as_tuple(get_bucket_string(f, g)));
-        if (!fg_buckets[f][g].is_open())
-            throw IOException("Fail to open open list fstream");
+        return fg_buckets[f].emplace
+            (piecewise_construct, forward_as_tuple(g),
+             forward_as_tuple(get_bucket_string(f, g, n_created_buckets++),
+                              Entry::get_size_in_bytes(), bucket_options))
+            .first->second;
     }
 
     template<class Entry>
@@ -390,16 +523,14 @@ namespace external_astar {
             for (auto g_it = f_it->second.begin();
                  g_it != f_it->second.end(); ++g_it) {
                 if (g_it->first == entry.g-1) {
-                    g_it->second.clear();
-                    g_it->second.seekg(0, ios::beg);
-                    Entry node;
-                    node.read(g_it->second);
-                    while (!g_it->second.eof()) {
+                    g_it->second.set_read_offset(0);
+                    NodeReader<Entry> reader(g_it->second);
+                    Entry node{};
+                    while (reader.read(node)) {
                         if (node.packed ==
                             entry.parent_packed) {
                             return node;
                         }
-                        node.read(g_it->second);
                     }
                 }
             }
@@ -12,6 +12,8 @@
 #include <array>
 #include <algorithm>
 #include <memory>
+#include <string>
+#include <sstream>
 
 // Zobrist hashing a.k.a Simple Tabulation Hashing
 // Using Mersenne Twister 64 bit pseudorandom number generator, seeded by
@@ -36,6 +38,11 @@ class TabulationHash {
     TabulationHash();
         
     std::size_t operator()(const Entry& entry) const; // hash value
+
+    // State of the generator of the bitstrings, e.g. for a checkpoint, so
+    // that hash functions created after a restart are the same as before.
+    static std::string get_generator_state();
+    static void set_generator_state(const std::string& state);
 };
 
 template<class Entry>
@@ -97,6 +104,22 @@ std::size_t TabulationHash<Entry>::get_rand_bitstring() const {
     return dis(*mt_ptr);
 }
 
+template<class Entry>
+std::string TabulationHash<Entry>::get_generator_state() {
+    if (!mt_ptr) return "";
+    std::ostringstream oss;
+    oss << *mt_ptr;
+    return oss.str();
+}
+
+template<class Entry>
+void TabulationHash<Entry>::set_generator_state(const std::string& state) {
+    if (state.empty()) return;
+    if (!mt_ptr) mt_ptr = memory::make_unique<std::mt19937_64>();
+    std::istringstream iss(state);
+    iss >> *mt_ptr;
+}
+
 template<class Entry>
 std::size_t TabulationHash<Entry>::operator()(const Entry& entry) const {
     std::size_t hash_value = 0;
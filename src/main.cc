@@ -10,7 +10,10 @@
 #include "astar_ddd.hpp"
 #include "astar_pidd.hpp"
 #include "utils/wall_timer.hpp"
+#include "utils/options.hpp"
 #include <cstring>
+#include <set>
+#include <string>
 
 using namespace astar_ddd;
 using namespace external_astar;
@@ -19,26 +22,48 @@ using namespace astar_pidd;
 
 using namespace std;
 
+// constructs an external search with the node layout of --node-layout
+template<template<class, class> class Alg>
+SearchAlg<Tiles> *make_external(Tiles &tiles, const utils::Options &options) {
+	set<string> names{ "node-layout" };
+	Alg<Tiles, FullLayout>::add_option_names(names);
+	options.check_names(names);
+	string layout = options.get_string("node-layout", FullLayout::get_name());
+	if (layout != FullLayout::get_name() &&
+	    layout != CompactLayout::get_name())
+		throw Fatal("Unknown node layout: %s", layout.c_str());
+	dfpair(stdout, "node layout", "%s", layout.c_str());
+	if (layout == CompactLayout::get_name())
+		return new Alg<Tiles, CompactLayout>(tiles, options);
+	return new Alg<Tiles, FullLayout>(tiles, options);
+}
+
 int main(int argc, const char *argv[]) {
 	try {
-		if (argc != 2)
-			throw Fatal("Usage: tiles <algorithm>");
+		if (argc < 2)
+			throw Fatal("Usage: tiles <algorithm> [--option=value ...]");
+
+		utils::Options options(argc - 2, argv + 2);
 	
 		Tiles tiles(stdin);
 	
 		SearchAlg<Tiles> *search = NULL;
-		if (strcmp(argv[1], "idastar") == 0)
+		// the in-memory searches take no options
+		if (strcmp(argv[1], "idastar") == 0) {
+			options.check_names({});
 			search = new Idastar<Tiles>(tiles);
-		else if (strcmp(argv[1], "astar") == 0)
+		} else if (strcmp(argv[1], "astar") == 0) {
+			options.check_names({});
 			search = new Astar<Tiles>(tiles);
+		}
                 else if (strcmp(argv[1], "astar_idd") == 0)
-                        search = new CompressAstar<Tiles>(tiles);
+                        search = make_external<CompressAstar>(tiles, options);
                 else if (strcmp(argv[1], "external_astar") == 0)
-                        search = new ExternalAstar<Tiles>(tiles);
+                        search = make_external<ExternalAstar>(tiles, options);
                 else if (strcmp(argv[1], "astar_ddd") == 0)
-                        search = new AstarDDD<Tiles>(tiles);
+                        search = make_external<AstarDDD>(tiles, options);
                 else if (strcmp(argv[1], "astar_pidd") == 0)
-                        search = new AStarPIDD<Tiles>(tiles);
+                        search = make_external<AStarPIDD>(tiles, options);
 
 		else
 			throw Fatal("Unknown algorithm: %s", argv[1]);
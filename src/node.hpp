@@ -6,66 +6,211 @@
 #define NODE_HPP
 
 #include "utils/named_fstream.hpp"
+#include "utils/record_file.hpp"
 #include <cstring>
 #include <fstream>
+#include <vector>
+#include <algorithm>
 
-template<class D>
+/*                                                                          \
+| Layouts of a node in bucket files and in the external closed list.        |
+|                                                                           |
+| FullLayout stores every field. CompactLayout drops f, which is g plus the |
+| heuristic of the state, and the parent, which is recovered by moving the  |
+| blank back to pop, the blank position of the parent. The packed state of  |
+| the domain must then provide get_h() and get_parent(pop). The fields of a |
+| node in memory are the same either way.                                   |
+\==========================================================================*/
+
+struct FullLayout {
+    static const char *get_name() {
+        return "full";
+    }
+
+    template<class N>
+    static size_t get_size_in_bytes() {
+        return sizeof(N::f) + sizeof(N::g) + sizeof(N::pop) +
+            sizeof(N::parent_packed) + sizeof(N::packed);
+    }
+
+    template<class N>
+    static void write(const N& n, char *ptr) {
+        memcpy(ptr, &n.f, sizeof(n.f));
+        ptr += sizeof(n.f);
+        memcpy(ptr, &n.g, sizeof(n.g));
+        ptr += sizeof(n.g);
+        memcpy(ptr, &n.pop, sizeof(n.pop));
+        ptr += sizeof(n.pop);
+        memcpy(ptr, &n.parent_packed, sizeof(n.parent_packed));
+        ptr += sizeof(n.parent_packed);
+        memcpy(ptr, &n.packed, sizeof(n.packed));
+    }
+
+    template<class N>
+    static void read(N& n, const char *ptr) {
+        memcpy(&n.f, ptr, sizeof(n.f));
+        ptr += sizeof(n.f);
+        memcpy(&n.g, ptr, sizeof(n.g));
+        ptr += sizeof(n.g);
+        memcpy(&n.pop, ptr, sizeof(n.pop));
+        ptr += sizeof(n.pop);
+        memcpy(&n.parent_packed, ptr, sizeof(n.parent_packed));
+        ptr += sizeof(n.parent_packed);
+        memcpy(&n.packed, ptr, sizeof(n.packed));
+    }
+};
+
+struct CompactLayout {
+    static const char *get_name() {
+        return "compact";
+    }
+
+    template<class N>
+    static size_t get_size_in_bytes() {
+        return sizeof(N::g) + sizeof(N::pop) + sizeof(N::packed);
+    }
+
+    template<class N>
+    static void write(const N& n, char *ptr) {
+        memcpy(ptr, &n.g, sizeof(n.g));
+        ptr += sizeof(n.g);
+        memcpy(ptr, &n.pop, sizeof(n.pop));
+        ptr += sizeof(n.pop);
+        memcpy(ptr, &n.packed, sizeof(n.packed));
+    }
+
+    template<class N>
+    static void read(N& n, const char *ptr) {
+        memcpy(&n.g, ptr, sizeof(n.g));
+        ptr += sizeof(n.g);
+        memcpy(&n.pop, ptr, sizeof(n.pop));
+        ptr += sizeof(n.pop);
+        memcpy(&n.packed, ptr, sizeof(n.packed));
+        n.f = n.g + n.packed.get_h();
+        // the initial node is its own parent
+        n.parent_packed = n.pop < 0 ? n.packed : n.packed.get_parent(n.pop);
+    }
+};
+
+template<class D, class Layout = FullLayout>
 struct Node {
     char f, g, pop;
     typename D::PackedState parent_packed;
     typename D::PackedState packed;
 
-    Node() {}
+    Node() = default;
     
     Node(typename D::PackedState packedState) : packed(packedState) {} // for hashing parent
 
     const typename D::PackedState &key() { return packed; }
 
     bool write(fstream& file) const {
-        file.write(reinterpret_cast<const char *>(&f), sizeof(f));
-        file.write(reinterpret_cast<const char *>(&g), sizeof(g));
-        file.write(reinterpret_cast<const char *>(&pop), sizeof(pop));
-        file.write(reinterpret_cast<const char *>(&parent_packed), sizeof(parent_packed));
-        file.write(reinterpret_cast<const char *>(&packed), sizeof(packed));
+        char buffer[sizeof(Node)];
+        write(buffer);
+        file.write(buffer, get_size_in_bytes());
         return !file.fail();
     }
 
+    void write(RecordFile& file) const {
+        char buffer[sizeof(Node)];
+        write(buffer);
+        file.append(buffer);
+    }
+
     void write(char* ptr) const {
-        memcpy(ptr, &f, sizeof(f));
-        ptr += sizeof(f);
-        memcpy(ptr, &g, sizeof(g));
-        ptr += sizeof(g);
-        memcpy(ptr, &pop, sizeof(pop));
-        ptr += sizeof(pop);
-        memcpy(ptr, &parent_packed, sizeof(parent_packed));
-        ptr += sizeof(parent_packed);
-        memcpy(ptr, &packed, sizeof(packed));
+        Layout::write(*this, ptr);
     }
 
     bool read(fstream& file) {
-        file.read(reinterpret_cast<char *>(&f), sizeof(f));
-        file.read(reinterpret_cast<char *>(&g), sizeof(g));
-        file.read(reinterpret_cast<char *>(&pop), sizeof(pop));
-        file.read(reinterpret_cast<char *>(&parent_packed), sizeof(parent_packed));
-        file.read(reinterpret_cast<char *>(&packed), sizeof(packed));
+        char buffer[sizeof(Node)];
+        if (!file.read(buffer, get_size_in_bytes())) return false;
+        read(buffer);
+        return true;
+    }
+
+    bool read(RecordFile& file) {
+        char buffer[sizeof(Node)];
+        if (!file.read(buffer)) return false;
+        read(buffer);
+        return true;
+    }
+
+    // removes the last node of the file, false if it is empty
+    bool pop_back(RecordFile& file) {
+        char buffer[sizeof(Node)];
+        if (!file.pop_back(buffer)) return false;
+        read(buffer);
+        return true;
+    }
+
+    void read(const char *ptr) {
+        Layout::read(*this, ptr);
+    }
+
+    // Writes n nodes with one stream write per BUFFER_BYTES of records,
+    // instead of one per node.
+    static bool write_many(fstream& file, const Node *nodes, size_t n) {
+        char buffer[BUFFER_BYTES];
+        size_t node_bytes = get_size_in_bytes();
+        size_t chunk = BUFFER_BYTES / node_bytes;
+        for (size_t first = 0; first < n; first += chunk) {
+            size_t k = std::min(chunk, n - first);
+            for (size_t i = 0; i < k; ++i)
+                nodes[first + i].write(buffer + i * node_bytes);
+            file.write(buffer, k * node_bytes);
+        }
         return !file.fail();
     }
 
-    void read(char *ptr) {
-        memcpy(&f, ptr, sizeof(f));
-        ptr += sizeof(f);
-        memcpy(&g, ptr, sizeof(g));
-        ptr += sizeof(g);
-        memcpy(&pop, ptr, sizeof(pop));
-        ptr += sizeof(pop);
-        memcpy(&parent_packed, ptr, sizeof(parent_packed));
-        ptr += sizeof(parent_packed);
-        memcpy(&packed, ptr, sizeof(packed));
+    static void write_many(RecordFile& file, const Node *nodes, size_t n) {
+        char buffer[BUFFER_BYTES];
+        size_t node_bytes = get_size_in_bytes();
+        size_t chunk = BUFFER_BYTES / node_bytes;
+        for (size_t first = 0; first < n; first += chunk) {
+            size_t k = std::min(chunk, n - first);
+            for (size_t i = 0; i < k; ++i)
+                nodes[first + i].write(buffer + i * node_bytes);
+            file.append_many(buffer, k);
+        }
+    }
+
+    // Reads up to n nodes as write_many, returns the number read. Fewer
+    // than n are read only at the end of the stream.
+    static size_t read_many(fstream& file, Node *nodes, size_t n) {
+        char buffer[BUFFER_BYTES];
+        size_t node_bytes = get_size_in_bytes();
+        size_t chunk = BUFFER_BYTES / node_bytes;
+        size_t n_read = 0;
+        while (n_read < n) {
+            size_t k = std::min(chunk, n - n_read);
+            file.read(buffer, k * node_bytes);
+            size_t got = file.gcount() / node_bytes;
+            for (size_t i = 0; i < got; ++i)
+                nodes[n_read + i].read(buffer + i * node_bytes);
+            n_read += got;
+            if (got < k) break;
+        }
+        return n_read;
+    }
+
+    static size_t read_many(RecordFile& file, Node *nodes, size_t n) {
+        char buffer[BUFFER_BYTES];
+        size_t node_bytes = get_size_in_bytes();
+        size_t chunk = BUFFER_BYTES / node_bytes;
+        size_t n_read = 0;
+        while (n_read < n) {
+            size_t k = std::min(chunk, n - n_read);
+            size_t got = file.read_many(buffer, k);
+            for (size_t i = 0; i < got; ++i)
+                nodes[n_read + i].read(buffer + i * node_bytes);
+            n_read += got;
+            if (got < k) break;
+        }
+        return n_read;
     }
         
     static size_t get_size_in_bytes() {
-        return sizeof(f) + sizeof(g) + sizeof(pop) +
-            sizeof(packed) + sizeof(parent_packed);
+        return Layout::template get_size_in_bytes<Node>();
     }
 
     static int get_n_var() {
@@ -93,4 +238,29 @@ struct Node {
     }
 };
 
+// Reads the nodes of a record file in runs through read_many, for scans of
+// a whole bucket. The read cursor is ahead of the nodes returned.
+template<class N>
+class NodeReader {
+    RecordFile& file;
+    std::vector<N> run;
+    size_t next = 0;
+    size_t end = 0;
+
+public:
+    explicit NodeReader(RecordFile& file) :
+        file(file), run(BUFFER_BYTES / N::get_size_in_bytes()) {}
+
+    // false at the end of the file
+    bool read(N& node) {
+        if (next == end) {
+            end = N::read_many(file, run.data(), run.size());
+            next = 0;
+            if (end == 0) return false;
+        }
+        node = run[next++];
+        return true;
+    }
+};
+
 #endif
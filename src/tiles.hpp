@@ -40,7 +40,36 @@ struct Tiles {
         int operator[] (const int index) const {
             return (word >> (4 * index)) & 0xF;
         }
-            
+
+        // tile at location i, as laid out by pack
+        int get_tile(int i) const {
+            return (word >> (4 * (Ntiles - 1 - i))) & 0xF;
+        }
+
+        // Manhattan distance, the heuristic of the unpacked state
+        int get_h() const {
+            int sum = 0;
+            for (int i = 0; i < Ntiles; i++) {
+                int t = get_tile(i);
+                if (t == 0)
+                    continue;
+                sum += abs(t % Width - i % Width) + abs(t / Width - i / Width);
+            }
+            return sum;
+        }
+
+        // undoes the move that brought the blank here from location pop
+        PackedState get_parent(int pop) const {
+            int blank = 0;
+            while (get_tile(blank) != 0)
+                blank++;
+            uint64_t tile = get_tile(pop);
+            PackedState parent;
+            parent.word = word & ~(uint64_t(0xF) << (4 * (Ntiles - 1 - pop)));
+            parent.word |= tile << (4 * (Ntiles - 1 - blank));
+            return parent;
+        }
+
         unsigned long hash() const {
             return word;
         }
@@ -13,6 +13,7 @@
 #include <sys/stat.h>
 #include <sys/utsname.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <unistd.h>
 
 enum { Bufsz = 256 };
@@ -23,6 +24,7 @@ const char *end4 = "#end data file format 4\n";
 static void dfpair_sz(FILE*, unsigned int, const char*, const char*, va_list);
 static void machineid(FILE*);
 static void tryprocstatus(FILE*);
+static void tryrusage(FILE*);
 
 void dfpair(FILE *f, const char *key, const char *fmt, ...) {
 	char buf[Bufsz];
@@ -140,6 +142,7 @@ void dffooter(FILE *f) {
 	tstr[strlen(tstr)-1] = '\0';
 	dfpair(f, "wall finish date", "%s", tstr);
 	tryprocstatus(f);
+	tryrusage(f);
 	fputs(end4, f);
 }
 
@@ -191,6 +194,15 @@ static void tryprocstatus(FILE *out)
 	fclose(in);
 }
 
+static void tryrusage(FILE *out)
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == -1)
+		return;
+	dfpair(out, "minor page faults", "%ld", usage.ru_minflt);
+	dfpair(out, "major page faults", "%ld", usage.ru_majflt);
+}
+
 double walltime(void) {
 	struct timeval tv;
 
@@ -0,0 +1,198 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#include "checkpoint.hpp"
+#include "errors.hpp"
+#include "storage.hpp"
+#include "../fatal.hpp"
+#include "../utils.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace utils {
+
+    bool Manifest::has(const string& key) const {
+        return values.find(key) != values.end();
+    }
+
+    void Manifest::set_string(const string& key, const string& value) {
+        values[key] = value;
+    }
+
+    void Manifest::set_int(const string& key, long long value) {
+        values[key] = to_string(value);
+    }
+
+    string Manifest::get_string(const string& key) const {
+        auto it = values.find(key);
+        if (it == values.end())
+            throw Fatal("Checkpoint has no %s", key.c_str());
+        return it->second;
+    }
+
+    long long Manifest::get_int(const string& key) const {
+        auto value = get_string(key);
+        char *end;
+        auto n = strtoll(value.c_str(), &end, 10);
+        if (value.empty() || *end != '\0')
+            throw Fatal("Checkpoint has malformed %s", key.c_str());
+        return n;
+    }
+
+    void Manifest::write(const string& path) const {
+        auto tmp_path = path + ".tmp";
+        {
+            ofstream file(tmp_path, ios::trunc);
+            for (auto& value : values)
+                file << value.first << '\t' << value.second << '\n';
+            file.flush();
+            if (!file)
+                throw IOException("Fail to write checkpoint manifest");
+        }
+        sync_file(tmp_path);
+        if (rename(tmp_path.c_str(), path.c_str()) < 0)
+            throw IOException("Fail to commit checkpoint manifest");
+        auto slash = path.rfind('/');
+        sync_file(slash == string::npos ? "." : path.substr(0, slash));
+    }
+
+    Manifest Manifest::read(const string& path) {
+        ifstream file(path);
+        if (!file)
+            throw Fatal("No checkpoint to resume from: %s", path.c_str());
+        Manifest manifest;
+        string line;
+        while (getline(file, line)) {
+            auto tab = line.find('\t');
+            if (tab == string::npos)
+                throw Fatal("Malformed checkpoint manifest");
+            manifest.values[line.substr(0, tab)] = line.substr(tab + 1);
+        }
+        return manifest;
+    }
+
+    Checkpointer::Checkpointer(const Options& options) :
+        dir(options.get_string("checkpoint-dir", "checkpoint")),
+        interval_seconds(options.get_double("checkpoint-interval", 0)),
+        resume(options.get_bool("resume", false))
+    {
+        if (is_enabled() || resume) {
+            for (auto key : { "open-storage", "closed-storage" }) {
+                if (get_storage_backend(options, key, StorageBackend::buffered)
+                    == StorageBackend::memory)
+                    throw Fatal("Checkpoints need files, not --%s=memory", key);
+            }
+            // the manifest records a file and offsets of each bucket
+            if (options.get_bytes("open-segment", 0) > 0)
+                throw Fatal("Checkpoints need a file of each bucket, not "
+                            "--open-segment");
+            // and offsets of records in the files
+            if (options.get_bool("open-compress", false))
+                throw Fatal("Checkpoints need uncompressed buckets, not "
+                            "--open-compress");
+            // before any directory or file of the search is created, which
+            // the failed run would leave behind
+            auto manifest_path = dir + "/" + "manifest";
+            if (resume && !ifstream(manifest_path))
+                throw Fatal("No checkpoint to resume from: %s",
+                            manifest_path.c_str());
+            mkdir(dir.c_str(), 0744);
+            files.insert("manifest");
+            dfpair(stdout, "checkpoint directory", "%s", dir.c_str());
+            cout << "#pair  \"checkpoint interval (s)\"   "
+                 << "\"" << interval_seconds << "\"" << endl;
+        }
+    }
+
+    void Checkpointer::add_option_names(set<string>& names) {
+        names.insert({ "checkpoint-interval", "checkpoint-dir", "resume" });
+    }
+
+    string Checkpointer::get_path(const string& name) {
+        files.insert(name);
+        return dir + "/" + name;
+    }
+
+    string Checkpointer::get_snapshot_name(const string& name) const {
+        return name + "." + to_string(sequence % 2);
+    }
+
+    void Checkpointer::retire(RecordFile& file) {
+        if (!is_enabled()) return;
+        file.keep_file();
+        retired_files.push_back(file.get_file_name());
+    }
+
+    void Checkpointer::write(const function<void(Manifest&)>& save) {
+        WallTimer timer;
+        Manifest manifest;
+        manifest.set_int("checkpoint", sequence);
+        save(manifest);
+        manifest.write(get_path("manifest"));
+        // the new checkpoint no longer refers to retired files
+        for (auto& file_name : retired_files) remove(file_name.c_str());
+        retired_files.clear();
+        timer.stop();
+        checkpoint_seconds += timer.get_seconds();
+        ++n_checkpoints;
+        ++sequence;
+        since_checkpoint.reset();
+    }
+
+    Manifest Checkpointer::load() {
+        auto manifest = Manifest::read(dir + "/" + "manifest");
+        sequence = manifest.get_int("checkpoint") + 1;
+        return manifest;
+    }
+
+    void Checkpointer::clear() {
+        if (!is_enabled() && !resume) return;
+        for (auto& file_name : retired_files) remove(file_name.c_str());
+        retired_files.clear();
+        for (auto& name : files) remove((dir + "/" + name).c_str());
+        remove((dir + "/manifest.tmp").c_str());
+        // fails if directory is not empty
+        rmdir(dir.c_str());
+    }
+
+    void Checkpointer::print_statistics() const {
+        if (!is_enabled() && !resume) return;
+        dfpair(stdout, "resumed from checkpoint", "%s",
+               resume ? "true" : "false");
+        dfpair(stdout, "checkpoints", "%lu", n_checkpoints);
+        cout << "#pair  \"checkpoint time (s)\"   "
+             << "\"" << checkpoint_seconds << "\"" << endl;
+    }
+
+    void sync_file(const string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw IOException("Fail to open " + path + " for fsync");
+        int result = fsync(fd);
+        close(fd);
+        if (result < 0)
+            throw IOException("Fail to fsync " + path);
+    }
+
+    size_t get_file_size(const string& path) {
+        struct stat file_stat;
+        if (stat(path.c_str(), &file_stat) < 0)
+            throw IOException("Fail to stat " + path);
+        return file_stat.st_size;
+    }
+
+    void truncate_file(const string& path, size_t size) {
+        if (truncate(path.c_str(), size) < 0)
+            throw IOException("Fail to truncate " + path);
+    }
+}
@@ -0,0 +1,117 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include "options.hpp"
+#include "wall_timer.hpp"
+#include "record_file.hpp"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstddef>
+
+/*                                                                          \
+| Periodic checkpoints of an external search, from which --resume restarts. |
+|                                                                           |
+| A checkpoint is a manifest of the bucket files of the search with their   |
+| sizes and read offsets, along with the in-memory state that cannot be     |
+| recovered from those files and the search counters. Data files are not    |
+| copied: they are fsynced, and must not be changed below the recorded      |
+| offsets until the next checkpoint is committed. Files that are dropped    |
+| in between are retired, kept on disk until then.                          |
+|                                                                           |
+| The manifest is replaced atomically (write, fsync, rename), so a crash    |
+| while checkpointing leaves the previous checkpoint intact.                |
+\==========================================================================*/
+
+namespace utils {
+
+    // key value pairs, one per line
+    class Manifest {
+        std::map<std::string, std::string> values;
+    public:
+        bool has(const std::string& key) const;
+
+        void set_string(const std::string& key, const std::string& value);
+        void set_int(const std::string& key, long long value);
+
+        // throw Fatal if key is missing or malformed
+        std::string get_string(const std::string& key) const;
+        long long get_int(const std::string& key) const;
+
+        void write(const std::string& path) const;
+        static Manifest read(const std::string& path);
+    };
+
+    class Checkpointer {
+        std::string dir;
+        double interval_seconds;
+        bool resume;
+        WallTimer since_checkpoint;
+        std::set<std::string> files; // in dir, removed by clear()
+        std::vector<std::string> retired_files;
+        std::size_t sequence = 0; // number of the checkpoint being written
+
+        // statistics
+        std::size_t n_checkpoints = 0;
+        double checkpoint_seconds = 0;
+
+    public:
+        // --checkpoint-interval (seconds, 0 disables), --checkpoint-dir and
+        // --resume
+        explicit Checkpointer(const Options& options);
+        static void add_option_names(std::set<std::string>& names);
+
+        bool is_enabled() const {
+            return interval_seconds > 0;
+        }
+
+        bool is_resuming() const {
+            return resume;
+        }
+
+        bool is_due() const {
+            return is_enabled() &&
+                since_checkpoint.get_seconds() >= interval_seconds;
+        }
+
+        // path of a file of the checkpoint itself, e.g. a snapshot of a table
+        std::string get_path(const std::string& name);
+
+        // Name of a snapshot in the checkpoint being written, alternating
+        // between two files so that the snapshot of the committed checkpoint
+        // is not overwritten. It is to be recorded in the manifest, and its
+        // path taken with get_path.
+        std::string get_snapshot_name(const std::string& name) const;
+
+        // Keeps the file of a dropped bucket until the next checkpoint is
+        // committed, since the current one may still refer to it. Without
+        // checkpoints, the file is removed with the stream as usual.
+        void retire(RecordFile& file);
+
+        // Fills a manifest through save, after which the data files it refers
+        // to must be synced, and commits it.
+        void write(const std::function<void(Manifest&)>& save);
+
+        Manifest load();
+
+        // removes the checkpoint, after the search is done
+        void clear();
+
+        void print_statistics() const;
+    };
+
+    // fsyncs the file, or directory, at path
+    void sync_file(const std::string& path);
+
+    std::size_t get_file_size(const std::string& path);
+
+    void truncate_file(const std::string& path, std::size_t size);
+}
+
+#endif
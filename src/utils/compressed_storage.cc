@@ -0,0 +1,385 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#include "compressed_storage.hpp"
+#include "errors.hpp"
+#include "memory.hpp"
+#include "../utils.hpp"
+
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+namespace utils {
+
+    namespace {
+
+        constexpr uint32_t block_magic = 0x4b424c4f; // "OLBK"
+        enum : uint32_t { raw_codec = 0, delta_codec = 1 };
+
+        struct BlockHeader {
+            uint32_t magic;
+            uint32_t codec;
+            uint32_t bytes;        // of records
+            uint32_t stored_bytes; // after the header
+        };
+
+        // largest block, so that reads decode little more than they use
+        constexpr size_t max_block_bytes = 256 * 1024;
+
+        // most bytes that encode takes for bytes, and writes past them
+        size_t get_max_encoded_bytes(size_t bytes) {
+            return bytes + (bytes + 7) / 8 + 8;
+        }
+
+        long long get_nanoseconds(chrono::steady_clock::time_point start) {
+            return chrono::duration_cast<chrono::nanoseconds>
+                (chrono::steady_clock::now() - start).count();
+        }
+
+        uint64_t load_word(const unsigned char *source) {
+            uint64_t word;
+            memcpy(&word, source, 8);
+            return word;
+        }
+
+        size_t encode(const char *source, size_t bytes, size_t stride,
+                      char *destination) {
+            auto in = reinterpret_cast<const unsigned char *>(source);
+            auto out = reinterpret_cast<unsigned char *>(destination);
+            for (size_t i = 0; i < bytes; i += 8) {
+                auto mask = out++;
+                *mask = 0;
+                size_t n = min<size_t>(8, bytes - i);
+                if (n == 8 && i >= stride && stride >= 8) {
+                    // the bytes of x from the lowest, without branches
+                    auto x = load_word(in + i) ^ load_word(in + i - stride);
+                    for (int k = 0; k < 8; ++k, x >>= 8) {
+                        unsigned char byte = x & 0xff;
+                        *out = byte;
+                        out += byte != 0;
+                        *mask |= (byte != 0) << k;
+                    }
+                    continue;
+                }
+                for (size_t k = 0; k < n; ++k) {
+                    unsigned char x = in[i + k];
+                    if (i + k >= stride) x ^= in[i + k - stride];
+                    if (x == 0) continue;
+                    *mask |= 1 << k;
+                    *out++ = x;
+                }
+            }
+            return out - reinterpret_cast<unsigned char *>(destination);
+        }
+
+        void decode(const char *source, size_t stored_bytes, size_t stride,
+                    char *destination, size_t bytes) {
+            auto in = reinterpret_cast<const unsigned char *>(source);
+            auto end = in + stored_bytes;
+            auto out = reinterpret_cast<unsigned char *>(destination);
+            for (size_t i = 0; i < bytes; i += 8) {
+                if (in == end) throw IOException("Corrupt compressed block");
+                unsigned mask = *in++;
+                size_t n = min<size_t>(8, bytes - i);
+                if (in + __builtin_popcount(mask) > end)
+                    throw IOException("Corrupt compressed block");
+                if (n == 8 && i >= stride && stride >= 8) {
+                    // the bytes a record before are all decoded
+                    uint64_t x = 0;
+                    for (int k = 0; k < 8; ++k) {
+                        uint64_t bit = (mask >> k) & 1;
+                        x |= (bit ? uint64_t(*in) : 0) << (8 * k);
+                        in += bit;
+                    }
+                    x ^= load_word(out + i - stride);
+                    memcpy(out + i, &x, 8);
+                    continue;
+                }
+                for (size_t k = 0; k < n; ++k) {
+                    unsigned char x = 0;
+                    if (mask & (1 << k)) x = *in++;
+                    if (i + k >= stride) x ^= out[i + k - stride];
+                    out[i + k] = x;
+                }
+            }
+        }
+
+        class CompressedStorage : public Storage {
+            struct Block {
+                off_t offset;   // of its records
+                off_t position; // of its header in storage
+                uint32_t bytes;
+                uint32_t stored_bytes;
+            };
+
+            unique_ptr<Storage> storage;
+            size_t record_bytes;
+            CompressionStats& stats;
+
+            // guards blocks and stored_size, which reads look up while
+            // blocks are appended
+            mutable mutex block_mutex;
+            vector<Block> blocks;
+            off_t stored_size = 0;
+            atomic<off_t> size{0};
+
+            // writes, one at a time
+            mutex write_mutex;
+            vector<char> staged;
+            vector<char> encoded;
+
+            // the last block decoded, for the reads of the rest of it
+            mutex read_mutex;
+            vector<char> frame;
+            vector<char> decoded;
+            off_t decoded_offset = -1;
+
+            Block find_block(off_t offset) const {
+                lock_guard<mutex> lock(block_mutex);
+                auto block = upper_bound
+                    (blocks.begin(), blocks.end(), offset,
+                     [](off_t offset, const Block& block) {
+                        return offset < block.offset;
+                    });
+                return *(block - 1);
+            }
+
+            // reads and decodes block into decoded, read_mutex held
+            void load(const Block& block) {
+                if (decoded_offset == block.offset) return;
+                decoded_offset = -1;
+                frame.resize(sizeof(BlockHeader) + block.stored_bytes);
+                auto start = chrono::steady_clock::now();
+                storage->read(frame.data(), frame.size(), block.position);
+                stats.read_time += get_nanoseconds(start);
+                BlockHeader header;
+                memcpy(&header, frame.data(), sizeof(header));
+                if (header.magic != block_magic ||
+                    header.bytes != block.bytes ||
+                    header.stored_bytes != block.stored_bytes)
+                    throw IOException("Corrupt compressed block");
+                decoded.resize(block.bytes);
+                auto payload = frame.data() + sizeof(header);
+                start = chrono::steady_clock::now();
+                if (header.codec == raw_codec) {
+                    if (block.stored_bytes != block.bytes)
+                        throw IOException("Corrupt compressed block");
+                    memcpy(decoded.data(), payload, block.bytes);
+                } else if (header.codec == delta_codec) {
+                    decode(payload, block.stored_bytes, record_bytes,
+                           decoded.data(), block.bytes);
+                } else {
+                    throw IOException("Corrupt compressed block");
+                }
+                stats.decode_time += get_nanoseconds(start);
+                ++stats.n_decoded;
+                decoded_offset = block.offset;
+            }
+
+            // appends bytes of source as blocks, write_mutex held
+            void append(const char *source, size_t bytes) {
+                // whole records in each block, as records are XORed with
+                // the one before
+                size_t block_bytes = max<size_t>
+                    (max_block_bytes / record_bytes, 1) * record_bytes;
+                while (bytes > 0) {
+                    size_t n = min(bytes, block_bytes);
+                    encoded.resize(sizeof(BlockHeader) +
+                                   get_max_encoded_bytes(n));
+                    auto payload = encoded.data() + sizeof(BlockHeader);
+                    auto start = chrono::steady_clock::now();
+                    BlockHeader header{block_magic, delta_codec,
+                            static_cast<uint32_t>(n), 0};
+                    header.stored_bytes = encode(source, n, record_bytes,
+                                                 payload);
+                    if (header.stored_bytes >= n) {
+                        header.codec = raw_codec;
+                        header.stored_bytes = n;
+                        memcpy(payload, source, n);
+                    }
+                    memcpy(encoded.data(), &header, sizeof(header));
+                    stats.encode_time += get_nanoseconds(start);
+
+                    off_t position;
+                    {
+                        lock_guard<mutex> lock(block_mutex);
+                        position = stored_size;
+                    }
+                    size_t frame_bytes = sizeof(header) + header.stored_bytes;
+                    start = chrono::steady_clock::now();
+                    storage->write(encoded.data(), frame_bytes, position);
+                    stats.write_time += get_nanoseconds(start);
+                    {
+                        lock_guard<mutex> lock(block_mutex);
+                        blocks.push_back(Block{size, position, header.bytes,
+                                    header.stored_bytes});
+                        stored_size = position + frame_bytes;
+                    }
+                    size += n;
+                    ++stats.n_blocks;
+                    stats.raw_bytes += n;
+                    stats.stored_bytes += frame_bytes;
+                    source += n;
+                    bytes -= n;
+                }
+            }
+
+            // cuts the records from offset on, write_mutex held
+            void cut(off_t offset) {
+                auto block = find_block(offset);
+                vector<char> kept;
+                if (offset > block.offset) {
+                    lock_guard<mutex> lock(read_mutex);
+                    load(block);
+                    kept.assign(decoded.begin(),
+                                decoded.begin() + (offset - block.offset));
+                }
+                {
+                    lock_guard<mutex> lock(block_mutex);
+                    while (!blocks.empty() &&
+                           blocks.back().offset >= block.offset)
+                        blocks.pop_back();
+                    stored_size = block.position;
+                }
+                {
+                    lock_guard<mutex> lock(read_mutex);
+                    decoded_offset = -1;
+                }
+                size = block.offset;
+                storage->resize(block.position);
+                append(kept.data(), kept.size());
+            }
+
+        public:
+            CompressedStorage(unique_ptr<Storage> storage, size_t record_bytes,
+                              CompressionStats& stats) :
+                storage(move(storage)),
+                record_bytes(record_bytes),
+                stats(stats)
+            {
+                if (this->storage->get_size() != 0)
+                    throw IOException("Compressed storage must start empty");
+            }
+
+            void read(char *destination, size_t bytes, off_t offset) {
+                if (offset + static_cast<off_t>(bytes) > size)
+                    throw IOException("Read past the end of storage");
+                lock_guard<mutex> lock(read_mutex);
+                while (bytes > 0) {
+                    auto block = find_block(offset);
+                    load(block);
+                    size_t n = min<size_t>(bytes, block.offset + block.bytes -
+                                           offset);
+                    memcpy(destination,
+                           decoded.data() + (offset - block.offset), n);
+                    destination += n;
+                    offset += n;
+                    bytes -= n;
+                }
+            }
+
+            void write_pair(const char *first, size_t first_bytes,
+                            const char *second, size_t second_bytes,
+                            off_t offset) {
+                lock_guard<mutex> lock(write_mutex);
+                if (offset > size)
+                    throw IOException("Write past the end of compressed "
+                                      "storage");
+                if (offset < size) cut(offset);
+                if (second_bytes == 0) {
+                    append(first, first_bytes);
+                    return;
+                }
+                // the codec reads across the two
+                staged.resize(first_bytes + second_bytes);
+                memcpy(staged.data(), first, first_bytes);
+                memcpy(staged.data() + first_bytes, second, second_bytes);
+                append(staged.data(), staged.size());
+            }
+
+            off_t get_size() const {
+                return size;
+            }
+
+            void resize(off_t bytes) {
+                lock_guard<mutex> lock(write_mutex);
+                if (bytes < size) cut(bytes);
+                if (bytes > size) {
+                    vector<char> zeros(bytes - size);
+                    append(zeros.data(), zeros.size());
+                }
+            }
+
+            void sync() {
+                storage->sync();
+            }
+
+            // the blocks entirely in [begin, end)
+            void discard(off_t begin, off_t end) {
+                off_t first = -1, last = -1;
+                {
+                    lock_guard<mutex> lock(block_mutex);
+                    auto block = lower_bound
+                        (blocks.begin(), blocks.end(), begin,
+                         [](const Block& block, off_t offset) {
+                            return block.offset < offset;
+                        });
+                    for (; block != blocks.end() &&
+                             block->offset + block->bytes <= end; ++block) {
+                        if (first < 0) first = block->position;
+                        last = block->position + sizeof(BlockHeader) +
+                            block->stored_bytes;
+                    }
+                }
+                if (first >= 0) storage->discard(first, last);
+            }
+
+            bool allows_concurrent_growth() const {
+                return storage->allows_concurrent_growth();
+            }
+
+            bool has_file() const {
+                return storage->has_file();
+            }
+
+            StorageBackend get_backend() const {
+                return storage->get_backend();
+            }
+        };
+    }
+
+    void CompressionStats::print_statistics() const {
+        dfpair(stdout, "open list compressed blocks", "%lu", n_blocks.load());
+        dfpair(stdout, "open list compressed blocks decoded", "%lu",
+               n_decoded.load());
+        dfpair(stdout, "open list compressed raw (bytes)", "%lu",
+               raw_bytes.load());
+        dfpair(stdout, "open list compressed stored (bytes)", "%lu",
+               stored_bytes.load());
+        cout << "#pair  \"open list compression ratio\"   " << "\""
+             << (stored_bytes > 0 ? double(raw_bytes) / stored_bytes : 0)
+             << "\"" << endl;
+        cout << "#pair  \"open list compression time (s)\"   " << "\""
+             << encode_time * 1e-9 << "\"" << endl;
+        cout << "#pair  \"open list decompression time (s)\"   " << "\""
+             << decode_time * 1e-9 << "\"" << endl;
+        cout << "#pair  \"open list compressed write time (s)\"   " << "\""
+             << write_time * 1e-9 << "\"" << endl;
+        cout << "#pair  \"open list compressed read time (s)\"   " << "\""
+             << read_time * 1e-9 << "\"" << endl;
+    }
+
+    unique_ptr<Storage> open_compressed_storage(unique_ptr<Storage> storage,
+                                                size_t record_bytes,
+                                                CompressionStats& stats) {
+        return memory::make_unique<CompressedStorage>
+            (move(storage), record_bytes, stats);
+    }
+}
@@ -0,0 +1,58 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#ifndef COMPRESSED_STORAGE_HPP
+#define COMPRESSED_STORAGE_HPP
+
+#include "storage.hpp"
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+/*                                                                          \
+| Storage of fixed size records that is compressed in blocks on another     |
+| storage, for the open list buckets, which are appended to and read in     |
+| order.                                                                    |
+|                                                                           |
+| Each write is framed as blocks of a header, with the sizes and the codec, |
+| and the compressed records. The codec XORs each byte with the byte one    |
+| record before, which within a bucket is mostly zero, as f and g are       |
+| constant and states are close to those generated before them, and keeps   |
+| the nonzero results behind a mask per 8 bytes. A block that does not      |
+| shrink is kept raw. Blocks are decoded as a whole, the last one read      |
+| being cached for the reads that follow.                                   |
+|                                                                           |
+| Compression runs in the thread that writes, the write behind thread when  |
+| there is one, and decompression of read ahead in the read ahead thread.   |
+| Writes go at the end, or cut the records after them first, as popping     |
+| from a stack does.                                                        |
+\==========================================================================*/
+
+namespace utils {
+
+    // statistics of the compressed storages of an open list
+    class CompressionStats {
+    public:
+        std::atomic<std::size_t> n_blocks{0};
+        std::atomic<std::size_t> raw_bytes{0};
+        std::atomic<std::size_t> stored_bytes{0}; // with the headers
+        std::atomic<std::size_t> n_decoded{0};
+        // in nanoseconds, of the codec and of the underlying storage
+        std::atomic<long long> encode_time{0};
+        std::atomic<long long> decode_time{0};
+        std::atomic<long long> write_time{0};
+        std::atomic<long long> read_time{0};
+
+        void print_statistics() const;
+    };
+
+    // Compressed storage on storage, which must be empty, of records of
+    // record_bytes.
+    std::unique_ptr<Storage>
+    open_compressed_storage(std::unique_ptr<Storage> storage,
+                            std::size_t record_bytes,
+                            CompressionStats& stats);
+}
+
+#endif
@@ -12,5 +12,5 @@ named_fstream::named_fstream(const string file_name, ios_base::openmode mode) :
 }
 
 named_fstream::~named_fstream() {
-    remove(file_name.data());
+    if (!keep) remove(file_name.data());
 }
@@ -12,7 +12,8 @@
 constexpr int BUFFER_BYTES = 16384; //16kb
 /*                                                                           \
 | Keeps file_names with their respective fstream for convenient destruction. |
-| Also provides custom size buffer.                                          |
+| Also provides custom size buffer. A file may be kept on destruction, e.g.  |
+| while a checkpoint still refers to it.                                     |
 \===========================================================================*/
 
 using namespace std;
@@ -20,6 +21,7 @@ using namespace std;
 class named_fstream : public fstream {
     string file_name;
     vector<char> buffer = vector<char>(BUFFER_BYTES);
+    bool keep = false;
  public:
     named_fstream() = default;
     named_fstream(const string file_name,
@@ -28,6 +30,15 @@ class named_fstream : public fstream {
     
     ~named_fstream();
 
+    const string& get_file_name() const {
+        return file_name;
+    }
+
+    // do not remove the file on destruction
+    void keep_file() {
+        keep = true;
+    }
+
     named_fstream(const named_fstream &other) = delete;
     named_fstream& operator = (const named_fstream &other) = delete;
 };
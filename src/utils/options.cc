@@ -0,0 +1,94 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#include "options.hpp"
+#include "compunits.hpp"
+#include "../fatal.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+using namespace compunits;
+
+namespace utils {
+
+    Options::Options(int argc, const char *argv[]) {
+        for (int i = 0; i < argc; ++i) {
+            string arg(argv[i]);
+            auto eq = arg.find('=');
+            if (arg.compare(0, 2, "--") != 0 || arg.size() == 2)
+                throw Fatal("Malformed option: %s", argv[i]);
+            if (eq == string::npos) {
+                values[arg.substr(2)] = "true"; // flag
+            } else {
+                values[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+            }
+        }
+    }
+
+    bool Options::has(const string& name) const {
+        return values.find(name) != values.end();
+    }
+
+    void Options::check_names(const set<string>& names) const {
+        for (auto& value : values) {
+            if (names.count(value.first) == 0)
+                throw Fatal("Unknown option: --%s", value.first.c_str());
+        }
+    }
+
+    string Options::get_string(const string& name,
+                               const string& default_value) const {
+        auto it = values.find(name);
+        if (it == values.end()) return default_value;
+        return it->second;
+    }
+
+    long Options::get_int(const string& name, long default_value) const {
+        auto it = values.find(name);
+        if (it == values.end()) return default_value;
+        char *end;
+        long value = strtol(it->second.c_str(), &end, 10);
+        if (it->second.empty() || *end != '\0')
+            throw Fatal("Option --%s expects an integer", name.c_str());
+        return value;
+    }
+
+    double Options::get_double(const string& name, double default_value) const {
+        auto it = values.find(name);
+        if (it == values.end()) return default_value;
+        char *end;
+        double value = strtod(it->second.c_str(), &end);
+        if (it->second.empty() || *end != '\0')
+            throw Fatal("Option --%s expects a number", name.c_str());
+        return value;
+    }
+
+    bool Options::get_bool(const string& name, bool default_value) const {
+        auto it = values.find(name);
+        if (it == values.end()) return default_value;
+        if (it->second == "true" || it->second == "1") return true;
+        if (it->second == "false" || it->second == "0") return false;
+        throw Fatal("Option --%s expects true or false", name.c_str());
+    }
+
+    size_t Options::get_bytes(const string& name, size_t default_value) const {
+        auto it = values.find(name);
+        if (it == values.end()) return default_value;
+        // strtoull negates a value after a minus sign, wrapping it around
+        auto first = it->second.find_first_not_of(" \t\n\v\f\r");
+        if (first != string::npos && it->second[first] == '-')
+            throw Fatal("Option --%s expects a size, not %s", name.c_str(),
+                        it->second.c_str());
+        char *end;
+        unsigned long long value = strtoull(it->second.c_str(), &end, 10);
+        if (it->second.empty() || end == it->second.c_str())
+            throw Fatal("Option --%s expects a size", name.c_str());
+        if (strcmp(end, "") == 0 || strcmp(end, "B") == 0) return value;
+        if (strcmp(end, "KiB") == 0) return value * 1_KiB;
+        if (strcmp(end, "MiB") == 0) return value * 1_MiB;
+        if (strcmp(end, "GiB") == 0) return value * 1_GiB;
+        throw Fatal("Option --%s has unknown size unit: %s", name.c_str(), end);
+    }
+}
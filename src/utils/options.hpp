@@ -0,0 +1,49 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#ifndef OPTIONS_HPP
+#define OPTIONS_HPP
+
+#include <map>
+#include <set>
+#include <string>
+#include <cstddef>
+
+/*                                                                        \
+| Command line options of the form --name=value, given after the search   |
+| algorithm. Sizes accept the suffixes of compunits (B, KiB, MiB, GiB).   |
+|                                                                         |
+| Each search adds the names of the options it accepts, with those of the |
+| parts it is made of, e.g. RecordFileOptions, to a set that the options  |
+| are checked against before it is constructed.                           |
+\========================================================================*/
+
+namespace utils {
+
+    class Options {
+        std::map<std::string, std::string> values;
+    public:
+        Options() = default;
+        Options(int argc, const char *argv[]);
+
+        bool has(const std::string& name) const;
+
+        // Throws Fatal on an option that is not one of names, e.g. a
+        // misspelled one, which would otherwise be ignored.
+        void check_names(const std::set<std::string>& names) const;
+
+        std::string get_string(const std::string& name,
+                               const std::string& default_value) const;
+
+        long get_int(const std::string& name, long default_value) const;
+
+        double get_double(const std::string& name, double default_value) const;
+
+        bool get_bool(const std::string& name, bool default_value) const;
+
+        std::size_t get_bytes(const std::string& name,
+                              std::size_t default_value) const;
+    };
+}
+
+#endif
@@ -0,0 +1,97 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#include "read_ahead.hpp"
+#include "errors.hpp"
+#include "memory.hpp"
+#include "../utils.hpp"
+
+#include <iostream>
+#include <thread>
+
+using namespace std;
+
+namespace utils {
+
+    ReadAhead::ReadAhead() {
+        reader = memory::make_unique<scoped_thread>
+            (thread(&ReadAhead::run, this));
+    }
+
+    ReadAhead::~ReadAhead() {
+        {
+            lock_guard<std::mutex> lock(read_mutex);
+            stopping = true;
+        }
+        queued.notify_one();
+        reader.reset();
+    }
+
+    void ReadAhead::run() {
+        unique_lock<std::mutex> lock(read_mutex);
+        while (true) {
+            queued.wait(lock, [this] {
+                    return !reads.empty() || stopping;
+                });
+            if (reads.empty()) return;
+            auto read = reads.front();
+            reads.pop_front();
+            lock.unlock();
+            string error;
+            try {
+                if (read.writer) read.writer->wait(*read.queue);
+                read.storage->read(read.destination, read.bytes, read.offset);
+            } catch (const IOException& e) {
+                error = e.what();
+            }
+            lock.lock();
+            read.ticket->pending = false;
+            read.ticket->error = error;
+            ++n_reads;
+            n_bytes += read.bytes;
+            completed.notify_all();
+        }
+    }
+
+    void ReadAhead::submit(Ticket& ticket, Storage& storage, char *destination,
+                           size_t bytes, off_t offset, WriteBehind *writer,
+                           WriteBehind::Queue *queue) {
+        {
+            lock_guard<std::mutex> lock(read_mutex);
+            ticket.pending = true;
+            reads.push_back(Read{&ticket, &storage, destination, bytes, offset,
+                        writer, queue});
+        }
+        queued.notify_one();
+    }
+
+    void ReadAhead::use(Ticket& ticket) {
+        unique_lock<std::mutex> lock(read_mutex);
+        if (ticket.pending) {
+            ++n_late;
+            completed.wait(lock, [&ticket] { return !ticket.pending; });
+        } else {
+            ++n_hits;
+        }
+        if (!ticket.error.empty()) throw IOException(ticket.error);
+    }
+
+    void ReadAhead::discard(Ticket& ticket) {
+        unique_lock<std::mutex> lock(read_mutex);
+        completed.wait(lock, [&ticket] { return !ticket.pending; });
+        ++n_unused;
+    }
+
+    void ReadAhead::print_statistics() {
+        lock_guard<std::mutex> lock(read_mutex);
+        dfpair(stdout, "read ahead reads", "%lu", n_reads);
+        dfpair(stdout, "read ahead bytes", "%lu", n_bytes);
+        dfpair(stdout, "read ahead hits", "%lu", n_hits);
+        dfpair(stdout, "read ahead late hits", "%lu", n_late);
+        dfpair(stdout, "read ahead unused", "%lu", n_unused);
+        size_t n_used = n_hits + n_late + n_unused;
+        cout << "#pair  \"read ahead hit rate\"   "
+             << "\"" << (n_used > 0 ? double(n_hits) / n_used : 0)
+             << "\"" << endl;
+    }
+}
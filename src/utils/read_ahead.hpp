@@ -0,0 +1,97 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#ifndef READ_AHEAD_HPP
+#define READ_AHEAD_HPP
+
+#include "storage.hpp"
+#include "write_behind.hpp"
+#include "scoped_thread.hpp"
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <cstddef>
+
+/*                                                                          \
+| Background reader of the heads of the open list buckets that are next in  |
+| the order of expansion, so that moving to the next bucket does not stall  |
+| on the device.                                                            |
+|                                                                           |
+| Each file has a Ticket for its one read in flight. A read that was        |
+| prefetched is used, waiting for it if it is still in flight, or           |
+| discarded if the file is read elsewhere first; the hit rate is the share  |
+| of prefetched reads that were complete when they were used. Reads of a    |
+| file that is written behind wait for its queued writes first.             |
+\==========================================================================*/
+
+namespace utils {
+
+    class ReadAhead {
+    public:
+        // read of one file
+        class Ticket {
+            friend class ReadAhead;
+            bool pending = false;
+            std::string error;
+        };
+
+    private:
+        struct Read {
+            Ticket *ticket;
+            Storage *storage;
+            char *destination;
+            std::size_t bytes;
+            off_t offset;
+            WriteBehind *writer;
+            WriteBehind::Queue *queue;
+        };
+
+        std::deque<Read> reads;
+        bool stopping = false;
+        std::mutex read_mutex;
+        std::condition_variable queued;
+        std::condition_variable completed;
+
+        // statistics
+        std::size_t n_reads = 0;
+        std::size_t n_hits = 0;   // used, complete
+        std::size_t n_late = 0;   // used, still in flight
+        std::size_t n_unused = 0; // discarded
+        std::size_t n_bytes = 0;
+
+        // last, so that the thread is joined before the rest is destroyed
+        std::unique_ptr<scoped_thread> reader;
+
+        void run();
+
+    public:
+        ReadAhead();
+        // finishes the queued reads
+        ~ReadAhead();
+
+        ReadAhead(const ReadAhead &other) = delete;
+        ReadAhead& operator = (const ReadAhead &other) = delete;
+
+        // Queues a read of bytes at offset of storage into destination, after
+        // the queued writes of the file if writer is given. The ticket must
+        // not have a read in flight.
+        void submit(Ticket& ticket, Storage& storage, char *destination,
+                    std::size_t bytes, off_t offset,
+                    WriteBehind *writer = nullptr,
+                    WriteBehind::Queue *queue = nullptr);
+
+        // waits for the read of the ticket before its destination is used,
+        // throws IOException if it failed
+        void use(Ticket& ticket);
+
+        // waits for the read of the ticket, whose destination is not used
+        void discard(Ticket& ticket);
+
+        void print_statistics();
+    };
+}
+
+#endif
@@ -0,0 +1,312 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#include "record_file.hpp"
+#include "errors.hpp"
+#include "../fatal.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <thread>
+
+using namespace std;
+
+// buffers are page aligned, for the kernel to copy whole pages
+constexpr size_t buffer_alignment = 4096;
+// read space is given back in steps of at least this, of whole pages
+constexpr off_t reclaim_bytes = 1024 * 1024;
+
+namespace {
+    // of all record files
+    atomic<off_t> disk_bytes_in_use{0};
+    atomic<off_t> peak_disk_bytes{0};
+}
+
+RecordFileOptions RecordFileOptions::from(const utils::Options& options) {
+    RecordFileOptions file_options;
+    file_options.backend =
+        utils::get_storage_backend(options, "open-storage",
+                                   file_options.backend);
+    // the writer only overlaps with expansion given a core of its own
+    auto write_behind =
+        options.get_int("write-behind", thread::hardware_concurrency() > 1 ?
+                        file_options.write_behind : 0);
+    if (write_behind < 0)
+        throw Fatal("--write-behind must be at least 0, not %ld",
+                    write_behind);
+    file_options.write_behind = write_behind;
+    file_options.read_ahead =
+        options.get_bool("read-ahead", thread::hardware_concurrency() > 1 &&
+                         file_options.read_ahead);
+    file_options.memory_bytes =
+        options.get_bytes("open-memory", file_options.memory_bytes);
+    file_options.segment_bytes =
+        options.get_bytes("open-segment", file_options.segment_bytes);
+    auto push_buffer = options.get_int("push-buffer",
+                                       file_options.push_buffer);
+    if (push_buffer < 0)
+        throw Fatal("--push-buffer must be at least 0, not %ld", push_buffer);
+    file_options.push_buffer = push_buffer;
+    file_options.compress =
+        options.get_bool("open-compress", file_options.compress);
+    return file_options;
+}
+
+void RecordFileOptions::add_option_names(set<string>& names) {
+    names.insert({ "open-storage", "write-behind", "read-ahead", "open-memory",
+                "open-segment", "push-buffer", "open-compress" });
+}
+
+namespace {
+    unique_ptr<utils::Storage> open_storage(const RecordFileOptions& options,
+                                            const string& file_name,
+                                            bool truncate,
+                                            size_t record_bytes) {
+        // the memory backend is not put in segments, see SegmentFile, nor
+        // compressed, as it is not read from a device
+        if (options.backend == utils::StorageBackend::memory)
+            return utils::open_storage(options.backend, file_name, truncate);
+        auto storage = options.segments ? options.segments->open() :
+            utils::open_storage(options.backend, file_name, truncate);
+        if (options.compression)
+            storage = utils::open_compressed_storage
+                (move(storage), record_bytes, *options.compression);
+        return storage;
+    }
+}
+
+RecordFile::RecordFile(const string& file_name, size_t record_bytes,
+                       const RecordFileOptions& options, bool truncate,
+                       size_t buffer_bytes) :
+    file_name(file_name),
+    storage(open_storage(options, file_name, truncate, record_bytes)),
+    record_bytes(record_bytes),
+    // a whole number of records, and at least one
+    buffer_bytes(max(buffer_bytes / record_bytes, size_t(1)) * record_bytes),
+    disk_bytes(storage->get_size()),
+    written_bytes(disk_bytes),
+    reclaim_limit(numeric_limits<off_t>::max())
+{
+    attach(options);
+    count_bytes();
+}
+
+void RecordFile::count_bytes() {
+    off_t bytes = is_in_memory() ? 0 : disk_bytes - reclaimed;
+    auto in_use = disk_bytes_in_use += bytes - counted_bytes;
+    counted_bytes = bytes;
+    auto peak = peak_disk_bytes.load();
+    while (peak < in_use &&
+           !peak_disk_bytes.compare_exchange_weak(peak, in_use)) {}
+}
+
+off_t RecordFile::get_peak_disk_bytes() {
+    return peak_disk_bytes;
+}
+
+void RecordFile::attach(const RecordFileOptions& options) {
+    // copies to memory are not worth a thread
+    writer = options.write_behind > 0 && !is_in_memory() ?
+        options.writer : nullptr;
+    reader = options.read_ahead && storage->allows_concurrent_growth() ?
+        options.reader : nullptr;
+}
+
+RecordFile::~RecordFile() {
+    settle_read_ahead(false);
+    if (writer) {
+        // errors of the writes are of no consequence to a dropped file
+        try {
+            writer->wait(queue);
+        } catch (const IOException&) {}
+        while (auto buffer = writer->take_done_buffer(queue)) free(buffer);
+    }
+    disk_bytes_in_use -= counted_bytes;
+    bool has_file = storage->has_file();
+    storage.reset();
+    free(append_buffer);
+    free(read_buffer);
+    if (!keep && has_file) remove(file_name.c_str());
+}
+
+char *RecordFile::allocate_buffer() {
+    // reuse the buffers of writes behind
+    if (writer) {
+        if (auto buffer = writer->take_done_buffer(queue)) return buffer;
+    }
+    void *data;
+    if (posix_memalign(&data, buffer_alignment, buffer_bytes) != 0)
+        throw IOException("Fail to allocate record file buffer");
+    return static_cast<char *>(data);
+}
+
+void RecordFile::write_out(const char *first, size_t first_bytes,
+                           const char *second, size_t second_bytes) {
+    storage->write_pair(first, first_bytes, second, second_bytes, disk_bytes);
+    disk_bytes += first_bytes + second_bytes;
+    // only without writes queued, or after waiting for them
+    written_bytes = disk_bytes;
+    count_bytes();
+}
+
+void RecordFile::write_behind() {
+    writer->submit(queue, *storage, append_buffer, append_fill, disk_bytes);
+    disk_bytes += append_fill;
+    append_buffer = nullptr;
+    append_fill = 0;
+    count_bytes();
+}
+
+void RecordFile::append_many(const char *records, size_t n) {
+    size_t bytes = n * record_bytes;
+    if (writer) {
+        // a full buffer is queued once more records come, so that records
+        // popped right away are still at hand
+        while (bytes > 0) {
+            if (append_fill == buffer_bytes) write_behind();
+            if (!append_buffer) append_buffer = allocate_buffer();
+            size_t n_bytes = min(bytes, buffer_bytes - append_fill);
+            memcpy(append_buffer + append_fill, records, n_bytes);
+            append_fill += n_bytes;
+            records += n_bytes;
+            bytes -= n_bytes;
+        }
+        return;
+    }
+    if (!append_buffer) append_buffer = allocate_buffer();
+    if (append_fill + bytes <= buffer_bytes) {
+        memcpy(append_buffer + append_fill, records, bytes);
+        append_fill += bytes;
+        return;
+    }
+    write_out(append_buffer, append_fill, records, bytes);
+    append_fill = 0;
+}
+
+size_t RecordFile::read_many(char *records, size_t n) {
+    size_t wanted = n * record_bytes;
+    size_t done = 0;
+    while (done < wanted && read_offset < get_size()) {
+        size_t n_bytes;
+        if (read_offset >= disk_bytes) {
+            // not written out yet
+            n_bytes = min<size_t>(wanted - done, get_size() - read_offset);
+            memcpy(records + done, append_buffer + (read_offset - disk_bytes),
+                   n_bytes);
+        } else if (read_offset >= read_buffer_offset &&
+                   read_offset < read_buffer_offset +
+                   static_cast<off_t>(read_fill)) {
+            settle_read_ahead(true);
+            n_bytes = min<size_t>(wanted - done, read_buffer_offset +
+                                  read_fill - read_offset);
+            memcpy(records + done,
+                   read_buffer + (read_offset - read_buffer_offset), n_bytes);
+        } else if (wanted - done >= buffer_bytes) {
+            // large reads bypass the read buffer
+            n_bytes = min<size_t>(wanted - done, disk_bytes - read_offset);
+            settle_read_ahead(false);
+            wait_writes();
+            storage->read(records + done, n_bytes, read_offset);
+        } else {
+            if (!read_buffer) read_buffer = allocate_buffer();
+            read_fill = min<size_t>(buffer_bytes, disk_bytes - read_offset);
+            read_buffer_offset = read_offset;
+            settle_read_ahead(false);
+            wait_writes();
+            storage->read(read_buffer, read_fill, read_offset);
+            continue;
+        }
+        done += n_bytes;
+        read_offset += n_bytes;
+    }
+    return done / record_bytes;
+}
+
+void RecordFile::prefetch() {
+    if (!reader || read_ahead_pending || read_offset >= disk_bytes) return;
+    if (read_offset >= read_buffer_offset &&
+        read_offset < read_buffer_offset + static_cast<off_t>(read_fill))
+        return;
+    if (!read_buffer) read_buffer = allocate_buffer();
+    read_fill = min<size_t>(buffer_bytes, disk_bytes - read_offset);
+    read_buffer_offset = read_offset;
+    reader->submit(ticket, *storage, read_buffer, read_fill, read_offset,
+                   writer, &queue);
+    read_ahead_pending = true;
+}
+
+void RecordFile::move_to_file(const RecordFileOptions& options) {
+    settle_read_ahead(false);
+    wait_writes();
+    auto file = open_storage(options, file_name, true, record_bytes);
+    // records before the read cursor that were not given back are copied
+    // too, as offsets are kept
+    auto buffer = allocate_buffer();
+    for (off_t offset = reclaimed; offset < disk_bytes;) {
+        size_t n_bytes = min<size_t>(buffer_bytes, disk_bytes - offset);
+        storage->read(buffer, n_bytes, offset);
+        file->write(buffer, n_bytes, offset);
+        offset += n_bytes;
+    }
+    free(buffer);
+    file->discard(0, reclaimed);
+    storage = move(file);
+    attach(options);
+    count_bytes();
+}
+
+off_t RecordFile::reclaim() {
+    // not what a write may still be queued for, or a checkpoint reads
+    auto end = min({ read_offset, written_bytes, reclaim_limit });
+    end = end / buffer_alignment * buffer_alignment;
+    if (end - reclaimed < reclaim_bytes) return 0;
+    storage->discard(reclaimed, end);
+    auto bytes = end - reclaimed;
+    reclaimed = end;
+    count_bytes();
+    return bytes;
+}
+
+bool RecordFile::pop_back(char *record) {
+    if (is_empty()) return false;
+    if (append_fill == 0) {
+        if (!append_buffer) append_buffer = allocate_buffer();
+        // bring the end of the file back into the append buffer, where it is
+        // popped from and appended to again
+        append_fill = min<size_t>(buffer_bytes, disk_bytes);
+        wait_writes();
+        disk_bytes -= append_fill;
+        written_bytes = disk_bytes;
+        storage->read(append_buffer, append_fill, disk_bytes);
+        // the tail is written again if records are appended again
+        storage->discard(disk_bytes, disk_bytes + append_fill);
+        count_bytes();
+        if (read_buffer_offset + static_cast<off_t>(read_fill) > disk_bytes) {
+            // to be overwritten by the next appends
+            settle_read_ahead(false);
+            read_fill = 0;
+        }
+    }
+    append_fill -= record_bytes;
+    memcpy(record, append_buffer + append_fill, record_bytes);
+    read_offset = min(read_offset, get_size());
+    return true;
+}
+
+void RecordFile::flush() {
+    wait_writes();
+    if (append_fill == 0) return;
+    write_out(append_buffer, append_fill, nullptr, 0);
+    append_fill = 0;
+}
+
+void RecordFile::sync() {
+    flush();
+    // the file may extend past records popped from it
+    storage->resize(disk_bytes);
+    storage->sync();
+}
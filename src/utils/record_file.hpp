@@ -0,0 +1,226 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#ifndef RECORD_FILE_HPP
+#define RECORD_FILE_HPP
+
+#include "storage.hpp"
+#include "write_behind.hpp"
+#include "read_ahead.hpp"
+#include "segment_file.hpp"
+#include "compressed_storage.hpp"
+#include "options.hpp"
+
+#include <set>
+#include <string>
+#include <memory>
+#include <cstddef>
+
+#include <sys/types.h>
+
+/*                                                                          \
+| Binary file of fixed size records on a storage backend, for the buckets   |
+| of the open lists.                                                        |
+|                                                                           |
+| Records are appended at the end through an append buffer, and read from   |
+| a read cursor of their own through a read buffer, so that reading and     |
+| appending do not move each other. A full append buffer goes out with the  |
+| records being appended in one write, a pwritev with buffered storage.     |
+| Given a WriteBehind, full append buffers are queued to its thread         |
+| instead, and reads wait for the queued writes of the file. Given a        |
+| ReadAhead, the read buffer may be filled in the background ahead of the   |
+| first read at the cursor.                                                 |
+| Records may also be popped from the end, as from a stack. The file is     |
+| removed on destruction, unless kept, e.g. while a checkpoint still refers |
+| to it. A file on the memory backend may be moved to a file on disk, when  |
+| its open list runs out of the memory it may keep buckets in.              |
+|                                                                           |
+| The space of records that were read, and are not read again, is given     |
+| back to the file system as the read cursor moves on, and that of records  |
+| popped from the end as they are popped, so that the files of the open     |
+| lists take the space of their frontier rather than that of the search so  |
+| far. The peak of the bytes in files across all record files is kept.      |
+\==========================================================================*/
+
+// storage of the buckets of an open list
+struct RecordFileOptions {
+    utils::StorageBackend backend = utils::StorageBackend::buffered;
+    // append buffers of a file queued for writing at once, 0 to write them
+    // synchronously
+    std::size_t write_behind = 2;
+    // read the next bucket to be expanded ahead
+    bool read_ahead = true;
+    // records the open list may keep in buckets on the memory backend
+    // before moving them to files, 0 to have files from the start
+    std::size_t memory_bytes = 256 * 1024 * 1024;
+    // files of buckets as chains of segments of this size in one shared
+    // file, 0 for a file of each bucket
+    std::size_t segment_bytes = 0;
+    // records of a bucket that the open list stages in memory, combining
+    // duplicates among them, before it writes them, 0 to write each record
+    // as it is pushed
+    std::size_t push_buffer = 4096;
+    // files of buckets compressed in blocks, see CompressedStorage
+    bool compress = false;
+    // threads writing behind and reading ahead, the shared file of
+    // segments and the statistics of compression, owned by the open list
+    utils::WriteBehind *writer = nullptr;
+    utils::ReadAhead *reader = nullptr;
+    utils::SegmentFile *segments = nullptr;
+    utils::CompressionStats *compression = nullptr;
+
+    // --open-storage, --write-behind, --read-ahead, --open-memory,
+    // --open-segment, --push-buffer and --open-compress
+    static RecordFileOptions from(const utils::Options& options);
+    static void add_option_names(std::set<std::string>& names);
+};
+
+class RecordFile {
+    std::string file_name;
+    std::unique_ptr<utils::Storage> storage;
+    utils::WriteBehind *writer = nullptr;
+    utils::WriteBehind::Queue queue; // of writes behind
+    utils::ReadAhead *reader = nullptr;
+    utils::ReadAhead::Ticket ticket; // of the read ahead into the read buffer
+    bool read_ahead_pending = false; // read buffer not used since read ahead
+    std::size_t record_bytes;
+    std::size_t buffer_bytes;
+    bool keep = false;
+
+    // records past disk_bytes are in the append buffer, those below may
+    // still be queued for writing, those below written_bytes are not
+    char *append_buffer = nullptr;
+    std::size_t append_fill = 0;
+    off_t disk_bytes = 0;
+    off_t written_bytes = 0;
+
+    // [0, reclaimed) was given back, and space past reclaim_limit is not
+    off_t reclaimed = 0;
+    off_t reclaim_limit;
+    // bytes of this file in the count of bytes in files
+    off_t counted_bytes = 0;
+
+    // caches [read_buffer_offset, read_buffer_offset + read_fill) of the file
+    char *read_buffer = nullptr;
+    off_t read_buffer_offset = 0;
+    std::size_t read_fill = 0;
+    off_t read_offset = 0;
+
+    // the threads of options that the storage can be used with
+    void attach(const RecordFileOptions& options);
+    // buffers are allocated on first use, as many buckets are only appended
+    // to, or only read
+    char *allocate_buffer();
+    void write_out(const char *first, std::size_t first_bytes,
+                   const char *second, std::size_t second_bytes);
+    // queues the append buffer to the writer
+    void write_behind();
+    // before reading what was written out
+    void wait_writes() {
+        if (writer) writer->wait(queue);
+        written_bytes = disk_bytes;
+    }
+    // updates the count of bytes in files after the file changed
+    void count_bytes();
+    // before the read buffer is used, or changed
+    void settle_read_ahead(bool use) {
+        if (!read_ahead_pending) return;
+        read_ahead_pending = false;
+        if (use) {
+            reader->use(ticket);
+        } else {
+            reader->discard(ticket);
+        }
+    }
+
+public:
+    // buffer_bytes is the size of each of the two buffers
+    RecordFile(const std::string& file_name, std::size_t record_bytes,
+               const RecordFileOptions& options = RecordFileOptions(),
+               bool truncate = true, std::size_t buffer_bytes = 64 * 1024);
+    ~RecordFile();
+
+    RecordFile(const RecordFile &other) = delete;
+    RecordFile& operator = (const RecordFile &other) = delete;
+
+    const std::string& get_file_name() const {
+        return file_name;
+    }
+
+    // do not remove the file on destruction
+    void keep_file() {
+        keep = true;
+    }
+
+    // in bytes, including records that are still buffered
+    off_t get_size() const {
+        return disk_bytes + append_fill;
+    }
+
+    bool is_empty() const {
+        return get_size() == 0;
+    }
+
+    // true on the memory backend, where there is no file
+    bool is_in_memory() const {
+        return storage->get_backend() == utils::StorageBackend::memory;
+    }
+    // Copies the records to a new file on the backend of options, at the
+    // same offsets, and continues on it.
+    void move_to_file(const RecordFileOptions& options);
+
+    // Gives back the space before the read cursor, which must not be set
+    // back before it anymore, once enough of it was read, but not past
+    // offset set by keep_from, e.g. where a checkpoint reads from. Returns
+    // the bytes given back.
+    off_t reclaim();
+    void keep_from(off_t offset) {
+        reclaim_limit = offset;
+    }
+    // in bytes, from the start of the file
+    off_t get_reclaimed() const {
+        return reclaimed;
+    }
+
+    // highest number of bytes in files, not on the memory backend, at once
+    static off_t get_peak_disk_bytes();
+
+    void append(const char *record) {
+        append_many(record, 1);
+    }
+    void append_many(const char *records, std::size_t n);
+
+    // Reads up to n records at the read cursor and moves it past them,
+    // returns the number read, fewer than n only at the end of the file.
+    std::size_t read_many(char *records, std::size_t n);
+    bool read(char *record) {
+        return read_many(record, 1) == 1;
+    }
+
+    off_t get_read_offset() const {
+        return read_offset;
+    }
+    void set_read_offset(off_t offset) {
+        read_offset = offset;
+    }
+    // true if the read cursor is at the end of the file
+    bool is_read_done() const {
+        return read_offset >= get_size();
+    }
+
+    // Starts filling the read buffer at the read cursor in the background,
+    // e.g. for the bucket to be read next. Has no effect without a reader,
+    // if the records at the cursor are buffered already, or if the storage
+    // does not allow reads while the file grows.
+    void prefetch();
+
+    // removes the last record, false if there is none
+    bool pop_back(char *record);
+
+    // writes buffered records to the file, and waits for them
+    void flush();
+    // flushes and fsyncs
+    void sync();
+};
+
+#endif
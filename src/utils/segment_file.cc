@@ -0,0 +1,219 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#include "segment_file.hpp"
+#include "errors.hpp"
+#include "memory.hpp"
+#include "../fatal.hpp"
+#include "../utils.hpp"
+
+#include <cstdio>
+#include <algorithm>
+#include <atomic>
+
+using namespace std;
+
+namespace utils {
+
+    namespace {
+
+        // granularity of the direct backend, which segments are aligned to so
+        // that no block is shared by two buckets
+        constexpr size_t segment_alignment = 4096;
+        // in a chain, for a segment given back by discard
+        constexpr size_t no_segment = static_cast<size_t>(-1);
+
+        class SegmentStorage : public Storage {
+            SegmentFile& segments;
+            size_t segment_bytes;
+            // guards chain, which the threads writing behind and reading
+            // ahead translate offsets with while it grows
+            mutable mutex chain_mutex;
+            vector<size_t> chain;
+            atomic<off_t> size{0};
+
+            // gives back the segments of chain in [first, last), chain_mutex
+            // held
+            void release(size_t first, size_t last) {
+                vector<size_t> released;
+                for (auto i = first; i < last; ++i) {
+                    if (chain[i] == no_segment) continue;
+                    released.push_back(chain[i]);
+                    chain[i] = no_segment;
+                }
+                segments.release(released.data(), released.size());
+            }
+
+            // offset in the file of offset in the bucket, extending the chain
+            // to it if allowed
+            off_t locate(off_t offset, bool extend) {
+                size_t index = offset / segment_bytes;
+                lock_guard<mutex> lock(chain_mutex);
+                if (index >= chain.size()) {
+                    if (!extend)
+                        throw IOException("Read past the end of storage");
+                    while (chain.size() <= index)
+                        chain.push_back(segments.allocate());
+                }
+                if (chain[index] == no_segment) {
+                    // written again, as the end of a stack
+                    if (!extend)
+                        throw IOException("Read of discarded storage");
+                    chain[index] = segments.allocate();
+                }
+                return static_cast<off_t>(chain[index] * segment_bytes +
+                                          offset % segment_bytes);
+            }
+
+        public:
+            explicit SegmentStorage(SegmentFile& segments) :
+                segments(segments),
+                segment_bytes(segments.get_segment_bytes()) {}
+
+            ~SegmentStorage() {
+                release(0, chain.size());
+            }
+
+            void read(char *destination, size_t bytes, off_t offset) {
+                if (offset + static_cast<off_t>(bytes) > size)
+                    throw IOException("Read past the end of storage");
+                while (bytes > 0) {
+                    size_t n = min<size_t>(bytes, segment_bytes -
+                                           offset % segment_bytes);
+                    segments.get_file().read(destination, n,
+                                             locate(offset, false));
+                    destination += n;
+                    offset += n;
+                    bytes -= n;
+                }
+            }
+
+            void write_pair(const char *first, size_t first_bytes,
+                            const char *second, size_t second_bytes,
+                            off_t offset) {
+                // as one request per segment, of the parts of first and
+                // second that fall in it
+                size_t bytes = first_bytes + second_bytes;
+                size_t done = 0;
+                while (done < bytes) {
+                    off_t position = offset + done;
+                    size_t n = min<size_t>(bytes - done, segment_bytes -
+                                           position % segment_bytes);
+                    auto location = locate(position, true);
+                    if (done < first_bytes) {
+                        size_t from_first = min(n, first_bytes - done);
+                        segments.get_file().write_pair
+                            (first + done, from_first, second, n - from_first,
+                             location);
+                    } else {
+                        segments.get_file().write
+                            (second + (done - first_bytes), n, location);
+                    }
+                    done += n;
+                }
+                off_t end = offset + bytes;
+                off_t current = size;
+                while (current < end &&
+                       !size.compare_exchange_weak(current, end)) {}
+            }
+
+            off_t get_size() const {
+                return size;
+            }
+
+            void resize(off_t bytes) {
+                if (bytes > size) {
+                    // extended with zeros
+                    vector<char> zeros(min<size_t>(bytes - size,
+                                                   segment_bytes));
+                    for (off_t offset = size; offset < bytes;) {
+                        size_t n = min<size_t>(zeros.size(), bytes - offset);
+                        write(zeros.data(), n, offset);
+                        offset += n;
+                    }
+                    return;
+                }
+                lock_guard<mutex> lock(chain_mutex);
+                size_t n_kept = (bytes + segment_bytes - 1) / segment_bytes;
+                if (n_kept < chain.size()) {
+                    release(n_kept, chain.size());
+                    chain.resize(n_kept);
+                }
+                size = bytes;
+            }
+
+            void sync() {
+                segments.get_file().sync();
+            }
+
+            // whole segments only
+            void discard(off_t begin, off_t end) {
+                lock_guard<mutex> lock(chain_mutex);
+                size_t first = (begin + segment_bytes - 1) / segment_bytes;
+                size_t last = min<size_t>(end / segment_bytes, chain.size());
+                if (last > first) release(first, last);
+            }
+
+            bool allows_concurrent_growth() const {
+                return true;
+            }
+
+            // the file is shared, not removed with the bucket
+            bool has_file() const {
+                return false;
+            }
+
+            StorageBackend get_backend() const {
+                return segments.get_file().get_backend();
+            }
+        };
+    }
+
+    SegmentFile::SegmentFile(StorageBackend backend, const string& file_name,
+                             size_t segment_bytes) :
+        file(open_storage(backend, file_name)),
+        segment_bytes((max<size_t>(segment_bytes, 1) + segment_alignment - 1) /
+                      segment_alignment * segment_alignment)
+    {
+        if (!file->allows_concurrent_growth() || !file->has_file())
+            throw Fatal("Segments need a backend that is read while it "
+                        "grows, not %s", get_storage_backend_name(backend));
+        // scratch, gone with the descriptor however the search ends
+        remove(file_name.c_str());
+    }
+
+    unique_ptr<Storage> SegmentFile::open() {
+        return memory::make_unique<SegmentStorage>(*this);
+    }
+
+    size_t SegmentFile::allocate() {
+        lock_guard<std::mutex> lock(segment_mutex);
+        ++n_allocated;
+        size_t segment;
+        if (free_segments.empty()) {
+            segment = n_segments++;
+        } else {
+            // most recently freed, likely still cached
+            segment = free_segments.back();
+            free_segments.pop_back();
+            ++n_reused;
+        }
+        max_used = max(max_used, n_segments - free_segments.size());
+        return segment;
+    }
+
+    void SegmentFile::release(const size_t *segments, size_t n) {
+        lock_guard<std::mutex> lock(segment_mutex);
+        free_segments.insert(free_segments.end(), segments, segments + n);
+    }
+
+    void SegmentFile::print_statistics() {
+        lock_guard<std::mutex> lock(segment_mutex);
+        dfpair(stdout, "open list segment (bytes)", "%lu", segment_bytes);
+        dfpair(stdout, "open list segments allocated", "%lu", n_allocated);
+        dfpair(stdout, "open list segments reused", "%lu", n_reused);
+        dfpair(stdout, "open list segment file (bytes)", "%lu",
+               n_segments * segment_bytes);
+        dfpair(stdout, "open list peak segments in use", "%lu", max_used);
+    }
+}
@@ -0,0 +1,70 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#ifndef SEGMENT_FILE_HPP
+#define SEGMENT_FILE_HPP
+
+#include "storage.hpp"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstddef>
+
+/*                                                                          \
+| One file of fixed size segments shared by the buckets of an open list, so |
+| that the number of files and descriptors does not grow with the number of |
+| buckets.                                                                  |
+|                                                                           |
+| Each bucket is a Storage of its own, a chain of segments that is extended |
+| a segment at a time as the bucket is appended to, and whose offsets are   |
+| translated to those of the segments. Segments of dropped buckets are      |
+| reused before the file is extended, so that it stays as large as the      |
+| buckets that are alive at once, and writes go to the end of few chains.   |
+\==========================================================================*/
+
+namespace utils {
+
+    class SegmentFile {
+        std::unique_ptr<Storage> file;
+        std::size_t segment_bytes;
+
+        std::mutex segment_mutex;
+        std::vector<std::size_t> free_segments;
+        std::size_t n_segments = 0; // in the file
+
+        // statistics
+        std::size_t n_allocated = 0;
+        std::size_t n_reused = 0;
+        std::size_t max_used = 0;
+
+    public:
+        // Throws Fatal with a backend whose reads may not run while the file
+        // grows, as buckets are read while others are written. The file is
+        // unlinked once open.
+        SegmentFile(StorageBackend backend, const std::string& file_name,
+                    std::size_t segment_bytes);
+
+        SegmentFile(const SegmentFile &other) = delete;
+        SegmentFile& operator = (const SegmentFile &other) = delete;
+
+        // storage of a new, empty bucket
+        std::unique_ptr<Storage> open();
+
+        // index of a segment to use, at byte index * segment_bytes
+        std::size_t allocate();
+        void release(const std::size_t *segments, std::size_t n);
+
+        Storage& get_file() {
+            return *file;
+        }
+        std::size_t get_segment_bytes() const {
+            return segment_bytes;
+        }
+
+        void print_statistics();
+    };
+}
+
+#endif
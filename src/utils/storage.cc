@@ -0,0 +1,528 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#include "storage.hpp"
+#include "errors.hpp"
+#include "memory.hpp"
+#include "../fatal.hpp"
+#include "../compress/batch_reader.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace utils {
+
+    namespace {
+
+        // logical block size that satisfies O_DIRECT on common devices
+        constexpr size_t direct_io_alignment = 4096;
+        // largest transfer of the direct backend through its bounce buffer
+        constexpr size_t bounce_bytes = 1024 * 1024;
+        // blocks of the reads of the io_uring backend
+        constexpr size_t ring_block_bytes = 64 * 1024;
+        constexpr unsigned ring_queue_depth = 8;
+
+        off_t align_down(off_t value) {
+            return value / direct_io_alignment * direct_io_alignment;
+        }
+
+        off_t align_up(off_t value) {
+            return (value + direct_io_alignment - 1) /
+                direct_io_alignment * direct_io_alignment;
+        }
+
+        bool is_aligned(const void *pointer, size_t bytes, off_t offset) {
+            return reinterpret_cast<uintptr_t>(pointer) %
+                direct_io_alignment == 0 &&
+                bytes % direct_io_alignment == 0 &&
+                offset % direct_io_alignment == 0;
+        }
+
+        int open_file(const string& file_name, bool truncate, int extra_flags) {
+            int flags = O_CREAT | O_RDWR | (truncate ? O_TRUNC : 0);
+            int fd = open(file_name.c_str(), flags | extra_flags,
+                          S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+            // file systems such as tmpfs do not support O_DIRECT
+            if (fd < 0 && extra_flags != 0)
+                fd = open(file_name.c_str(), flags,
+                          S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+            if (fd < 0) throw IOException("Fail to open " + file_name);
+            return fd;
+        }
+
+        off_t get_fd_size(int fd, const string& file_name) {
+            struct stat file_stat;
+            if (fstat(fd, &file_stat) < 0)
+                throw IOException("Fail to stat " + file_name);
+            return file_stat.st_size;
+        }
+
+        void read_fully(int fd, char *destination, size_t bytes, off_t offset,
+                        const string& file_name) {
+            while (bytes > 0) {
+                ssize_t n = pread(fd, destination, bytes, offset);
+                if (n <= 0) throw IOException("Fail to read " + file_name);
+                destination += n;
+                offset += n;
+                bytes -= n;
+            }
+        }
+
+        void write_fully(int fd, const char *first, size_t first_bytes,
+                         const char *second, size_t second_bytes,
+                         off_t offset, const string& file_name) {
+            iovec iov[2] = {
+                { const_cast<char *>(first), first_bytes },
+                { const_cast<char *>(second), second_bytes }
+            };
+            int n_iov = second_bytes > 0 ? 2 : 1;
+            iovec *next = iov;
+            while (n_iov > 0) {
+                ssize_t written = pwritev(fd, next, n_iov, offset);
+                if (written < 0)
+                    throw IOException("Fail to write " + file_name);
+                offset += written;
+                // skip what was written, after a short write
+                while (n_iov > 0 &&
+                       static_cast<size_t>(written) >= next->iov_len) {
+                    written -= next->iov_len;
+                    ++next;
+                    --n_iov;
+                }
+                if (n_iov > 0) {
+                    next->iov_base = static_cast<char *>(next->iov_base) +
+                        written;
+                    next->iov_len -= written;
+                }
+            }
+        }
+
+        // best effort, not all file systems punch holes
+        void punch_hole(int fd, off_t begin, off_t end) {
+            if (end > begin &&
+                fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                          begin, end - begin) < 0) {}
+        }
+
+        void update_max(atomic<off_t>& value, off_t candidate) {
+            auto current = value.load();
+            while (current < candidate &&
+                   !value.compare_exchange_weak(current, candidate)) {}
+        }
+
+        class BufferedStorage : public Storage {
+        protected:
+            string file_name;
+            int fd;
+            atomic<off_t> size;
+
+        public:
+            BufferedStorage(const string& file_name, bool truncate,
+                            int extra_flags = 0) :
+                file_name(file_name),
+                fd(open_file(file_name, truncate, extra_flags)),
+                size(get_fd_size(fd, file_name)) {}
+
+            ~BufferedStorage() {
+                close(fd);
+            }
+
+            void read(char *destination, size_t bytes, off_t offset) {
+                read_fully(fd, destination, bytes, offset, file_name);
+            }
+
+            void write_pair(const char *first, size_t first_bytes,
+                            const char *second, size_t second_bytes,
+                            off_t offset) {
+                write_fully(fd, first, first_bytes, second, second_bytes,
+                            offset, file_name);
+                update_max(size, offset + first_bytes + second_bytes);
+            }
+
+            off_t get_size() const {
+                return size;
+            }
+
+            void resize(off_t bytes) {
+                if (ftruncate(fd, bytes) < 0)
+                    throw IOException("Fail to resize " + file_name);
+                size = bytes;
+            }
+
+            void sync() {
+                if (fsync(fd) < 0)
+                    throw IOException("Fail to fsync " + file_name);
+            }
+
+            void discard(off_t begin, off_t end) {
+                punch_hole(fd, begin, end);
+            }
+
+            StorageBackend get_backend() const {
+                return StorageBackend::buffered;
+            }
+        };
+
+        class DirectStorage : public BufferedStorage {
+            // serializes writes, which read, modify and write partial blocks
+            mutex write_mutex;
+            // the partial block at the end of the last write
+            char *tail = nullptr;
+            off_t tail_offset = -1;
+
+            static char *get_bounce_buffer() {
+                struct Buffer {
+                    char *data = nullptr;
+                    ~Buffer() { free(data); }
+                };
+                thread_local Buffer buffer;
+                if (!buffer.data) {
+                    void *data;
+                    if (posix_memalign(&data, direct_io_alignment,
+                                       bounce_bytes) != 0)
+                        throw IOException("Fail to allocate bounce buffer");
+                    buffer.data = static_cast<char *>(data);
+                }
+                return buffer.data;
+            }
+
+            // Reads the aligned block at offset, of which only the bytes
+            // below the end of file are read from the device. The file may
+            // end within the block after a resize.
+            void read_block(char *block, off_t offset) {
+                if (offset == tail_offset) {
+                    memcpy(block, tail, direct_io_alignment);
+                    return;
+                }
+                memset(block, 0, direct_io_alignment);
+                if (offset >= size) return;
+                ssize_t n = pread(fd, block, direct_io_alignment, offset);
+                if (n < min<off_t>(direct_io_alignment, size - offset))
+                    throw IOException("Fail to read " + file_name);
+            }
+
+        public:
+            DirectStorage(const string& file_name, bool truncate) :
+                BufferedStorage(file_name, truncate, O_DIRECT) {
+                void *data;
+                if (posix_memalign(&data, direct_io_alignment,
+                                   direct_io_alignment) != 0)
+                    throw IOException("Fail to allocate bounce buffer");
+                tail = static_cast<char *>(data);
+            }
+
+            ~DirectStorage() {
+                // blocks are written whole, past the end of file
+                if (ftruncate(fd, size) < 0) {}
+                free(tail);
+            }
+
+            void read(char *destination, size_t bytes, off_t offset) {
+                if (is_aligned(destination, bytes, offset)) {
+                    read_fully(fd, destination, bytes, offset, file_name);
+                    return;
+                }
+                char *bounce = get_bounce_buffer();
+                while (bytes > 0) {
+                    off_t begin = align_down(offset);
+                    off_t end = min<off_t>(align_up(offset + bytes),
+                                           begin + bounce_bytes);
+                    ssize_t n = pread(fd, bounce, end - begin, begin);
+                    size_t skip = offset - begin;
+                    size_t copied = min<size_t>(bytes, end - offset);
+                    if (n < static_cast<ssize_t>(skip + copied))
+                        throw IOException("Fail to read " + file_name);
+                    memcpy(destination, bounce + skip, copied);
+                    destination += copied;
+                    offset += copied;
+                    bytes -= copied;
+                }
+            }
+
+            void write_pair(const char *first, size_t first_bytes,
+                            const char *second, size_t second_bytes,
+                            off_t offset) {
+                lock_guard<mutex> lock(write_mutex);
+                size_t bytes = first_bytes + second_bytes;
+                off_t write_end = offset + bytes;
+                if (second_bytes == 0 && is_aligned(first, bytes, offset)) {
+                    write_fully(fd, first, bytes, nullptr, 0, offset,
+                                file_name);
+                    if (tail_offset >= offset && tail_offset < write_end)
+                        tail_offset = -1;
+                    update_max(size, write_end);
+                    return;
+                }
+                char *bounce = get_bounce_buffer();
+                size_t done = 0; // of first and second
+                while (done < bytes) {
+                    off_t position = offset + done;
+                    off_t begin = align_down(position);
+                    off_t end = min<off_t>(align_up(write_end),
+                                           begin + bounce_bytes);
+                    size_t n = min<size_t>(bytes - done, end - position);
+                    // keep the bytes of the edge blocks around the write
+                    if (position != begin) read_block(bounce, begin);
+                    if (position + static_cast<off_t>(n) < end)
+                        read_block(bounce + (end - begin - direct_io_alignment),
+                                   end - direct_io_alignment);
+                    char *to = bounce + (position - begin);
+                    if (done < first_bytes) {
+                        size_t from_first = min(n, first_bytes - done);
+                        memcpy(to, first + done, from_first);
+                        memcpy(to + from_first, second, n - from_first);
+                    } else {
+                        memcpy(to, second + (done - first_bytes), n);
+                    }
+                    write_fully(fd, bounce, end - begin, nullptr, 0, begin,
+                                file_name);
+                    if (tail_offset >= begin && tail_offset < end)
+                        tail_offset = -1;
+                    done += n;
+                    if (done == bytes && write_end % direct_io_alignment != 0) {
+                        tail_offset = end - direct_io_alignment;
+                        memcpy(tail, bounce + (tail_offset - begin),
+                               direct_io_alignment);
+                    }
+                }
+                update_max(size, write_end);
+            }
+
+            void resize(off_t bytes) {
+                lock_guard<mutex> lock(write_mutex);
+                // bytes cut off must read as zeros if the file grows again
+                if (bytes < size && tail_offset + static_cast<off_t>
+                    (direct_io_alignment) > bytes)
+                    tail_offset = -1;
+                BufferedStorage::resize(bytes);
+            }
+
+            void sync() {
+                lock_guard<mutex> lock(write_mutex);
+                if (ftruncate(fd, size) < 0)
+                    throw IOException("Fail to resize " + file_name);
+                BufferedStorage::sync();
+            }
+
+            StorageBackend get_backend() const {
+                return StorageBackend::direct;
+            }
+        };
+
+        class IoUringStorage : public BufferedStorage {
+            unique_ptr<compress::BatchReader> reader;
+            mutex read_mutex; // one batch on the rings at a time
+            vector<compress::ReadRequest> requests;
+
+        public:
+            IoUringStorage(const string& file_name, bool truncate) :
+                BufferedStorage(file_name, truncate),
+                reader(compress::BatchReader::create("io_uring",
+                                                     ring_queue_depth, 0)) {}
+
+            void read(char *destination, size_t bytes, off_t offset) {
+                lock_guard<mutex> lock(read_mutex);
+                requests.clear();
+                for (size_t done = 0; done < bytes; done += ring_block_bytes)
+                    requests.push_back(compress::ReadRequest{
+                            fd, static_cast<uint64_t>(offset + done),
+                            min(ring_block_bytes, bytes - done),
+                            destination + done});
+                reader->read_batch(requests);
+            }
+
+            StorageBackend get_backend() const {
+                return StorageBackend::io_uring;
+            }
+        };
+
+        // Bytes in a growing mapping, of a file or of anonymous memory, with
+        // room to grow past the size.
+        class MappedStorage : public Storage {
+        protected:
+            char *data = nullptr;
+            size_t capacity = 0;
+            off_t size = 0;
+
+            virtual void remap(size_t new_capacity) = 0;
+
+            void ensure_capacity(off_t bytes) {
+                if (static_cast<size_t>(bytes) <= capacity) return;
+                size_t new_capacity = max<size_t>(capacity, 1024 * 1024);
+                while (new_capacity < static_cast<size_t>(bytes))
+                    new_capacity *= 2;
+                remap(new_capacity);
+                capacity = new_capacity;
+            }
+
+        public:
+            void read(char *destination, size_t bytes, off_t offset) {
+                if (offset + static_cast<off_t>(bytes) > size)
+                    throw IOException("Read past the end of storage");
+                memcpy(destination, data + offset, bytes);
+            }
+
+            void write_pair(const char *first, size_t first_bytes,
+                            const char *second, size_t second_bytes,
+                            off_t offset) {
+                off_t end = offset + first_bytes + second_bytes;
+                ensure_capacity(end);
+                memcpy(data + offset, first, first_bytes);
+                if (second_bytes > 0)
+                    memcpy(data + offset + first_bytes, second, second_bytes);
+                size = max(size, end);
+            }
+
+            off_t get_size() const {
+                return size;
+            }
+
+            bool allows_concurrent_growth() const {
+                return false;
+            }
+
+            void resize(off_t bytes) {
+                ensure_capacity(bytes);
+                if (bytes > size) memset(data + size, 0, bytes - size);
+                size = bytes;
+            }
+        };
+
+        class MmapStorage : public MappedStorage {
+            string file_name;
+            int fd;
+
+            void remap(size_t new_capacity) {
+                if (ftruncate(fd, new_capacity) < 0)
+                    throw IOException("Fail to extend " + file_name);
+                void *mapped = capacity == 0 ?
+                    mmap(NULL, new_capacity, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, 0) :
+                    mremap(data, capacity, new_capacity, MREMAP_MAYMOVE);
+                if (mapped == MAP_FAILED)
+                    throw IOException("Fail to mmap " + file_name);
+                data = static_cast<char *>(mapped);
+            }
+
+        public:
+            MmapStorage(const string& file_name, bool truncate) :
+                file_name(file_name),
+                fd(open_file(file_name, truncate, 0)) {
+                size = get_fd_size(fd, file_name);
+                ensure_capacity(size);
+            }
+
+            ~MmapStorage() {
+                if (data) munmap(data, capacity);
+                // the file is extended ahead of the size
+                if (ftruncate(fd, size) < 0) {}
+                close(fd);
+            }
+
+            void sync() {
+                if (size > 0 && msync(data, size, MS_SYNC) < 0)
+                    throw IOException("Fail to msync " + file_name);
+            }
+
+            // the pages are dropped from the mapping as well
+            void discard(off_t begin, off_t end) {
+                punch_hole(fd, begin, end);
+            }
+
+            StorageBackend get_backend() const {
+                return StorageBackend::mmap;
+            }
+        };
+
+        class MemoryStorage : public MappedStorage {
+            void remap(size_t new_capacity) {
+                void *mapped = capacity == 0 ?
+                    mmap(NULL, new_capacity, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) :
+                    mremap(data, capacity, new_capacity, MREMAP_MAYMOVE);
+                if (mapped == MAP_FAILED)
+                    throw IOException("Fail to allocate memory storage");
+                data = static_cast<char *>(mapped);
+            }
+
+        public:
+            ~MemoryStorage() {
+                if (data) munmap(data, capacity);
+            }
+
+            void sync() {}
+
+            // whole pages only, which read as zeros afterwards
+            void discard(off_t begin, off_t end) {
+                off_t first = align_up(begin);
+                off_t last = min(align_down(end), size);
+                if (last > first &&
+                    madvise(data + first, last - first, MADV_DONTNEED) < 0) {}
+            }
+
+            bool has_file() const {
+                return false;
+            }
+
+            StorageBackend get_backend() const {
+                return StorageBackend::memory;
+            }
+        };
+    }
+
+    StorageBackend parse_storage_backend(const string& name) {
+        for (auto backend : { StorageBackend::buffered, StorageBackend::direct,
+                    StorageBackend::mmap, StorageBackend::io_uring,
+                    StorageBackend::memory }) {
+            if (name == get_storage_backend_name(backend)) return backend;
+        }
+        throw Fatal("Unknown storage backend %s", name.c_str());
+    }
+
+    const char *get_storage_backend_name(StorageBackend backend) {
+        switch (backend) {
+        case StorageBackend::buffered: return "buffered";
+        case StorageBackend::direct: return "direct";
+        case StorageBackend::mmap: return "mmap";
+        case StorageBackend::io_uring: return "io_uring";
+        case StorageBackend::memory: return "memory";
+        }
+        return "unknown";
+    }
+
+    StorageBackend get_storage_backend(const Options& options,
+                                       const string& key,
+                                       StorageBackend default_backend) {
+        return parse_storage_backend
+            (options.get_string(key, get_storage_backend_name(default_backend)));
+    }
+
+    unique_ptr<Storage> open_storage(StorageBackend backend,
+                                     const string& file_name, bool truncate) {
+        switch (backend) {
+        case StorageBackend::direct:
+            return memory::make_unique<DirectStorage>(file_name, truncate);
+        case StorageBackend::mmap:
+            return memory::make_unique<MmapStorage>(file_name, truncate);
+        case StorageBackend::io_uring:
+            return memory::make_unique<IoUringStorage>(file_name, truncate);
+        case StorageBackend::memory:
+            return memory::make_unique<MemoryStorage>();
+        default:
+            return memory::make_unique<BufferedStorage>(file_name, truncate);
+        }
+    }
+}
@@ -0,0 +1,97 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#ifndef STORAGE_HPP
+#define STORAGE_HPP
+
+#include "options.hpp"
+
+#include <string>
+#include <memory>
+#include <cstddef>
+
+#include <sys/types.h>
+
+/*                                                                          \
+| Backends of the files of the external data structures, accessed by        |
+| offset, so that the I/O strategy can be matched to the device, or taken   |
+| out of a benchmark, at runtime.                                           |
+|                                                                           |
+|  buffered  pread and pwritev through the kernel page cache                |
+|  direct    O_DIRECT, through aligned bounce buffers for unaligned         |
+|            accesses, with the partial block at the end of the last write  |
+|            kept so that appends do not read it back                       |
+|  mmap      a shared mapping of the file, remapped as it grows             |
+|  io_uring  reads split into blocks that are in flight at once, on the     |
+|            rings of the batched closed list probes; writes are buffered   |
+|  memory    anonymous memory, no file at all                               |
+|                                                                           |
+| Reads and writes of distinct bytes may run concurrently, except with the  |
+| mmap and memory backends, whose growth moves the data.                    |
+\==========================================================================*/
+
+namespace utils {
+
+    enum class StorageBackend { buffered, direct, mmap, io_uring, memory };
+
+    // throws Fatal on an unknown name
+    StorageBackend parse_storage_backend(const std::string& name);
+
+    const char *get_storage_backend_name(StorageBackend backend);
+
+    // backend named by an option, e.g. --open-storage
+    StorageBackend get_storage_backend(const Options& options,
+                                       const std::string& key,
+                                       StorageBackend default_backend);
+
+    class Storage {
+    public:
+        virtual ~Storage() {}
+
+        // reads exactly bytes at offset, throws IOException past the end
+        virtual void read(char *destination, std::size_t bytes,
+                          off_t offset) = 0;
+
+        // writes first and then second at offset, in one request if the
+        // backend allows, extending the file as needed
+        virtual void write_pair(const char *first, std::size_t first_bytes,
+                                const char *second, std::size_t second_bytes,
+                                off_t offset) = 0;
+
+        void write(const char *source, std::size_t bytes, off_t offset) {
+            write_pair(source, bytes, nullptr, 0, offset);
+        }
+
+        virtual off_t get_size() const = 0;
+
+        // cuts the file, or extends it with zeros
+        virtual void resize(off_t bytes) = 0;
+
+        // makes what was written durable
+        virtual void sync() = 0;
+        // Gives back the space of [begin, end), which is not read again,
+        // where the file system or memory allows. Its bytes read as zeros
+        // or garbage afterwards; the size does not change.
+        virtual void discard(off_t begin, off_t end) = 0;
+
+        // false if reads must not run while the file grows, as with mmap
+        virtual bool allows_concurrent_growth() const {
+            return true;
+        }
+
+        // false for the memory backend, which has nothing on disk
+        virtual bool has_file() const {
+            return true;
+        }
+
+        virtual StorageBackend get_backend() const = 0;
+    };
+
+    // With truncate, the file is created empty, otherwise an existing file
+    // is opened as it is.
+    std::unique_ptr<Storage> open_storage(StorageBackend backend,
+                                          const std::string& file_name,
+                                          bool truncate = true);
+}
+
+#endif
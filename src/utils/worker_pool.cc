@@ -0,0 +1,92 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#include "worker_pool.hpp"
+#include "memory.hpp"
+#include "wall_timer.hpp"
+#include "../fatal.hpp"
+#include "../utils.hpp"
+
+#include <iostream>
+#include <thread>
+
+using namespace std;
+
+namespace utils {
+
+    WorkerPool::WorkerPool(unsigned n_threads) :
+        n_threads(n_threads)
+    {
+        if (n_threads == 0)
+            throw Fatal("Worker pool needs at least one thread");
+        for (unsigned thread = 1; thread < n_threads; ++thread)
+            workers.push_back(memory::make_unique<scoped_thread>
+                              (std::thread(&WorkerPool::work, this, thread)));
+    }
+
+    WorkerPool::~WorkerPool() {
+        {
+            lock_guard<std::mutex> lock(pool_mutex);
+            stopping = true;
+        }
+        started.notify_all();
+        workers.clear();
+    }
+
+    void WorkerPool::work(unsigned thread) {
+        size_t done = 0; // generation of the last task run
+        unique_lock<std::mutex> lock(pool_mutex);
+        while (true) {
+            started.wait(lock, [this, done] {
+                    return generation != done || stopping;
+                });
+            if (stopping) return;
+            done = generation;
+            auto& current = *task;
+            lock.unlock();
+            exception_ptr thrown;
+            try {
+                current(thread);
+            } catch (...) {
+                thrown = current_exception();
+            }
+            lock.lock();
+            if (thrown && !error) error = thrown;
+            if (--n_running == 0) finished.notify_one();
+        }
+    }
+
+    void WorkerPool::run(const function<void(unsigned)>& task) {
+        {
+            lock_guard<std::mutex> lock(pool_mutex);
+            this->task = &task;
+            ++generation;
+            n_running = n_threads - 1;
+            error = nullptr;
+        }
+        started.notify_all();
+        exception_ptr thrown;
+        try {
+            task(0);
+        } catch (...) {
+            thrown = current_exception();
+        }
+        WallTimer timer;
+        unique_lock<std::mutex> lock(pool_mutex);
+        finished.wait(lock, [this] { return n_running == 0; });
+        timer.stop();
+        ++n_runs;
+        wait_seconds += timer.get_seconds();
+        this->task = nullptr;
+        if (!thrown) thrown = error;
+        if (thrown) rethrow_exception(thrown);
+    }
+
+    void WorkerPool::print_statistics() {
+        lock_guard<std::mutex> lock(pool_mutex);
+        dfpair(stdout, "worker pool threads", "%u", n_threads);
+        dfpair(stdout, "worker pool runs", "%lu", n_runs);
+        cout << "#pair  \"worker pool wait time (s)\"   "
+             << "\"" << wait_seconds << "\"" << endl;
+    }
+}
@@ -0,0 +1,74 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include "scoped_thread.hpp"
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <cstddef>
+
+/*                                                                          \
+| Threads that are started once and run one task after another, for the     |
+| rounds of a parallel search, instead of a thread per task.                |
+|                                                                           |
+| A task is run on every thread of the pool at once, each call being given  |
+| the index of its thread, which it divides the work by. The calling        |
+| thread is thread 0 and runs its share too, so a pool of n threads starts  |
+| n - 1. run returns when all calls are done.                               |
+\==========================================================================*/
+
+namespace utils {
+
+    class WorkerPool {
+        unsigned n_threads;
+        const std::function<void(unsigned)> *task = nullptr;
+        std::size_t generation = 0; // of the task, one per run
+        unsigned n_running = 0;     // workers still in the task
+        bool stopping = false;
+        std::exception_ptr error;   // first thrown by the task
+        std::mutex pool_mutex;
+        std::condition_variable started;
+        std::condition_variable finished;
+
+        // statistics
+        std::size_t n_runs = 0;
+        double wait_seconds = 0; // of the caller, for the other threads
+
+        // last, so that the threads are joined before the rest is destroyed
+        std::vector<std::unique_ptr<scoped_thread> > workers;
+
+        void work(unsigned thread);
+
+    public:
+        // n_threads with the calling thread, at least 1
+        explicit WorkerPool(unsigned n_threads);
+        ~WorkerPool();
+
+        WorkerPool(const WorkerPool &other) = delete;
+        WorkerPool& operator = (const WorkerPool &other) = delete;
+
+        unsigned get_n_threads() const {
+            return n_threads;
+        }
+
+        // Calls task(thread) on each thread of the pool, and returns when all
+        // calls are done. Rethrows the first exception of a call.
+        void run(const std::function<void(unsigned)>& task);
+
+        // first of the part of thread in n items split evenly
+        std::size_t get_first(std::size_t n, unsigned thread) const {
+            return n * thread / n_threads;
+        }
+
+        void print_statistics();
+    };
+}
+
+#endif
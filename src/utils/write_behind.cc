@@ -0,0 +1,108 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#include "write_behind.hpp"
+#include "errors.hpp"
+#include "memory.hpp"
+#include "wall_timer.hpp"
+#include "../utils.hpp"
+
+#include <iostream>
+#include <thread>
+
+using namespace std;
+
+namespace utils {
+
+    WriteBehind::WriteBehind(size_t max_pending) :
+        max_pending(max_pending)
+    {
+        if (max_pending == 0)
+            throw IOException("Write behind needs at least one pending write");
+        writer = memory::make_unique<scoped_thread>
+            (thread(&WriteBehind::run, this));
+    }
+
+    WriteBehind::~WriteBehind() {
+        {
+            lock_guard<std::mutex> lock(write_mutex);
+            stopping = true;
+        }
+        queued.notify_one();
+        writer.reset();
+    }
+
+    void WriteBehind::run() {
+        unique_lock<std::mutex> lock(write_mutex);
+        while (true) {
+            queued.wait(lock, [this] {
+                    return !writes.empty() || stopping;
+                });
+            if (writes.empty()) return;
+            auto write = writes.front();
+            writes.pop_front();
+            lock.unlock();
+            string error;
+            try {
+                write.storage->write(write.data, write.bytes, write.offset);
+            } catch (const IOException& e) {
+                error = e.what();
+            }
+            lock.lock();
+            auto& queue = *write.queue;
+            if (!error.empty() && queue.error.empty()) queue.error = error;
+            queue.done_buffers.push_back(write.data);
+            --queue.n_pending;
+            ++n_writes;
+            n_bytes += write.bytes;
+            completed.notify_all();
+        }
+    }
+
+    void WriteBehind::wait_until(unique_lock<std::mutex>& lock, Queue& queue,
+                                 size_t n_pending) {
+        if (queue.n_pending <= n_pending) return;
+        WallTimer timer;
+        completed.wait(lock, [&queue, n_pending] {
+                return queue.n_pending <= n_pending;
+            });
+        timer.stop();
+        ++n_stalls;
+        stall_seconds += timer.get_seconds();
+    }
+
+    void WriteBehind::submit(Queue& queue, Storage& storage, char *data,
+                             size_t bytes, off_t offset) {
+        {
+            unique_lock<std::mutex> lock(write_mutex);
+            wait_until(lock, queue, max_pending - 1);
+            ++queue.n_pending;
+            writes.push_back(Write{&queue, &storage, data, bytes, offset});
+        }
+        queued.notify_one();
+    }
+
+    void WriteBehind::wait(Queue& queue) {
+        unique_lock<std::mutex> lock(write_mutex);
+        wait_until(lock, queue, 0);
+        if (!queue.error.empty()) throw IOException(queue.error);
+    }
+
+    char *WriteBehind::take_done_buffer(Queue& queue) {
+        lock_guard<std::mutex> lock(write_mutex);
+        if (queue.done_buffers.empty()) return nullptr;
+        auto buffer = queue.done_buffers.back();
+        queue.done_buffers.pop_back();
+        return buffer;
+    }
+
+    void WriteBehind::print_statistics() {
+        lock_guard<std::mutex> lock(write_mutex);
+        dfpair(stdout, "write behind buffers per bucket", "%lu", max_pending);
+        dfpair(stdout, "write behind writes", "%lu", n_writes);
+        dfpair(stdout, "write behind bytes", "%lu", n_bytes);
+        dfpair(stdout, "write behind stalls", "%lu", n_stalls);
+        cout << "#pair  \"write behind stall time (s)\"   "
+             << "\"" << stall_seconds << "\"" << endl;
+    }
+}
@@ -0,0 +1,93 @@
+// Copyright 2017 Shunji Lin. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#ifndef WRITE_BEHIND_HPP
+#define WRITE_BEHIND_HPP
+
+#include "storage.hpp"
+#include "scoped_thread.hpp"
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <vector>
+#include <cstddef>
+
+/*                                                                          \
+| Background writer of the full append buffers of the open list buckets,    |
+| so that expansion fills fresh buffers while full ones go out to disk.     |
+|                                                                           |
+| The writes of a file are tracked by its Queue, of which at most           |
+| max_pending may be in flight; submitting more waits for the oldest. The   |
+| owner of a file waits for its writes before reading what they cover, and  |
+| takes the buffers of completed writes back for reuse.                     |
+\==========================================================================*/
+
+namespace utils {
+
+    class WriteBehind {
+    public:
+        // writes of one file
+        class Queue {
+            friend class WriteBehind;
+            std::size_t n_pending = 0;
+            std::vector<char *> done_buffers;
+            std::string error; // of the first failed write
+        };
+
+    private:
+        struct Write {
+            Queue *queue;
+            Storage *storage;
+            char *data;
+            std::size_t bytes;
+            off_t offset;
+        };
+
+        std::size_t max_pending;
+        std::deque<Write> writes;
+        bool stopping = false;
+        std::mutex write_mutex;
+        std::condition_variable queued;
+        std::condition_variable completed;
+
+        // statistics
+        std::size_t n_writes = 0;
+        std::size_t n_bytes = 0;
+        std::size_t n_stalls = 0; // submits and reads that had to wait
+        double stall_seconds = 0;
+
+        // last, so that the thread is joined before the rest is destroyed
+        std::unique_ptr<scoped_thread> writer;
+
+        void run();
+        void wait_until(std::unique_lock<std::mutex>& lock, Queue& queue,
+                        std::size_t n_pending);
+
+    public:
+        explicit WriteBehind(std::size_t max_pending);
+        // finishes the queued writes
+        ~WriteBehind();
+
+        WriteBehind(const WriteBehind &other) = delete;
+        WriteBehind& operator = (const WriteBehind &other) = delete;
+
+        // Queues bytes at data to be written at offset of storage, after
+        // waiting while max_pending writes of the queue are in flight. The
+        // writer owns data until take_done_buffer hands it back.
+        void submit(Queue& queue, Storage& storage, char *data,
+                    std::size_t bytes, off_t offset);
+
+        // waits for all writes of the queue, throws IOException if one failed
+        void wait(Queue& queue);
+
+        // buffer of a completed write of the queue, nullptr if there is none
+        char *take_done_buffer(Queue& queue);
+
+        void print_statistics();
+    };
+}
+
+#endif